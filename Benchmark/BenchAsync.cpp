@@ -0,0 +1,252 @@
+#include "Source.h"
+#include "AsyncVerbs.h"
+#include "ExtendedVerbs.h"
+
+constexpr auto AsyncBenchQueueDepth = 256;
+constexpr auto AsyncMessageSize = 8;
+constexpr auto AsyncCheckSize = 16;
+
+/* Offsets in the first half of the loopback buffer used by the checked round, the timed writes land in the second */
+constexpr auto CheckSendOffset = 64;
+constexpr auto CheckRecvOffset = 128;
+constexpr auto CheckReadOffset = 192;
+constexpr auto CheckReadIntoOffset = 256;
+constexpr auto CheckCounterOffset = 320;
+constexpr auto CheckOriginalOffset = 328;
+
+enum AsyncLoop {
+    LoopRaw,            /* Post and poll inline, wr_id is unused */
+    LoopCallback,       /* wr_id points at a request with a completion function */
+    LoopCoroutine       /* One coroutine per outstanding write, resumed through wr_id */
+};
+
+static const char* asyncLoopName(enum AsyncLoop loop)
+{
+    return loop == LoopRaw ? "raw poll" : loop == LoopCallback ? "callback" : "coroutine";
+}
+
+/* Shared state of one measured run */
+struct AsyncBench {
+    struct RDMAResource*    res;
+    uint64_t                target;         /* Writes to complete */
+    uint64_t                issued;
+    uint64_t                completed;
+    int                     failed;
+};
+
+static int postWrite(struct AsyncBench* bench, uint64_t wrId)
+{
+    struct ibv_sge sge;
+    sge.addr = (uintptr_t)bench->res->buffer;
+    sge.length = AsyncMessageSize;
+    sge.lkey = bench->res->memoryHandle->lkey;
+
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = wrId;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_RDMA_WRITE;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.wr.rdma.remote_addr = bench->res->remoteBuffer + BufferSize / 2;
+    wr.wr.rdma.rkey = bench->res->remoteKey;
+    bench->issued++;
+    return ibv_post_send(bench->res->queuePair, &wr, &badWR);
+}
+
+/* Hand written loop keeping `depth` writes in flight */
+static void runRaw(struct AsyncBench* bench, int depth)
+{
+    for (int i = 0; i < depth && bench->issued < bench->target; i++)
+        bench->failed |= postWrite(bench, 0);
+
+    struct ibv_wc wc[AsyncPollBatch];
+    while (bench->completed < bench->target && !bench->failed) {
+        int polled = ibv_poll_cq(bench->res->compQueue, AsyncPollBatch, wc);
+        for (int i = 0; i < polled; i++) {
+            bench->failed |= wc[i].status != IBV_WC_SUCCESS;
+            bench->completed++;
+            if (bench->issued < bench->target)
+                bench->failed |= postWrite(bench, 0);
+        }
+        bench->failed |= polled < 0;
+    }
+}
+
+/* Request carrying its own completion function, the usual C alternative to coroutines */
+struct CallbackRequest {
+    void                    (*complete)(struct CallbackRequest* request, const struct ibv_wc* wc);
+    struct AsyncBench*      bench;
+};
+
+static void writeCompleted(struct CallbackRequest* request, const struct ibv_wc* wc)
+{
+    struct AsyncBench* bench = request->bench;
+    bench->failed |= wc->status != IBV_WC_SUCCESS;
+    bench->completed++;
+    if (bench->issued < bench->target)
+        bench->failed |= postWrite(bench, (uintptr_t)request);
+}
+
+static void runCallback(struct AsyncBench* bench, int depth)
+{
+    std::vector<CallbackRequest> requests(depth);
+    for (int i = 0; i < depth && bench->issued < bench->target; i++) {
+        requests[i].complete = writeCompleted;
+        requests[i].bench = bench;
+        bench->failed |= postWrite(bench, (uintptr_t)&requests[i]);
+    }
+
+    struct ibv_wc wc[AsyncPollBatch];
+    while (bench->completed < bench->target && !bench->failed) {
+        int polled = ibv_poll_cq(bench->res->compQueue, AsyncPollBatch, wc);
+        for (int i = 0; i < polled; i++) {
+            struct CallbackRequest* request = (struct CallbackRequest*)(uintptr_t)wc[i].wr_id;
+            request->complete(request, &wc[i]);
+        }
+        bench->failed |= polled < 0;
+    }
+}
+
+/* Writer coroutine, issues writes until the run has enough of them */
+static AsyncTask writeLoop(struct AsyncExecutor* exec, struct AsyncBench* bench)
+{
+    struct RDMAResource* res = bench->res;
+    while (bench->issued < bench->target && !bench->failed) {
+        bench->issued++;
+        struct AsyncResult result = co_await asyncWrite(exec, res->buffer, AsyncMessageSize, res->memoryHandle->lkey,
+            res->remoteBuffer + BufferSize / 2, res->remoteKey);
+        bench->failed |= result.status != 0;
+        bench->completed++;
+    }
+}
+
+static void runCoroutine(struct AsyncBench* bench, int depth)
+{
+    struct AsyncExecutor exec;
+    bench->failed |= createAsyncExecutor(&exec, bench->res, -1, depth);
+    for (int i = 0; i < depth && !bench->failed; i++)
+        spawnAsync(&exec, writeLoop(&exec, bench));
+    if (!bench->failed)
+        bench->failed |= runAsyncExecutor(&exec);
+}
+
+/* Receiving side of the checked send, spawned first so the receive is posted before the send */
+static AsyncTask checkRecv(struct AsyncExecutor* exec, struct RDMAResource* res, int* failed)
+{
+    char* into = res->buffer + CheckRecvOffset;
+    struct AsyncResult result = co_await asyncRecv(exec, into, AsyncCheckSize, res->memoryHandle->lkey);
+    *failed |= result.status != 0 || result.byteLen != AsyncCheckSize ||
+        memcmp(into, res->buffer + CheckSendOffset, AsyncCheckSize);
+}
+
+/* One send, read and (when the device has them) fetch-add and compare-swap, each result checked */
+static AsyncTask checkOperations(struct AsyncExecutor* exec, struct RDMAResource* res, bool atomics, int* failed)
+{
+    uint32_t lkey = res->memoryHandle->lkey;
+    for (int i = 0; i < AsyncCheckSize; i++) {
+        res->buffer[CheckSendOffset + i] = (char)(0xa0 + i);
+        res->buffer[CheckReadOffset + i] = (char)(0x50 + i);
+    }
+    memset(res->buffer + CheckReadIntoOffset, 0, AsyncCheckSize);
+
+    struct AsyncResult result = co_await asyncSend(exec, res->buffer + CheckSendOffset, AsyncCheckSize, lkey);
+    *failed |= result.status != 0;
+
+    char* readInto = res->buffer + CheckReadIntoOffset;
+    result = co_await asyncRead(exec, readInto, AsyncCheckSize, lkey, res->remoteBuffer + CheckReadOffset,
+        res->remoteKey);
+    *failed |= result.status != 0 || memcmp(readInto, res->buffer + CheckReadOffset, AsyncCheckSize);
+
+    if (!atomics)
+        co_return;
+
+    uint64_t* counter = (uint64_t*)(res->buffer + CheckCounterOffset);
+    uint64_t* original = (uint64_t*)(res->buffer + CheckOriginalOffset);
+    *counter = 5;
+    result = co_await asyncFetchAdd(exec, original, lkey, res->remoteBuffer + CheckCounterOffset, res->remoteKey, 3);
+    *failed |= result.status != 0 || *original != 5 || *counter != 8;
+
+    result = co_await asyncCompareSwap(exec, original, lkey, res->remoteBuffer + CheckCounterOffset, res->remoteKey,
+        8, 42);
+    *failed |= result.status != 0 || *original != 8 || *counter != 42;
+}
+
+/* Run every awaitable besides the write once through the executor and check what landed */
+static int checkAsyncOperations(struct RDMAResource* res)
+{
+    struct AsyncExecutor exec;
+    bool atomics = res->deviceAttr.atomic_cap != IBV_ATOMIC_NONE;
+    int failed = createAsyncExecutor(&exec, res, -1, 2);
+    if (!failed) {
+        spawnAsync(&exec, checkRecv(&exec, res, &failed));
+        spawnAsync(&exec, checkOperations(&exec, res, atomics, &failed));
+        failed |= runAsyncExecutor(&exec);
+    }
+
+    fprintf(stdout, "send/recv, read%s: %s\n", atomics ? ", fetch-add, compare-swap" : " (no atomics on the device)",
+        failed ? "FAILED" : "ok");
+    return failed;
+}
+
+/* Cost per operation of the coroutine API against the hand written poll loops it replaces */
+int benchAsync(const struct benchConfig_t* config)
+{
+    struct RDMAResource res;
+    struct ExtendedQueue eq;
+    openBenchResource(config, &res);
+    if (createExtendedQueue(&res, &eq, AsyncBenchQueueDepth, 0, ExtendedQueueClassic) || connectLoopback(&res)) {
+        destroyExtendedQueue(&res, &eq);
+        destroyRDMAResource(&res);
+        return 1;
+    }
+
+    const int depths[] = { 1, 16, 128 };
+    int result = checkAsyncOperations(&res);
+    fprintf(stdout, "%-10s %6s %10s %12s %12s %14s\n", "loop", "depth", "Mops/s", "ns/op", "cycles/op", "frame allocs");
+
+    for (int depth : depths) {
+        double rawCycles = 0;
+        for (int loop = LoopRaw; loop <= LoopCoroutine && !result; loop++) {
+            struct AsyncBench bench;
+            bench.res = &res;
+            bench.target = config->iterations;
+            bench.issued = 0;
+            bench.completed = 0;
+            bench.failed = 0;
+
+            uint64_t allocations = asyncFrameAllocations;
+            uint64_t start = nowNs();
+            uint64_t cycles = readCycles();
+            if (loop == LoopRaw)
+                runRaw(&bench, depth);
+            else if (loop == LoopCallback)
+                runCallback(&bench, depth);
+            else
+                runCoroutine(&bench, depth);
+            cycles = readCycles() - cycles;
+            uint64_t elapsed = nowNs() - start;
+
+            if (bench.failed || bench.completed != bench.target) {
+                fprintf(stderr, "%s loop at depth %d failed after %lu writes\n", asyncLoopName((AsyncLoop)loop), depth,
+                    (unsigned long)bench.completed);
+                result = 1;
+                break;
+            }
+
+            double perOp = (double)cycles / bench.completed;
+            if (loop == LoopRaw)
+                rawCycles = perOp;
+            fprintf(stdout, "%-10s %6d %10.2f %12.1f %12.1f %14lu", asyncLoopName((AsyncLoop)loop), depth,
+                bench.completed * 1e3 / elapsed, (double)elapsed / bench.completed, perOp,
+                (unsigned long)(asyncFrameAllocations - allocations));
+            if (loop != LoopRaw)
+                fprintf(stdout, "   %+.1f cycles/op vs raw", perOp - rawCycles);
+            fprintf(stdout, "\n");
+        }
+    }
+
+    destroyExtendedQueue(&res, &eq);
+    destroyRDMAResource(&res);
+    return result;
+}
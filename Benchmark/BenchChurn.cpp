@@ -0,0 +1,83 @@
+#include "Source.h"
+#include "VerbsResources.h"
+
+#include <dirent.h>
+#include <unistd.h>
+
+constexpr auto ChurnWarmup = 1000;
+constexpr auto FullResourceRatio = 1000;		/* One device open per this many QP cycles */
+constexpr auto LeakRssLimit = 4 * 1024 * 1024;
+
+/* Resident set size in bytes */
+static long residentBytes()
+{
+    long pages = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/* Number of open file descriptors */
+static int openDescriptors()
+{
+    int count = 0;
+    DIR* dir = opendir("/proc/self/fd");
+    if (!dir)
+        return 0;
+    while (readdir(dir))
+        count++;
+    closedir(dir);
+    return count;
+}
+
+/* Create and destroy QPs on one PD/CQ, then whole resource sets, checking for leaks */
+int benchChurn(const struct benchConfig_t* config)
+{
+    VerbsResource res;
+    if (res.create(config->deviceName, config->devicePort))
+        return 1;
+
+    for (int i = 0; i < ChurnWarmup; i++) {
+        QueuePair qp(res.protectedDomain, res.compQueue);
+        if (!qp)
+            return 1;
+    }
+
+    long rssBefore = residentBytes();
+    int fdsBefore = openDescriptors();
+
+    uint64_t start = nowNs();
+    for (int i = 0; i < config->iterations; i++) {
+        QueuePair qp(res.protectedDomain, res.compQueue);
+        if (!qp)
+            return 1;
+    }
+    uint64_t elapsed = nowNs() - start;
+    fprintf(stdout, "QP create/destroy: %d cycles, %.0f cycles/s, %.2f us/cycle\n", config->iterations,
+        config->iterations * 1e9 / elapsed, (double)elapsed / config->iterations / 1000);
+
+    int fullCycles = config->iterations / FullResourceRatio + 1;
+    start = nowNs();
+    for (int i = 0; i < fullCycles; i++) {
+        VerbsResource cycle;
+        if (cycle.create(config->deviceName, config->devicePort))
+            return 1;
+    }
+    elapsed = nowNs() - start;
+    fprintf(stdout, "Full resource create/destroy: %d cycles, %.0f cycles/s, %.2f us/cycle\n", fullCycles,
+        fullCycles * 1e9 / elapsed, (double)elapsed / fullCycles / 1000);
+
+    long rssGrowth = residentBytes() - rssBefore;
+    int fdGrowth = openDescriptors() - fdsBefore;
+    fprintf(stdout, "Leak check: RSS growth %ld bytes, fd growth %d\n", rssGrowth, fdGrowth);
+
+    if (rssGrowth > LeakRssLimit || fdGrowth > 0) {
+        fprintf(stderr, "Resource leak detected\n");
+        return 1;
+    }
+    return 0;
+}
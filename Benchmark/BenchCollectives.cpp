@@ -0,0 +1,276 @@
+#include "Source.h"
+#include "Collectives.h"
+
+#include <atomic>
+#include <thread>
+
+constexpr auto CollectiveMinSize = 4096;
+constexpr auto CollectiveDefaultMaxSize = 16 * 1024 * 1024;
+constexpr auto CollectiveBytesPerPoint = 1024ull * 1024 * 1024;	/* Caps iterations of large messages */
+constexpr auto CollectiveMinIterations = 5;
+constexpr auto KernelBufferSize = 1024 * 1024;
+constexpr auto KernelRepeats = 256;
+constexpr auto CheckPattern = 251;			/* Small integers keep float sums exact */
+
+enum CollectiveKind {
+    KindBroadcast,
+    KindAllreduce,
+    KindAllgather
+};
+
+static const char* collectiveKindName(enum CollectiveKind kind)
+{
+    return kind == KindBroadcast ? "broadcast" : kind == KindAllreduce ? "allreduce" : "allgather";
+}
+
+/* Generation counting spin barrier for the rank threads. A failed rank releases
+ * everybody, wait() then returns false */
+struct SpinBarrier {
+    std::atomic<int>    arrived;
+    std::atomic<int>    generation;
+    std::atomic<bool>   failed;
+    int                 count;
+
+    bool wait() {
+        int current = generation.load();
+        if (arrived.fetch_add(1) + 1 == count) {
+            arrived = 0;
+            generation++;
+            return !failed;
+        }
+        while (generation.load() == current && !failed)
+            ;
+        return !failed;
+    }
+};
+
+/* One measured point of the sweep */
+struct CollectivePoint {
+    enum CollectiveAlgorithm    algorithm;
+    enum CollectiveKind         kind;
+    size_t                      size;
+    int                         iterations;
+};
+
+/* Reduction kernel throughput for every kernel set the CPU supports */
+static void benchKernels()
+{
+    AlignedBuffer target(KernelBufferSize);
+    AlignedBuffer source(KernelBufferSize);
+    memset(source.get(), 1, KernelBufferSize);
+
+    fprintf(stdout, "%-8s %-8s %-4s %10s\n", "isa", "type", "op", "GB/s");
+    for (int isa = ReduceScalar; isa <= reduceBestIsa(); isa++) {
+        for (int type = 0; type < ReduceTypeCount; type++) {
+            for (int op = 0; op < ReduceOpCount; op++) {
+                size_t count = KernelBufferSize / reduceTypeSize((ReduceType)type);
+                memset(target.get(), 0, KernelBufferSize);
+                uint64_t start = nowNs();
+                for (int i = 0; i < KernelRepeats; i++)
+                    reduceInto(target.get(), source.get(), count, (ReduceType)type, (ReduceOp)op, (ReduceIsa)isa);
+                uint64_t elapsed = nowNs() - start;
+                fprintf(stdout, "%-8s %-8s %-4s %10.2f\n", reduceIsaName((ReduceIsa)isa), reduceTypeName((ReduceType)type),
+                    reduceOpName((ReduceOp)op), (double)KernelBufferSize * KernelRepeats / elapsed);
+            }
+        }
+    }
+}
+
+/* One collective call of the point, broadcasts come from rank 0 */
+static int runPoint(struct Communicator* comm, const struct CollectivePoint* point, enum ReduceOp op)
+{
+    if (point->kind == KindBroadcast)
+        return collectiveBroadcast(comm, point->size, 0, point->algorithm);
+    if (point->kind == KindAllreduce)
+        return collectiveAllreduce(comm, point->size / sizeof(float), ReduceFloat, op, point->algorithm);
+    return collectiveAllgather(comm, point->size / comm->size, point->algorithm);
+}
+
+static uint8_t patternByte(size_t i, int rank)
+{
+    return (uint8_t)(i * 7 + rank * 31 + 1);
+}
+
+/* Rank specific input: own pattern at offset 0 (broadcast) or in the own segment (allgather),
+ * i % CheckPattern + rank for every allreduce element */
+static void seedPoint(struct Communicator* comm, const struct CollectivePoint* point)
+{
+    if (point->kind == KindAllreduce) {
+        float* values = (float*)comm->data;
+        for (size_t i = 0; i < point->size / sizeof(float); i++)
+            values[i] = (float)(i % CheckPattern + comm->rank);
+        return;
+    }
+
+    size_t length = point->kind == KindBroadcast ? point->size : point->size / comm->size;
+    char* own = comm->data + (point->kind == KindBroadcast ? 0 : comm->rank * length);
+    memset(comm->data, 0xff, point->size);
+    for (size_t i = 0; i < length; i++)
+        own[i] = patternByte(i, comm->rank);
+}
+
+/* Compare data with the result expected from seedPoint() inputs, returns the first bad byte offset or -1 */
+static int64_t verifyPoint(const struct Communicator* comm, const struct CollectivePoint* point, enum ReduceOp op)
+{
+    int size = comm->size;
+    if (point->kind == KindAllreduce) {
+        const float* values = (const float*)comm->data;
+        for (size_t i = 0; i < point->size / sizeof(float); i++) {
+            float base = (float)(i % CheckPattern);
+            float expected = op == ReduceSum ? base * size + size * (size - 1) / 2 :
+                op == ReduceMin ? base : base + size - 1;
+            if (values[i] != expected)
+                return (int64_t)(i * sizeof(float));
+        }
+        return -1;
+    }
+
+    std::vector<uint8_t> expected(point->size);
+    size_t length = point->kind == KindBroadcast ? point->size : point->size / size;
+    int segments = point->kind == KindBroadcast ? 1 : size;
+    for (int segment = 0; segment < segments; segment++) {
+        for (size_t i = 0; i < length; i++)
+            expected[segment * length + i] = patternByte(i, segment);
+    }
+
+    size_t checked = segments * length;
+    if (!memcmp(comm->data, expected.data(), checked))
+        return -1;
+    for (size_t i = 0; i < checked; i++) {
+        if ((uint8_t)comm->data[i] != expected[i])
+            return (int64_t)i;
+    }
+    return -1;
+}
+
+/* Untimed calls of the point on seeded input, every reduction op for allreduce */
+static int checkPoint(struct Communicator* comm, const struct CollectivePoint* point)
+{
+    int ops = point->kind == KindAllreduce ? ReduceOpCount : 1;
+    for (int op = 0; op < ops; op++) {
+        seedPoint(comm, point);
+        if (runPoint(comm, point, (ReduceOp)op))
+            return 1;
+
+        int64_t offset = verifyPoint(comm, point, (ReduceOp)op);
+        if (offset >= 0) {
+            fprintf(stderr, "Rank %d: %s %s%s%s of %zu bytes has wrong result at offset %ld\n", comm->rank,
+                collectiveAlgorithmName(point->algorithm), collectiveKindName(point->kind),
+                point->kind == KindAllreduce ? " " : "", point->kind == KindAllreduce ? reduceOpName((ReduceOp)op) : "",
+                point->size, (long)offset);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Check and then time every point of the sweep on one rank, elapsed time per point goes to `elapsed`.
+ * A failure releases the other ranks through the barrier */
+static void runRank(struct Communicator* comm, const std::vector<CollectivePoint>* points, struct SpinBarrier* barrier,
+    uint64_t* elapsed)
+{
+    for (size_t p = 0; p < points->size(); p++) {
+        const struct CollectivePoint& point = (*points)[p];
+        if (!barrier->wait())
+            return;
+        if (checkPoint(comm, &point)) {
+            barrier->failed = true;
+            return;
+        }
+        if (!barrier->wait())
+            return;
+
+        uint64_t start = nowNs();
+        for (int i = 0; i < point.iterations; i++) {
+            if (runPoint(comm, &point, ReduceSum)) {
+                /* Ranks released by another rank's failure stay quiet */
+                if (!barrier->failed)
+                    fprintf(stderr, "Rank %d: %s %s of %zu bytes failed\n", comm->rank, collectiveAlgorithmName(point.algorithm),
+                        collectiveKindName(point.kind), point.size);
+                barrier->failed = true;
+                return;
+            }
+        }
+        elapsed[p] = nowNs() - start;
+    }
+}
+
+/* One table row per point, the slowest rank defines the collective time */
+static void printPoints(int size, const std::vector<CollectivePoint>& points, const std::vector<uint64_t>& elapsed)
+{
+    fprintf(stdout, "\n%-6s %-6s %-10s %12s %12s %12s\n", "ranks", "algo", "collective", "bytes", "time us", "algbw GB/s");
+    for (size_t p = 0; p < points.size(); p++) {
+        uint64_t slowest = 0;
+        for (int r = 0; r < size; r++)
+            slowest = elapsed[r * points.size() + p] > slowest ? elapsed[r * points.size() + p] : slowest;
+        double perCall = (double)slowest / points[p].iterations;
+        fprintf(stdout, "%-6d %-6s %-10s %12zu %12.2f %12.2f\n", size, collectiveAlgorithmName(points[p].algorithm),
+            collectiveKindName(points[p].kind), points[p].size, perCall / 1000, points[p].size / perCall);
+    }
+}
+
+/* Algorithm bandwidth of broadcast, allreduce and allgather vs message size and rank count,
+ * every rank is a thread with its own device context in this process */
+int benchCollectives(const struct benchConfig_t* config)
+{
+    size_t maxSize = config->size ? config->size : CollectiveDefaultMaxSize;
+    benchKernels();
+
+    const int rankCounts[] = { 2, 4, 8 };
+    for (int size : rankCounts) {
+        std::vector<RDMAResource> resources(size);
+        std::vector<Communicator> comms(size);
+        std::vector<Communicator*> group(size);
+        int created = 0;
+        int result = 0;
+
+        for (int r = 0; r < size && !result; r++) {
+            openBenchResource(config, &resources[r]);
+            result = createCommunicator(&comms[r], &resources[r], r, size, maxSize);
+            group[r] = &comms[r];
+            created++;
+        }
+        if (!result)
+            result = connectLocalCommunicators(group.data(), size);
+
+        if (!result) {
+            std::vector<CollectivePoint> points;
+            for (int algorithm = CollectiveRing; algorithm <= CollectiveTree; algorithm++) {
+                for (int kind = KindBroadcast; kind <= KindAllgather; kind++) {
+                    for (size_t bytes = CollectiveMinSize; bytes <= maxSize; bytes *= 4) {
+                        uint64_t limit = CollectiveBytesPerPoint / bytes;
+                        int iterations = config->iterations < (int)limit ? config->iterations : (int)limit;
+                        points.push_back({ (CollectiveAlgorithm)algorithm, (CollectiveKind)kind, bytes,
+                            iterations > CollectiveMinIterations ? iterations : CollectiveMinIterations });
+                    }
+                }
+            }
+
+            struct SpinBarrier barrier;
+            barrier.arrived = 0;
+            barrier.generation = 0;
+            barrier.failed = false;
+            barrier.count = size;
+            for (int r = 0; r < size; r++)
+                comms[r].abort = &barrier.failed;
+
+            std::vector<uint64_t> elapsed(points.size() * size);
+            std::vector<std::thread> threads;
+            for (int r = 0; r < size; r++)
+                threads.emplace_back(runRank, &comms[r], &points, &barrier, &elapsed[r * points.size()]);
+            for (auto& thread : threads)
+                thread.join();
+            result = barrier.failed;
+            if (!result)
+                printPoints(size, points, elapsed);
+        }
+
+        for (int r = 0; r < created; r++) {
+            destroyCommunicator(&comms[r]);
+            destroyRDMAResource(&resources[r]);
+        }
+        if (result)
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include "Source.h"
+
+#include <algorithm>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* CPU timestamp counter, nanoseconds where no TSC is available */
+uint64_t readCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return nowNs();
+#endif
+}
+
+/* Open device and create resources selected by the config */
+void openBenchResource(const struct benchConfig_t* config, struct RDMAResource* res)
+{
+    memset(res, 0, sizeof(RDMAResource));
+    res->deviceName = config->deviceName;
+    res->devicePort = config->devicePort;
+    createRDMAResource(res);
+}
+
+/* Connect resource QP to itself and move it to RTS */
+int connectLoopback(struct RDMAResource* res)
+{
+    res->remoteBuffer = (uintptr_t)res->buffer;
+    res->remoteKey = res->memoryHandle->rkey;
+    res->remoteQueueNum = res->queuePair->qp_num;
+    res->remoteId = res->portAttr.lid;
+    res->remoteGid = res->localGid;
+
+    if (modifyQPtoInit(res))
+        return 1;
+    if (modifyQPtoRTR(res))
+        return 1;
+    return modifyQPtoRTS(res);
+}
+
+/* Connect the QPs of two resources to each other and move both to RTS */
+int connectPair(struct RDMAResource* first, struct RDMAResource* second)
+{
+    struct RDMAResource* ends[2] = { first, second };
+    for (int i = 0; i < 2; i++) {
+        struct RDMAResource* res = ends[i];
+        struct RDMAResource* peer = ends[1 - i];
+        res->remoteBuffer = (uintptr_t)peer->buffer;
+        res->remoteKey = peer->memoryHandle->rkey;
+        res->remoteQueueNum = peer->queuePair->qp_num;
+        res->remoteId = peer->portAttr.lid;
+        res->remoteGid = peer->localGid;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (modifyQPtoInit(ends[i]))
+            return 1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (modifyQPtoRTR(ends[i]) || modifyQPtoRTS(ends[i]))
+            return 1;
+    }
+    return 0;
+}
+
+/* Replace resource QP with one of the given send/recv depth and inline size,
+ * connected to itself. `res` is filled with a non owning view */
+int createLoopbackQueuePair(struct VerbsResource* owner, struct RDMAResource* res, uint32_t depth, uint32_t maxInline)
+{
+    struct ibv_qp_init_attr qpInitAttr;
+    memset(&qpInitAttr, 0, sizeof(ibv_qp_init_attr));
+    qpInitAttr.qp_type = IBV_QPT_RC;
+    qpInitAttr.sq_sig_all = 0;
+    qpInitAttr.send_cq = owner->compQueue.get();
+    qpInitAttr.recv_cq = owner->compQueue.get();
+    qpInitAttr.cap.max_send_wr = depth;
+    qpInitAttr.cap.max_recv_wr = depth;
+    qpInitAttr.cap.max_send_sge = 1;
+    qpInitAttr.cap.max_recv_sge = 1;
+    qpInitAttr.cap.max_inline_data = maxInline;
+
+    owner->queuePair = QueuePair(owner->protectedDomain, &qpInitAttr);
+    if (!owner->queuePair)
+        return 1;
+
+    owner->view(res);
+    return connectLoopback(res);
+}
+
+/* Wait for one completion on the resource CQ, returns 0 on success */
+int waitCompletion(struct RDMAResource* res, struct ibv_wc* wc)
+{
+    int polled = 0;
+    while (!polled)
+        polled = ibv_poll_cq(res->compQueue, 1, wc);
+
+    if (polled < 0) {
+        fprintf(stderr, "Poll CQ failed\n");
+        return 1;
+    }
+    if (wc->status != IBV_WC_SUCCESS) {
+        fprintf(stderr, "Completion with status %s, wr_id %lu\n", ibv_wc_status_str(wc->status), (unsigned long)wc->wr_id);
+        return 1;
+    }
+    return 0;
+}
+
+/* Sort samples and compute latency percentiles */
+void computeLatencyStats(std::vector<uint64_t>& samples, struct LatencyStats* stats)
+{
+    memset(stats, 0, sizeof(LatencyStats));
+    if (samples.empty())
+        return;
+
+    std::sort(samples.begin(), samples.end());
+
+    double total = 0, squares = 0;
+    for (uint64_t sample : samples) {
+        total += sample;
+        squares += (double)sample * sample;
+    }
+
+    size_t last = samples.size() - 1;
+    stats->samples = samples.size();
+    stats->minNs = samples.front();
+    stats->avgNs = total / samples.size();
+    stats->stdevNs = sqrt(std::max(0.0, squares / samples.size() - stats->avgNs * stats->avgNs));
+    stats->p50Ns = samples[last * 50 / 100];
+    stats->p99Ns = samples[last * 99 / 100];
+    stats->p999Ns = samples[last * 999 / 1000];
+    stats->p9999Ns = samples[last * 9999 / 10000];
+    stats->maxNs = samples.back();
+}
+
+/* Print latency percentiles in microseconds */
+void printLatencyStats(const char* name, const struct LatencyStats* stats)
+{
+    fprintf(stdout, "%-24s samples=%lu min=%.2fus avg=%.2fus p50=%.2fus p99=%.2fus p99.99=%.2fus max=%.2fus\n",
+        name, (unsigned long)stats->samples, stats->minNs / 1000, stats->avgNs / 1000, stats->p50Ns / 1000,
+        stats->p99Ns / 1000, stats->p9999Ns / 1000, stats->maxNs / 1000);
+}
@@ -0,0 +1,94 @@
+#include "Source.h"
+#include "ExtendedVerbs.h"
+
+constexpr auto ExtDepth = 256;
+constexpr auto ExtBatch = 16;
+constexpr auto ExtMessageSize = 32;
+
+/* Run inline RDMA write batches on one path and print rate and CPU cycles per message */
+static int runPostPath(const struct benchConfig_t* config, const char* name, unsigned flags)
+{
+    struct RDMAResource res;
+    openBenchResource(config, &res);
+
+    struct ExtendedQueue eq;
+    if (createExtendedQueue(&res, &eq, ExtDepth, ExtMessageSize, flags) || connectLoopback(&res)) {
+        destroyExtendedQueue(&res, &eq);
+        destroyRDMAResource(&res);
+        return 1;
+    }
+
+    /* A fallback would repeat another row under the wrong name */
+    bool fellBack = (!(flags & ExtendedQueueClassic) && !eq.extended) || ((flags & ExtendedQueueLockFree) && !eq.parentDomain);
+    if (fellBack) {
+        fprintf(stdout, "%-18s not supported, fell back to %s%s, skipped\n", name,
+            eq.extended ? "extended" : "classic", eq.parentDomain ? " lock free" : "");
+        destroyExtendedQueue(&res, &eq);
+        destroyRDMAResource(&res);
+        return 0;
+    }
+
+    uint64_t batches = (config->iterations + ExtBatch - 1) / ExtBatch;
+    uint64_t localAddr = (uintptr_t)res.buffer;
+    uint64_t remoteAddr = res.remoteBuffer + BufferSize / 2;
+    const int window = ExtDepth / ExtBatch;
+
+    struct ExtendedCompletion completions[QueueSize];
+    uint64_t posted = 0, completed = 0;
+    uint64_t postCycles = 0, pollCycles = 0;
+    uint64_t firstTimestamp = 0, lastTimestamp = 0;
+    int result = 0;
+
+    uint64_t start = nowNs();
+    while (completed < batches && !result) {
+        if (posted < batches && posted - completed < (uint64_t)window) {
+            uint64_t cycles = readCycles();
+            result = postExtendedWrites(&res, &eq, posted * ExtBatch, ExtBatch, localAddr, ExtMessageSize, remoteAddr, true);
+            postCycles += readCycles() - cycles;
+            posted++;
+            continue;
+        }
+
+        uint64_t cycles = readCycles();
+        int polled = pollExtendedQueue(&res, &eq, completions, QueueSize);
+        pollCycles += readCycles() - cycles;
+        if (polled < 0) {
+            result = 1;
+            break;
+        }
+        for (int i = 0; i < polled; i++) {
+            if (completions[i].status != IBV_WC_SUCCESS) {
+                fprintf(stderr, "Completion with status %s\n", ibv_wc_status_str(completions[i].status));
+                result = 1;
+            }
+            if (!firstTimestamp)
+                firstTimestamp = completions[i].timestamp;
+            lastTimestamp = completions[i].timestamp;
+        }
+        completed += polled;
+    }
+    uint64_t elapsed = nowNs() - start;
+
+    uint64_t messages = batches * ExtBatch;
+    fprintf(stdout, "%-18s %10.2f Mmsg/s  post %6.1f cycles/msg  poll %6.1f cycles/msg",
+        name, messages * 1e3 / elapsed,
+        (double)postCycles / messages, (double)pollCycles / messages);
+    if (eq.timestamps && lastTimestamp > firstTimestamp)
+        fprintf(stdout, "  HW %.2f Mmsg/s", messages * 1e3 / timestampToNs(&eq, lastTimestamp - firstTimestamp));
+    fprintf(stdout, "\n");
+
+    destroyExtendedQueue(&res, &eq);
+    destroyRDMAResource(&res);
+    return result;
+}
+
+/* Classic and extended post/poll path, each with and without thread domain and single
+ * threaded CQ, so the API and the locking effect show up as separate rows */
+int benchExtendedPost(const struct benchConfig_t* config)
+{
+    if (runPostPath(config, "classic", ExtendedQueueClassic) ||
+        runPostPath(config, "classic lock free", ExtendedQueueClassic | ExtendedQueueLockFree) ||
+        runPostPath(config, "extended", 0))
+        return 1;
+    return runPostPath(config, "extended lock free", ExtendedQueueLockFree);
+}
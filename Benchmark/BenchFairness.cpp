@@ -0,0 +1,309 @@
+#include "Source.h"
+#include "FairScheduler.h"
+
+#include <atomic>
+#include <thread>
+
+constexpr auto RpcSize = 64;
+constexpr auto RpcWeight = 4;                   /* Share of the RPC tenant against the bulk tenant under DRR */
+constexpr auto BulkDefaultSize = 64 * 1024;
+constexpr auto BulkDefaultRateMbps = 10000;
+constexpr auto BulkDepth = 16;
+constexpr auto BulkWarmupNs = 10000000;         /* Bulk flow runs alone this long before the first RPC */
+
+enum FairnessMode {
+    ModeAlone,          /* RPC flow only */
+    ModeShared,         /* Bulk flow posts straight to the HCA next to the RPC flow */
+    ModeServiceLevel,   /* Same, RPC QP on its own SL / traffic class */
+    ModeRateLimit,      /* Bulk QP paced, by the HCA when it can */
+    ModeFairQueue       /* Both flows through the DRR scheduler with a bounded in-flight budget */
+};
+
+static const char* fairnessModeNames[] = { "rpc alone", "rpc + bulk", "rpc + bulk, rpc SL/TC", "rpc + bulk, bulk paced",
+    "rpc + bulk, DRR 4:1" };
+
+/* Loopback QP with its own CQ */
+struct Flow {
+    CompletionQueue     cq;
+    QueuePair           qp;
+};
+
+/* Buffer layout: bulk source, bulk destination, then the RPC slot */
+struct FairnessBench {
+    struct VerbsResource    owner;
+    uint32_t                bulkSize;
+    uint64_t                rpcOffset;
+};
+
+static int openFlow(struct FairnessBench* bench, struct Flow* flow, uint8_t serviceLevel, uint8_t trafficClass)
+{
+    flow->cq = CompletionQueue(bench->owner.context, 2 * BulkDepth);
+    if (!flow->cq)
+        return 1;
+
+    struct ibv_qp_init_attr qpInitAttr;
+    memset(&qpInitAttr, 0, sizeof(ibv_qp_init_attr));
+    qpInitAttr.qp_type = IBV_QPT_RC;
+    qpInitAttr.send_cq = flow->cq.get();
+    qpInitAttr.recv_cq = flow->cq.get();
+    qpInitAttr.cap.max_send_wr = BulkDepth;
+    qpInitAttr.cap.max_recv_wr = 1;
+    qpInitAttr.cap.max_send_sge = 1;
+    qpInitAttr.cap.max_recv_sge = 1;
+    flow->qp = QueuePair(bench->owner.protectedDomain, &qpInitAttr);
+    if (!flow->qp)
+        return 1;
+
+    struct RDMAResource view;
+    bench->owner.view(&view);
+    view.compQueue = flow->cq.get();
+    view.queuePair = flow->qp.get();
+    view.serviceLevel = serviceLevel;
+    view.trafficClass = trafficClass;
+    return connectLoopback(&view);
+}
+
+/* Signaled write of `length` bytes from `offset` to `offset + remoteDelta` of the same buffer */
+static void buildWrite(struct FairnessBench* bench, struct ibv_send_wr* wr, struct ibv_sge* sge, uint64_t offset,
+    uint32_t length, uint64_t remoteDelta)
+{
+    sge->addr = (uintptr_t)bench->owner.buffer.get() + offset;
+    sge->length = length;
+    sge->lkey = bench->owner.memoryHandle.lkey();
+
+    memset(wr, 0, sizeof(ibv_send_wr));
+    wr->sg_list = sge;
+    wr->num_sge = 1;
+    wr->opcode = IBV_WR_RDMA_WRITE;
+    wr->send_flags = IBV_SEND_SIGNALED;
+    wr->wr.rdma.remote_addr = sge->addr + remoteDelta;
+    wr->wr.rdma.rkey = bench->owner.memoryHandle.rkey();
+}
+
+/* Bulk flow of a thread of its own, keeps BulkDepth writes in flight until stopped */
+struct BulkFlow {
+    struct FairnessBench*   bench;
+    struct Flow*            flow;
+    std::atomic<bool>       stop;
+    uint64_t                bytes;
+    int                     failed;
+};
+
+static void runBulk(struct BulkFlow* bulk)
+{
+    struct ibv_send_wr wr, *badWR = nullptr;
+    struct ibv_sge sge;
+    buildWrite(bulk->bench, &wr, &sge, 0, bulk->bench->bulkSize, bulk->bench->bulkSize);
+
+    int inflight = 0;
+    for (; inflight < BulkDepth && !bulk->failed; inflight++)
+        bulk->failed = ibv_post_send(bulk->flow->qp.get(), &wr, &badWR);
+
+    struct ibv_wc wc[BulkDepth];
+    while (inflight && !bulk->failed) {
+        int polled = ibv_poll_cq(bulk->flow->cq.get(), BulkDepth, wc);
+        bulk->failed |= polled < 0;
+        for (int i = 0; i < polled && !bulk->failed; i++) {
+            inflight--;
+            /* Only successful writes count towards the bulk rate */
+            bulk->failed |= wc[i].status != IBV_WC_SUCCESS;
+            if (bulk->failed)
+                break;
+            bulk->bytes += bulk->bench->bulkSize;
+            if (!bulk->stop) {
+                bulk->failed |= ibv_post_send(bulk->flow->qp.get(), &wr, &badWR);
+                inflight += !bulk->failed;
+            }
+        }
+    }
+}
+
+/* Closed loop of RPC sized writes, each posted when the previous one completed */
+static int runRpc(struct FairnessBench* bench, struct Flow* rpc, int iterations, std::vector<uint64_t>& samples)
+{
+    struct ibv_send_wr wr, *badWR = nullptr;
+    struct ibv_sge sge;
+    buildWrite(bench, &wr, &sge, bench->rpcOffset, RpcSize, RpcSize);
+
+    for (int i = 0; i < iterations; i++) {
+        uint64_t start = nowNs();
+        if (ibv_post_send(rpc->qp.get(), &wr, &badWR)) {
+            fprintf(stderr, "Failed to post RPC write\n");
+            return 1;
+        }
+
+        struct ibv_wc wc;
+        int polled = 0;
+        while (!polled)
+            polled = ibv_poll_cq(rpc->cq.get(), 1, &wc);
+        if (polled < 0 || wc.status != IBV_WC_SUCCESS) {
+            fprintf(stderr, "RPC write failed\n");
+            return 1;
+        }
+        samples.push_back(nowNs() - start);
+    }
+    return 0;
+}
+
+/* Both flows as tenants of one scheduler, driven from this thread. RPC latency
+ * includes the time the request waited in the scheduler queue */
+static int runScheduled(struct FairnessBench* bench, struct Flow* rpc, struct Flow* bulk, int iterations, uint32_t rpcWeight,
+    uint64_t maxInflightBytes, uint32_t bulkRateKbps, std::vector<uint64_t>& samples, uint64_t* bulkBytes, bool* hardwarePaced)
+{
+    struct FairScheduler sched;
+    createFairScheduler(&sched, FairQuantum, maxInflightBytes);
+    int rpcTenant = addFairTenant(&sched, rpc->qp.get(), rpcWeight, 0);
+    int bulkTenant = addFairTenant(&sched, bulk->qp.get(), 1, bulkRateKbps);
+    *hardwarePaced = sched.tenants[bulkTenant].hardwarePaced;
+
+    struct ibv_send_wr rpcWR, bulkWR;
+    struct ibv_sge rpcSge, bulkSge;
+    buildWrite(bench, &rpcWR, &rpcSge, bench->rpcOffset, RpcSize, RpcSize);
+    buildWrite(bench, &bulkWR, &bulkSge, 0, bench->bulkSize, bench->bulkSize);
+
+    uint64_t start = nowNs(), rpcStart = 0;
+    bool rpcPending = false;
+    int result = 0;
+    struct FairTenant* bulkQueue = &sched.tenants[bulkTenant];
+
+    while ((int)samples.size() < iterations && !result) {
+        if (!rpcPending && nowNs() - start > BulkWarmupNs) {
+            enqueueFair(&sched, rpcTenant, &rpcWR);
+            rpcStart = nowNs();
+            rpcPending = true;
+        }
+        while (bulkQueue->queue.size() + bulkQueue->inflight.size() < BulkDepth)
+            enqueueFair(&sched, bulkTenant, &bulkWR);
+        result = scheduleFair(&sched) < 0;
+
+        struct ibv_wc wc[BulkDepth];
+        int polled = ibv_poll_cq(rpc->cq.get(), 1, wc);
+        if (polled > 0 && wc[0].status == IBV_WC_SUCCESS) {
+            completeFair(&sched, &wc[0]);
+            samples.push_back(nowNs() - rpcStart);
+            rpcPending = false;
+        }
+        else
+            result |= polled != 0;
+
+        polled = ibv_poll_cq(bulk->cq.get(), BulkDepth, wc);
+        result |= polled < 0;
+        for (int i = 0; i < polled; i++) {
+            result |= wc[i].status != IBV_WC_SUCCESS;
+            completeFair(&sched, &wc[i]);
+            *bulkBytes += bench->bulkSize;
+        }
+    }
+
+    /* Queued bulk writes are dropped, posted ones are waited for */
+    struct ibv_wc wc[BulkDepth];
+    while (!bulkQueue->inflight.empty() && !result) {
+        int polled = ibv_poll_cq(bulk->cq.get(), BulkDepth, wc);
+        result |= polled < 0;
+        for (int i = 0; i < polled; i++) {
+            result |= wc[i].status != IBV_WC_SUCCESS;
+            completeFair(&sched, &wc[i]);
+        }
+    }
+    if (result)
+        fprintf(stderr, "Scheduled run failed\n");
+    return result;
+}
+
+/* Run one mode, returns the RPC p99 in ns through `p99Ns` */
+static int runMode(struct FairnessBench* bench, const struct benchConfig_t* config, enum FairnessMode mode, double* p99Ns)
+{
+    struct Flow rpc, bulk;
+    bool classed = mode == ModeServiceLevel;
+    if (openFlow(bench, &rpc, classed ? config->serviceLevel : 0, classed ? config->trafficClass : 0) ||
+        openFlow(bench, &bulk, 0, 0))
+        return 1;
+
+    std::vector<uint64_t> samples;
+    samples.reserve(config->iterations);
+    uint64_t bulkBytes = 0;
+    uint32_t rateMbps = config->rateLimit ? config->rateLimit : BulkDefaultRateMbps;
+    bool hardwarePaced = false;
+    int result = 0;
+
+    uint64_t start = nowNs();
+    if (mode == ModeRateLimit) {
+        /* Budget covers every posted write, only pacing shapes the bulk flow */
+        result = runScheduled(bench, &rpc, &bulk, config->iterations, 1, (uint64_t)BulkDepth * bench->bulkSize + RpcSize,
+            rateMbps * 1000, samples, &bulkBytes, &hardwarePaced);
+    }
+    else if (mode == ModeFairQueue) {
+        result = runScheduled(bench, &rpc, &bulk, config->iterations, RpcWeight, FairMaxInflight, 0, samples, &bulkBytes,
+            &hardwarePaced);
+    }
+    else {
+        struct BulkFlow bulkFlow;
+        bulkFlow.bench = bench;
+        bulkFlow.flow = &bulk;
+        bulkFlow.stop = false;
+        bulkFlow.bytes = 0;
+        bulkFlow.failed = 0;
+
+        std::thread bulkThread;
+        if (mode != ModeAlone) {
+            bulkThread = std::thread(runBulk, &bulkFlow);
+            std::this_thread::sleep_for(std::chrono::nanoseconds(BulkWarmupNs));
+        }
+        result = runRpc(bench, &rpc, config->iterations, samples);
+        bulkFlow.stop = true;
+        if (bulkThread.joinable())
+            bulkThread.join();
+        if (bulkFlow.failed) {
+            fprintf(stderr, "Bulk flow failed\n");
+            result = 1;
+        }
+        bulkBytes = bulkFlow.bytes;
+    }
+    uint64_t elapsed = nowNs() - start;
+    if (result)
+        return result;
+
+    struct LatencyStats stats;
+    computeLatencyStats(samples, &stats);
+    printLatencyStats(fairnessModeNames[mode], &stats);
+    fprintf(stdout, "%-24s bulk %.2f Gb/s", "", bulkBytes * 8.0 / elapsed);
+    if (mode == ModeRateLimit)
+        fprintf(stdout, ", paced at %u Mb/s by the %s", rateMbps, hardwarePaced ? "HCA" : "scheduler");
+    if (mode == ModeServiceLevel)
+        fprintf(stdout, ", rpc on SL %d traffic class %d", config->serviceLevel, config->trafficClass);
+    if (mode != ModeAlone && *p99Ns > 0)
+        fprintf(stdout, ", rpc p99 %.1fx alone", stats.p99Ns / *p99Ns);
+    fprintf(stdout, "\n");
+
+    if (mode == ModeAlone)
+        *p99Ns = stats.p99Ns;
+    return 0;
+}
+
+/* RPC tail latency next to a bulk flow on the same port, uncontrolled, with SL/TC
+ * separation, with the bulk flow rate limited and with both under DRR */
+int benchFairness(const struct benchConfig_t* config)
+{
+    struct FairnessBench bench;
+    bench.bulkSize = config->size ? (uint32_t)config->size : BulkDefaultSize;
+    bench.rpcOffset = 2 * (uint64_t)bench.bulkSize;
+
+    struct VerbsResource& owner = bench.owner;
+    if (owner.create(config->deviceName, config->devicePort, bench.rpcOffset + 2 * RpcSize,
+        IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE))
+        return 1;
+
+    fprintf(stdout, "%d RPC writes of %d bytes, bulk writes of %u bytes %d deep\n", config->iterations, RpcSize,
+        bench.bulkSize, BulkDepth);
+
+    double aloneP99 = 0;
+    for (int mode = ModeAlone; mode <= ModeFairQueue; mode++) {
+        if (mode == ModeServiceLevel && !config->serviceLevel && !config->trafficClass) {
+            fprintf(stdout, "%-24s skipped, set --sl or --tclass\n", fairnessModeNames[mode]);
+            continue;
+        }
+        if (runMode(&bench, config, (FairnessMode)mode, &aloneP99))
+            return 1;
+    }
+    return 0;
+}
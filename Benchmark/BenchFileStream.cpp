@@ -0,0 +1,248 @@
+#include "Source.h"
+#include "ExtendedVerbs.h"
+#include "FileStream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+constexpr auto StreamDefaultSize = 1024ull * 1024 * 1024;
+constexpr auto StreamQueueDepth = 4 * StreamMaxSlots;
+constexpr auto StreamSourcePath = "stream-source.bin";
+constexpr auto StreamDestPath = "stream-dest.bin";
+
+/* One measured transfer */
+struct StreamRun {
+    double      seconds;
+    double      cpuSeconds;     /* User + system time of every thread in the process */
+};
+
+static double cpuSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/* Evict file pages so the next read comes from the device */
+static void dropCache(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+/* Fill every 8 bytes with its own file offset */
+static void fillPattern(char* buffer, size_t length, uint64_t offset)
+{
+    uint64_t* words = (uint64_t*)buffer;
+    for (size_t i = 0; i < length / sizeof(uint64_t); i++)
+        words[i] = offset + i * sizeof(uint64_t);
+}
+
+static int createSourceFile(const char* path, uint64_t size)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create '%s': %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    AlignedBuffer buffer(StreamChunkSize);
+    int result = 0;
+    for (uint64_t offset = 0; offset < size && !result; offset += StreamChunkSize) {
+        size_t length = size - offset < (uint64_t)StreamChunkSize ? size - offset : StreamChunkSize;
+        fillPattern(buffer.get(), StreamChunkSize, offset);
+        if (write(fd, buffer.get(), length) != (ssize_t)length) {
+            fprintf(stderr, "Failed to write '%s': %s\n", path, strerror(errno));
+            result = 1;
+        }
+    }
+    close(fd);
+    dropCache(path);
+    return result;
+}
+
+/* Compare destination against the pattern, reports the first mismatching offset */
+static int verifyFile(const char* path, uint64_t size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open '%s': %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    AlignedBuffer expected(StreamChunkSize), actual(StreamChunkSize);
+    struct stat st;
+    int result = fstat(fd, &st) || (uint64_t)st.st_size != size;
+    if (result)
+        fprintf(stderr, "'%s' has %ld bytes, expected %lu\n", path, (long)st.st_size, (unsigned long)size);
+
+    for (uint64_t offset = 0; offset < size && !result; offset += StreamChunkSize) {
+        size_t length = size - offset < (uint64_t)StreamChunkSize ? size - offset : StreamChunkSize;
+        fillPattern(expected.get(), StreamChunkSize, offset);
+        if (pread(fd, actual.get(), length, offset) != (ssize_t)length || memcmp(actual.get(), expected.get(), length)) {
+            fprintf(stderr, "'%s' differs from the source in the chunk at offset %lu\n", path, (unsigned long)offset);
+            result = 1;
+        }
+    }
+    close(fd);
+    return result;
+}
+
+/* Sequential O_DIRECT read or write of the whole file through one chunk buffer */
+static int diskBaseline(const char* path, uint64_t size, bool forWrite, struct StreamRun* run)
+{
+    bool direct;
+    int fd = openStreamFile(path, forWrite, &direct);
+    if (fd < 0)
+        return 1;
+
+    AlignedBuffer buffer(StreamChunkSize);
+    fillPattern(buffer.get(), StreamChunkSize, 0);
+    int result = 0;
+    double cpuStart = cpuSeconds();
+    uint64_t start = nowNs();
+
+    for (uint64_t offset = 0; offset < size && !result; offset += StreamChunkSize) {
+        size_t length = size - offset < (uint64_t)StreamChunkSize ? size - offset : StreamChunkSize;
+        if (direct)
+            length = (length + StreamBlockSize - 1) & ~(size_t)(StreamBlockSize - 1);
+        ssize_t done = forWrite ? pwrite(fd, buffer.get(), length, offset) : pread(fd, buffer.get(), length, offset);
+        if (done <= 0) {
+            fprintf(stderr, "Disk %s at offset %lu failed: %s\n", forWrite ? "write" : "read", (unsigned long)offset,
+                strerror(errno));
+            result = 1;
+        }
+    }
+    if (forWrite)
+        fdatasync(fd);
+
+    run->seconds = (nowNs() - start) / 1e9;
+    run->cpuSeconds = cpuSeconds() - cpuStart;
+    close(fd);
+    return result;
+}
+
+/* Stream `size` bytes from `source` to `dest`, a NULL path leaves that disk out */
+static int runTransfer(struct RDMAResource* senderRes, struct RDMAResource* receiverRes, const char* source,
+    const char* dest, uint64_t size, enum StreamSource mode, struct StreamRun* run)
+{
+    bool sourceDirect = false, destDirect = false;
+    int sourceFd = source ? openStreamFile(source, false, &sourceDirect) : -1;
+    int destFd = dest ? openStreamFile(dest, true, &destDirect) : -1;
+    if ((source && sourceFd < 0) || (dest && destFd < 0)) {
+        if (sourceFd >= 0)
+            close(sourceFd);
+        if (destFd >= 0)
+            close(destFd);
+        return 1;
+    }
+
+    struct StreamSender sender;
+    struct StreamReceiver receiver;
+    struct StreamLayout layout;
+    int result = createStreamReceiver(&receiver, receiverRes, destFd, size, destDirect, StreamSlots);
+    bool senderCreated = !result;
+    if (senderCreated)
+        result = createStreamSender(&sender, senderRes, sourceFd, size, sourceDirect, mode, StreamSlots);
+
+    if (!result) {
+        streamReceiverLayout(&receiver, &layout);
+        int receiverResult = 0;
+        double cpuStart = cpuSeconds();
+        uint64_t start = nowNs();
+
+        std::thread receiverThread([&] { receiverResult = runStreamReceiver(&receiver); });
+        result = runStreamSender(&sender, &layout);
+        receiverThread.join();
+        if (destFd >= 0)
+            fdatasync(destFd);
+
+        run->seconds = (nowNs() - start) / 1e9;
+        run->cpuSeconds = cpuSeconds() - cpuStart;
+        result = result || receiverResult;
+    }
+
+    if (senderCreated)
+        destroyStreamSender(&sender);
+    destroyStreamReceiver(&receiver);
+    if (sourceFd >= 0)
+        close(sourceFd);
+    if (destFd >= 0)
+        close(destFd);
+    return result;
+}
+
+static void printRun(const char* name, uint64_t size, const struct StreamRun* run, double ceiling)
+{
+    double gbs = size / run->seconds / 1e9;
+    fprintf(stdout, "%-26s %10.2f %12.3f", name, gbs, run->cpuSeconds / (size / 1e9));
+    if (ceiling > 0)
+        fprintf(stdout, " %11.1f%%", 100 * gbs / ceiling);
+    fprintf(stdout, "\n");
+}
+
+/* File to file throughput over a pipelined RDMA WRITE stream, against the disk and link limits */
+int benchFileStream(const struct benchConfig_t* config)
+{
+    uint64_t size = config->size ? config->size : StreamDefaultSize;
+
+    struct RDMAResource senderRes, receiverRes;
+    struct ExtendedQueue senderQueue, receiverQueue;
+    memset(&receiverQueue, 0, sizeof(ExtendedQueue));
+    openBenchResource(config, &senderRes);
+    openBenchResource(config, &receiverRes);
+
+    int result = createExtendedQueue(&senderRes, &senderQueue, StreamQueueDepth, 0, ExtendedQueueClassic) ||
+        createExtendedQueue(&receiverRes, &receiverQueue, StreamQueueDepth, 0, ExtendedQueueClassic) ||
+        connectPair(&senderRes, &receiverRes) || createSourceFile(StreamSourcePath, size);
+
+    if (!result) {
+        struct StreamRun readRun, writeRun, linkRun, directRun, mmapRun;
+        fprintf(stdout, "%lu bytes, %d slots of %d bytes\n", (unsigned long)size, StreamSlots, StreamChunkSize);
+        fprintf(stdout, "%-26s %10s %12s %12s\n", "", "GB/s", "CPU s/GB", "of ceiling");
+
+        result = diskBaseline(StreamSourcePath, size, false, &readRun) ||
+            diskBaseline(StreamDestPath, size, true, &writeRun) ||
+            runTransfer(&senderRes, &receiverRes, nullptr, nullptr, size, StreamFromDirect, &linkRun);
+
+        if (!result) {
+            printRun("disk read", size, &readRun, 0);
+            printRun("disk write", size, &writeRun, 0);
+            printRun("link (no disk)", size, &linkRun, 0);
+
+            /* Best a pipeline can do is its slowest stage */
+            double slowest = readRun.seconds > writeRun.seconds ? readRun.seconds : writeRun.seconds;
+            slowest = linkRun.seconds > slowest ? linkRun.seconds : slowest;
+            double ceiling = size / slowest / 1e9;
+
+            dropCache(StreamSourcePath);
+            result = runTransfer(&senderRes, &receiverRes, StreamSourcePath, StreamDestPath, size, StreamFromDirect,
+                &directRun) || verifyFile(StreamDestPath, size);
+            if (!result)
+                printRun("file->file O_DIRECT", size, &directRun, ceiling);
+
+            dropCache(StreamSourcePath);
+            result = result || runTransfer(&senderRes, &receiverRes, StreamSourcePath, StreamDestPath, size,
+                StreamFromMmap, &mmapRun) || verifyFile(StreamDestPath, size);
+            if (!result)
+                printRun("file->file mmap source", size, &mmapRun, ceiling);
+        }
+        fprintf(stdout, "CPU includes the busy polling RDMA threads of both ends\n");
+    }
+
+    unlink(StreamSourcePath);
+    unlink(StreamDestPath);
+    destroyExtendedQueue(&senderRes, &senderQueue);
+    destroyExtendedQueue(&receiverRes, &receiverQueue);
+    destroyRDMAResource(&senderRes);
+    destroyRDMAResource(&receiverRes);
+    return result;
+}
@@ -0,0 +1,319 @@
+#include "Source.h"
+#include "Integrity.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+
+constexpr auto IntegrityDepth = 16;
+constexpr uint64_t IntegrityRecvFlag = 1ull << 63;
+constexpr auto IntegrityKernelSize = 1024 * 1024;
+constexpr auto IntegrityKernelRounds = 256;
+
+enum IntegrityVariant {
+    VariantOff,             /* Payload only */
+    VariantCrc32cHeader,    /* Header with per block CRC32C as first SGE */
+    VariantXxHashHeader,    /* Header with per block XXH64 as first SGE */
+    VariantCrc32cImmediate  /* SEND_WITH_IMM, one CRC32C over the message */
+};
+
+constexpr auto IntegrityVariantCount = 4;
+
+static const char* integrityVariantNames[] = { "off", "crc32c hdr", "xxh64 hdr", "crc32c imm" };
+
+static enum IntegrityMode variantMode(enum IntegrityVariant variant)
+{
+    return variant == VariantXxHashHeader ? IntegrityXxHash64 : variant == VariantOff ? IntegrityOff : IntegrityCrc32c;
+}
+
+/* Buffer layout: payload source, 2 * depth header slots, depth receive slots */
+struct IntegrityBench {
+    struct VerbsResource    owner;
+    CompletionQueue         cq;
+    QueuePair               qp;
+    size_t                  maxSize;
+    size_t                  headerStride;
+    size_t                  recvStride;
+    char*                   payload;
+    char*                   headers;
+    char*                   recvSlots;
+    uint32_t                lkey;
+};
+
+static size_t roundUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static int openIntegrityBench(struct IntegrityBench* bench, const struct benchConfig_t* config)
+{
+    bench->headerStride = roundUp(integrityHeaderSize(bench->maxSize), 64);
+    bench->recvStride = roundUp(bench->headerStride + bench->maxSize, 64);
+    size_t payloadLength = roundUp(bench->maxSize, 64);
+
+    struct VerbsResource& owner = bench->owner;
+    if (owner.create(config->deviceName, config->devicePort,
+        payloadLength + 2 * IntegrityDepth * bench->headerStride + IntegrityDepth * bench->recvStride, IBV_ACCESS_LOCAL_WRITE))
+        return 1;
+
+    bench->payload = owner.buffer.get();
+    bench->headers = bench->payload + payloadLength;
+    bench->recvSlots = bench->headers + 2 * IntegrityDepth * bench->headerStride;
+    bench->lkey = owner.memoryHandle.lkey();
+    for (size_t i = 0; i < bench->maxSize; i++)
+        bench->payload[i] = (char)(i * 131 + (i >> 12));
+
+    bench->cq = CompletionQueue(owner.context, 4 * IntegrityDepth);
+    if (!bench->cq)
+        return 1;
+
+    struct ibv_qp_init_attr qpInitAttr;
+    memset(&qpInitAttr, 0, sizeof(ibv_qp_init_attr));
+    qpInitAttr.qp_type = IBV_QPT_RC;
+    qpInitAttr.sq_sig_all = 1;
+    qpInitAttr.send_cq = bench->cq.get();
+    qpInitAttr.recv_cq = bench->cq.get();
+    qpInitAttr.cap.max_send_wr = 2 * IntegrityDepth;
+    qpInitAttr.cap.max_recv_wr = IntegrityDepth;
+    qpInitAttr.cap.max_send_sge = 2;
+    qpInitAttr.cap.max_recv_sge = 1;
+    bench->qp = QueuePair(owner.protectedDomain, &qpInitAttr);
+    if (!bench->qp)
+        return 1;
+
+    struct RDMAResource view;
+    owner.view(&view);
+    view.compQueue = bench->cq.get();
+    view.queuePair = bench->qp.get();
+    return connectLoopback(&view);
+}
+
+static int postIntegrityRecv(struct IntegrityBench* bench, uint32_t slot)
+{
+    struct ibv_sge sge;
+    sge.addr = (uintptr_t)bench->recvSlots + slot * bench->recvStride;
+    sge.length = bench->recvStride;
+    sge.lkey = bench->lkey;
+
+    struct ibv_recv_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = IntegrityRecvFlag | slot;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    return ibv_post_recv(bench->qp.get(), &wr, &badWR);
+}
+
+/* Checksum the payload and send it, header slot `slot` carries the block checksums */
+static int postIntegritySend(struct IntegrityBench* bench, enum IntegrityVariant variant, size_t size, uint32_t slot)
+{
+    struct ibv_sge sge[2];
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = slot;
+    wr.sg_list = sge;
+    wr.opcode = IBV_WR_SEND;
+
+    int n = 0;
+    if (variant == VariantCrc32cHeader || variant == VariantXxHashHeader) {
+        struct IntegrityHeader* header = (struct IntegrityHeader*)(bench->headers + slot * bench->headerStride);
+        sealIntegrityHeader(header, variantMode(variant), bench->payload, size);
+        sge[n].addr = (uintptr_t)header;
+        sge[n].length = integrityHeaderSize(size);
+        sge[n++].lkey = bench->lkey;
+    }
+    else if (variant == VariantCrc32cImmediate) {
+        wr.opcode = IBV_WR_SEND_WITH_IMM;
+        wr.imm_data = htonl(integrityImmediate(IntegrityCrc32c, bench->payload, size));
+    }
+    sge[n].addr = (uintptr_t)bench->payload;
+    sge[n].length = size;
+    sge[n++].lkey = bench->lkey;
+    wr.num_sge = n;
+    return ibv_post_send(bench->qp.get(), &wr, &badWR);
+}
+
+/* Verify received message, returns number of mismatching blocks or -1 for a malformed message */
+static int verifyIntegrityRecv(struct IntegrityBench* bench, enum IntegrityVariant variant, const struct ibv_wc* wc,
+    struct IntegrityMismatch* mismatches)
+{
+    const char* slot = bench->recvSlots + (wc->wr_id & ~IntegrityRecvFlag) * bench->recvStride;
+    if (variant == VariantOff)
+        return 0;
+    if (variant == VariantCrc32cImmediate) {
+        if (!(wc->wc_flags & IBV_WC_WITH_IMM))
+            return -1;
+        return verifyIntegrityImmediate(IntegrityCrc32c, slot, wc->byte_len, ntohl(wc->imm_data), mismatches);
+    }
+
+    const struct IntegrityHeader* header = (const struct IntegrityHeader*)slot;
+    size_t headerSize = integrityHeaderSize(header->length);
+    if (wc->byte_len < sizeof(IntegrityHeader) || wc->byte_len < headerSize)
+        return -1;
+    return verifyIntegrity(header, slot + headerSize, wc->byte_len - headerSize, mismatches, IntegrityMaxMismatches);
+}
+
+/* Stream `iterations` messages keeping up to IntegrityDepth in flight, every one verified on receipt.
+ * `corruptAt` >= 0 flips that payload byte of the first received message before verification.
+ * `corrupted` counts messages that failed verification, `mismatches` (IntegrityMaxMismatches entries)
+ * and `mismatchCount` receive the blocks reported for the first of them */
+static int runIntegrityPoint(struct IntegrityBench* bench, enum IntegrityVariant variant, size_t size, int iterations,
+    int64_t corruptAt, uint64_t* elapsedNs, int* corrupted, struct IntegrityMismatch* mismatches, int* mismatchCount)
+{
+    int result = 0;
+    for (int slot = 0; slot < IntegrityDepth && slot < iterations && !result; slot++)
+        result = postIntegrityRecv(bench, slot);
+
+    int posted = 0, received = 0, sendsDone = 0;
+    *corrupted = 0;
+    *mismatchCount = 0;
+    uint64_t start = nowNs();
+    struct ibv_wc wc[IntegrityDepth];
+
+    while ((received < iterations || sendsDone < posted) && !result) {
+        /* A send needs a posted receive on the loopback QP and a header slot that is not in flight */
+        while (posted < iterations && posted - received < IntegrityDepth && posted - sendsDone < 2 * IntegrityDepth &&
+            !result) {
+            result = postIntegritySend(bench, variant, size, posted % (2 * IntegrityDepth));
+            posted++;
+        }
+
+        int polled = ibv_poll_cq(bench->cq.get(), IntegrityDepth, wc);
+        if (polled < 0) {
+            fprintf(stderr, "Poll CQ failed\n");
+            result = 1;
+        }
+        for (int i = 0; i < polled && !result; i++) {
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                fprintf(stderr, "Integrity %s completion with status %s\n", integrityVariantNames[variant],
+                    ibv_wc_status_str(wc[i].status));
+                result = 1;
+                break;
+            }
+            if (!(wc[i].wr_id & IntegrityRecvFlag)) {
+                sendsDone++;
+                continue;
+            }
+
+            if (corruptAt >= 0 && received == 0) {
+                char* slot = bench->recvSlots + (wc[i].wr_id & ~IntegrityRecvFlag) * bench->recvStride;
+                size_t headerSize = variant == VariantCrc32cHeader || variant == VariantXxHashHeader ?
+                    integrityHeaderSize(size) : 0;
+                slot[headerSize + corruptAt] ^= 0x20;
+            }
+
+            struct IntegrityMismatch found[IntegrityMaxMismatches];
+            int count = verifyIntegrityRecv(bench, variant, &wc[i], found);
+            if (count < 0) {
+                fprintf(stderr, "Malformed %s message of %u bytes\n", integrityVariantNames[variant], wc[i].byte_len);
+                result = 1;
+                break;
+            }
+            if (count) {
+                int stored = count < IntegrityMaxMismatches ? count : IntegrityMaxMismatches;
+                reportIntegrityMismatches(integrityVariantNames[variant], found, stored);
+                if (!(*corrupted)++) {
+                    memcpy(mismatches, found, stored * sizeof(IntegrityMismatch));
+                    *mismatchCount = count;
+                }
+            }
+
+            received++;
+            if (received + IntegrityDepth <= iterations)
+                result = postIntegrityRecv(bench, wc[i].wr_id & ~IntegrityRecvFlag);
+        }
+    }
+    *elapsedNs = nowNs() - start;
+    return result;
+}
+
+/* Keeps the kernel loop from being optimized out */
+static volatile uint64_t integritySink;
+
+/* Throughput of the bare checksum kernels on a cache resident buffer */
+static void printKernelRates(struct IntegrityBench* bench)
+{
+    size_t length = bench->maxSize < IntegrityKernelSize ? bench->maxSize : IntegrityKernelSize;
+    fprintf(stdout, "Checksum kernels over %lu bytes:", (unsigned long)length);
+    for (int mode = IntegrityCrc32c; mode <= IntegrityXxHash64; mode++) {
+        uint64_t start = nowNs();
+        for (int round = 0; round < IntegrityKernelRounds; round++)
+            integritySink = integritySink + integrityChecksum((IntegrityMode)mode, bench->payload, length);
+        uint64_t elapsed = nowNs() - start;
+        fprintf(stdout, " %s %.2f GB/s%s", integrityModeName((IntegrityMode)mode),
+            (double)length * IntegrityKernelRounds / elapsed,
+            mode == IntegrityCrc32c ? (crc32cHardware() ? " (sse4.2)," : " (table),") : "");
+    }
+    fprintf(stdout, "\n");
+}
+
+/* Bandwidth cost of checksumming every message on send and verifying it on receipt */
+int benchIntegrity(const struct benchConfig_t* config)
+{
+    std::vector<size_t> sizes;
+    if (config->size)
+        sizes.push_back(config->size);
+    else
+        sizes = { 64, 512, 4096, 65536, 1024 * 1024 };
+
+    struct IntegrityBench bench;
+    bench.maxSize = *std::max_element(sizes.begin(), sizes.end());
+    if (openIntegrityBench(&bench, config))
+        return 1;
+
+    printKernelRates(&bench);
+    fprintf(stdout, "Loopback SENDs %d deep, sender and receiver share one core so every byte is checksummed twice\n",
+        IntegrityDepth);
+    fprintf(stdout, "%10s", "size");
+    for (int variant = VariantOff; variant < IntegrityVariantCount; variant++)
+        fprintf(stdout, " %12s GB/s%s", integrityVariantNames[variant], variant == VariantOff ? "" : "   cost");
+    fprintf(stdout, "\n");
+
+    int result = 0;
+    for (size_t size : sizes) {
+        fprintf(stdout, "%10lu", (unsigned long)size);
+        double offRate = 0;
+        for (int variant = VariantOff; variant < IntegrityVariantCount && !result; variant++) {
+            uint64_t elapsed = 0;
+            int corrupted = 0, mismatchCount = 0;
+            struct IntegrityMismatch mismatches[IntegrityMaxMismatches];
+            result = runIntegrityPoint(&bench, (IntegrityVariant)variant, size, config->iterations, -1, &elapsed, &corrupted,
+                mismatches, &mismatchCount);
+            if (!result && corrupted) {
+                fprintf(stderr, "%d of %d %s messages of %lu bytes arrived corrupted\n", corrupted, config->iterations,
+                    integrityVariantNames[variant], (unsigned long)size);
+                result = 1;
+            }
+
+            double rate = (double)size * config->iterations / elapsed;
+            if (variant == VariantOff) {
+                offRate = rate;
+                fprintf(stdout, " %17.2f", rate);
+            }
+            else {
+                fprintf(stdout, " %17.2f %5.1f%%", rate, offRate > 0 ? (1 - rate / offRate) * 100 : 0);
+            }
+        }
+        fprintf(stdout, "\n");
+        if (result)
+            return result;
+    }
+
+    /* Flip one byte after arrival, the report has to name the block holding it */
+    size_t size = bench.maxSize;
+    int64_t corruptAt = size / 2 + 1;
+    uint64_t elapsed = 0;
+    int corrupted = 0, mismatchCount = 0;
+    struct IntegrityMismatch mismatches[IntegrityMaxMismatches];
+    fprintf(stdout, "Corrupting payload byte %ld of a %lu byte message after arrival:\n", (long)corruptAt, (unsigned long)size);
+    if (runIntegrityPoint(&bench, VariantCrc32cHeader, size, 1, corruptAt, &elapsed, &corrupted, mismatches, &mismatchCount))
+        return 1;
+
+    uint64_t block = corruptAt / IntegrityBlockSize * IntegrityBlockSize;
+    if (corrupted != 1 || mismatchCount != 1 || mismatches[0].offset != block) {
+        fprintf(stderr, "Injected corruption was not reported as block %lu..%lu\n", (unsigned long)block,
+            (unsigned long)std::min<uint64_t>(size, block + IntegrityBlockSize) - 1);
+        return 1;
+    }
+    fprintf(stdout, "Detected, block %lu..%lu reported\n", (unsigned long)mismatches[0].offset,
+        (unsigned long)(mismatches[0].offset + mismatches[0].length - 1));
+    return 0;
+}
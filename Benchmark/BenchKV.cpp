@@ -0,0 +1,109 @@
+#include "Source.h"
+#include "KVStore.h"
+
+#include <thread>
+
+constexpr auto KVBenchKeys = 1024;
+constexpr auto KVBenchBuckets = 4096;
+constexpr auto KVBenchLogSize = 4 * 1024 * 1024;
+constexpr auto KVDefaultValue = 64;
+
+/* Fill `key` with the name of key number `index`, returns its length */
+static uint32_t benchKey(char* key, int index)
+{
+    return snprintf(key, KVMaxKey, "key-%08d", index);
+}
+
+/* GET latency and server CPU involvement, one-sided READ vs RPC, client and server on one HCA */
+int benchKeyValue(const struct benchConfig_t* config)
+{
+    uint32_t valueSize = config->size ? config->size : KVDefaultValue;
+    if (valueSize > KVMaxValue) {
+        fprintf(stderr, "Value size %u exceeds %d bytes\n", valueSize, KVMaxValue);
+        return 1;
+    }
+
+    struct RDMAResource serverRes, clientRes;
+    openBenchResource(config, &serverRes);
+    openBenchResource(config, &clientRes);
+
+    struct KVServer server;
+    struct KVClient client;
+    struct KVLayout layout;
+    std::thread serverThread;
+    int result = 1;
+
+    if (createKVServer(&server, &serverRes, KVBenchBuckets, KVBenchLogSize))
+        goto exit;
+    if (connectPair(&serverRes, &clientRes) || kvServerStart(&server))
+        goto destroy;
+
+    /* Layout would normally travel over the TCP exchange, both ends live here */
+    kvServerLayout(&server, &layout);
+    createKVClient(&client, &clientRes, &layout);
+    serverThread = std::thread(kvServerLoop, &server);
+
+    {
+        char key[KVMaxKey], value[KVMaxValue], readBack[KVMaxValue];
+        uint32_t keyLen, readLen = 0;
+        memset(value, 'v', valueSize);
+
+        for (int i = 0; i < KVBenchKeys; i++) {
+            keyLen = benchKey(key, i);
+            int status = kvPut(&client, key, keyLen, value, valueSize);
+            if (status != KVOk) {
+                fprintf(stderr, "PUT of %s failed with status %d\n", key, status);
+                goto stop;
+            }
+        }
+
+        std::vector<uint64_t> samples;
+        struct LatencyStats stats;
+        const char* names[2] = { "GET one-sided READ", "GET two-sided RPC" };
+
+        for (int rpc = 0; rpc < 2; rpc++) {
+            samples.clear();
+            uint64_t rpcBefore = server.rpcCount;
+            uint64_t readsBefore = client.reads;
+            uint64_t start = nowNs();
+
+            for (int i = 0; i < config->iterations; i++) {
+                keyLen = benchKey(key, i % KVBenchKeys);
+                uint64_t begin = nowNs();
+                int status = rpc ? kvGetRpc(&client, key, keyLen, readBack, &readLen) :
+                    kvGet(&client, key, keyLen, readBack, &readLen);
+                samples.push_back(nowNs() - begin);
+                if (status != KVOk || readLen != valueSize || memcmp(readBack, value, valueSize)) {
+                    fprintf(stderr, "%s of %s returned status %d\n", names[rpc], key, status);
+                    goto stop;
+                }
+            }
+
+            uint64_t elapsed = nowNs() - start;
+            computeLatencyStats(samples, &stats);
+            printLatencyStats(names[rpc], &stats);
+            fprintf(stdout, "%-24s %.0f ops/s, server requests %lu, READs %lu\n", "",
+                config->iterations * 1e9 / elapsed, (unsigned long)(server.rpcCount - rpcBefore),
+                (unsigned long)(client.reads - readsBefore));
+        }
+
+        keyLen = benchKey(key, KVBenchKeys);
+        if (kvGet(&client, key, keyLen, readBack, &readLen) != KVNotFound) {
+            fprintf(stderr, "GET of missing key %s did not report KVNotFound\n", key);
+            goto stop;
+        }
+
+        fprintf(stdout, "Torn reads retried: %lu\n", (unsigned long)client.retries);
+        result = 0;
+    }
+
+stop:
+    server.running = false;
+    serverThread.join();
+destroy:
+    destroyKVServer(&server);
+exit:
+    destroyRDMAResource(&clientRes);
+    destroyRDMAResource(&serverRes);
+    return result;
+}
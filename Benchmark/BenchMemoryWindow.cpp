@@ -0,0 +1,137 @@
+#include "Source.h"
+#include "ExtendedVerbs.h"
+#include "MemoryWindow.h"
+
+constexpr auto WindowRegionSize = 64 * 1024 * 1024;
+constexpr auto WindowDefaultGrant = 4096;
+constexpr auto WindowQueueDepth = 64;
+
+/* Per-request grant cost: window bind/invalidate vs ibv_reg_mr/ibv_dereg_mr */
+int benchMemoryWindow(const struct benchConfig_t* config)
+{
+    size_t grantSize = config->size ? config->size : WindowDefaultGrant;
+    if (grantSize > WindowRegionSize) {
+        fprintf(stderr, "Grant size %zu is larger than the %d bytes region\n", grantSize, WindowRegionSize);
+        return 1;
+    }
+    uint64_t slots = WindowRegionSize / grantSize;
+
+    struct RDMAResource res;
+    openBenchResource(config, &res);
+
+    struct ExtendedQueue eq;
+    memset(&eq, 0, sizeof(ExtendedQueue));
+    AlignedBuffer region(WindowRegionSize);
+    int access = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
+    bool windows = memoryWindowsSupported(&res);
+    struct ibv_mr* regionMR = nullptr;
+    int result = 1;
+
+    if (!region || createExtendedQueue(&res, &eq, WindowQueueDepth, 0, ExtendedQueueClassic) || connectLoopback(&res))
+        goto exit;
+
+    regionMR = ibv_reg_mr(res.protectedDomain, region.get(), WindowRegionSize, access | (windows ? IBV_ACCESS_MW_BIND : 0));
+    if (!regionMR)
+        goto exit;
+
+    {
+        std::vector<uint64_t> regSamples, deregSamples;
+        for (int i = 0; i < config->iterations; i++) {
+            char* addr = region.get() + (i % slots) * grantSize;
+            uint64_t start = nowNs();
+            struct ibv_mr* mr = ibv_reg_mr(res.protectedDomain, addr, grantSize, access);
+            uint64_t registered = nowNs();
+            if (!mr)
+                goto exit;
+            ibv_dereg_mr(mr);
+            regSamples.push_back(registered - start);
+            deregSamples.push_back(nowNs() - registered);
+        }
+
+        struct LatencyStats stats;
+        computeLatencyStats(regSamples, &stats);
+        printLatencyStats("ibv_reg_mr", &stats);
+        computeLatencyStats(deregSamples, &stats);
+        printLatencyStats("ibv_dereg_mr", &stats);
+    }
+
+    if (!windows) {
+        fprintf(stdout, "Device '%s' has no type 2 memory windows\n", res.deviceName);
+        result = 0;
+        goto exit;
+    }
+
+    {
+        struct AccessGrant grant;
+        if (allocAccessGrant(&res, &grant))
+            goto exit;
+
+        std::vector<uint64_t> bindSamples, invalidateSamples, sendInvSamples;
+        struct ibv_wc wc;
+        int failed = 0;
+
+        /* Bind and local invalidation, each waited for */
+        for (int i = 0; i < config->iterations && !failed; i++) {
+            uint64_t addr = (uintptr_t)region.get() + (i % slots) * grantSize;
+            uint64_t start = nowNs();
+            failed = postBindGrant(&res, &grant, regionMR, addr, grantSize, IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE, i, true) ||
+                waitCompletion(&res, &wc);
+            uint64_t bound = nowNs();
+            failed = failed || postInvalidateGrant(&res, &grant, i, true) || waitCompletion(&res, &wc);
+            bindSamples.push_back(bound - start);
+            invalidateSamples.push_back(nowNs() - bound);
+        }
+
+        /* Bind, then the peer hands the grant back with SEND_WITH_INV */
+        struct ibv_sge recvSge;
+        recvSge.addr = (uintptr_t)res.buffer;
+        recvSge.length = BufferSize;
+        recvSge.lkey = res.memoryHandle->lkey;
+
+        for (int i = 0; i < config->iterations && !failed; i++) {
+            struct ibv_recv_wr recvWR, *badWR = nullptr;
+            memset(&recvWR, 0, sizeof(recvWR));
+            recvWR.wr_id = i;
+            recvWR.sg_list = &recvSge;
+            recvWR.num_sge = 1;
+
+            uint64_t addr = (uintptr_t)region.get() + (i % slots) * grantSize;
+            uint64_t start = nowNs();
+            failed = ibv_post_recv(res.queuePair, &recvWR, &badWR) ||
+                postBindGrant(&res, &grant, regionMR, addr, grantSize, IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE, i, false) ||
+                postSendWithInvalidate(&res, grant.rkey, nullptr, i);
+
+            bool invalidated = false;
+            for (int k = 0; k < 2 && !failed; k++) {
+                failed = waitCompletion(&res, &wc);
+                if (!failed && wc.opcode == IBV_WC_RECV)
+                    invalidated = grantInvalidatedBy(&grant, &wc);
+            }
+            if (!failed && !invalidated) {
+                fprintf(stderr, "Receive completion did not invalidate rkey 0x%x\n", grant.rkey);
+                failed = 1;
+            }
+            sendInvSamples.push_back(nowNs() - start);
+        }
+
+        struct LatencyStats stats;
+        computeLatencyStats(bindSamples, &stats);
+        printLatencyStats("bind window", &stats);
+        computeLatencyStats(invalidateSamples, &stats);
+        printLatencyStats("local invalidate", &stats);
+        computeLatencyStats(sendInvSamples, &stats);
+        printLatencyStats("bind + send with inv", &stats);
+
+        if (grant.bound && !postInvalidateGrant(&res, &grant, 0, true))
+            waitCompletion(&res, &wc);
+        freeAccessGrant(&grant);
+        result = failed;
+    }
+
+exit:
+    if (regionMR)
+        ibv_dereg_mr(regionMR);
+    destroyExtendedQueue(&res, &eq);
+    destroyRDMAResource(&res);
+    return result;
+}
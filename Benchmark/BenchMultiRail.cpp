@@ -0,0 +1,51 @@
+#include "Source.h"
+#include "MultiRail.h"
+
+constexpr auto DefaultTransferSize = 256 * 1024 * 1024;
+constexpr auto MultiRailTransfers = 8;
+
+/* Striped write bandwidth for 1..N rails, every rail looped back to itself */
+int benchMultiRail(const struct benchConfig_t* config)
+{
+    size_t transferSize = config->size ? config->size : DefaultTransferSize;
+
+    struct MultiRail mr;
+    int rails = openRails(&mr, 4);
+    if (!rails) {
+        fprintf(stderr, "No active ports found\n");
+        return 1;
+    }
+
+    AlignedBuffer source(transferSize);
+    AlignedBuffer destination(transferSize);
+    if (!source || !destination || registerRailBuffers(&mr, source.get(), transferSize) ||
+        connectRailsLoopback(&mr, destination.get(), transferSize)) {
+        closeRails(&mr);
+        return 1;
+    }
+
+    int result = 0;
+    double singleRail = 0;
+    fprintf(stdout, "%-6s %12s %10s %s\n", "rails", "GB/s", "scaling", "bytes per rail");
+    for (int n = 1; n <= rails && !result; n++) {
+        mr.useRails = n;
+        for (auto& rail : mr.rails)
+            rail.bytesCompleted = 0;
+
+        uint64_t start = nowNs();
+        for (int t = 0; t < MultiRailTransfers && !result; t++)
+            result = stripedWrite(&mr, (uintptr_t)source.get(), 0, transferSize);
+        uint64_t elapsed = nowNs() - start;
+
+        double bandwidth = (double)transferSize * MultiRailTransfers / elapsed;
+        if (n == 1)
+            singleRail = bandwidth;
+        fprintf(stdout, "%-6d %12.2f %9.2fx", n, bandwidth, bandwidth / singleRail);
+        for (int i = 0; i < n; i++)
+            fprintf(stdout, " %lu", (unsigned long)mr.rails[i].bytesCompleted);
+        fprintf(stdout, "\n");
+    }
+
+    closeRails(&mr);
+    return result;
+}
@@ -0,0 +1,182 @@
+#include "Source.h"
+#include "ExtendedVerbs.h"
+#include "MemoryRegistration.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+constexpr auto OdpMinSize = 1ull << 30;
+constexpr auto OdpDefaultMaxSize = 64ull << 30;
+constexpr auto OdpFaultSamples = 256;
+constexpr auto OdpMessageSize = 1 << 20;
+constexpr auto OdpQueueDepth = 64;
+constexpr auto OdpWindow = 16;
+constexpr auto OdpStreamLimit = 4ull << 30;
+
+/* Single signaled RDMA write, returns latency in ns or 0 on failure */
+static uint64_t writeOnce(struct RDMAResource* res, uint32_t lkey, uint64_t localAddr, uint32_t rkey, uint64_t remoteAddr, uint32_t length)
+{
+    struct ibv_sge sge;
+    sge.addr = localAddr;
+    sge.length = length;
+    sge.lkey = lkey;
+
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_RDMA_WRITE;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.wr.rdma.remote_addr = remoteAddr;
+    wr.wr.rdma.rkey = rkey;
+
+    struct ibv_wc wc;
+    uint64_t start = nowNs();
+    if (ibv_post_send(res->queuePair, &wr, &badWR) || waitCompletion(res, &wc))
+        return 0;
+    return nowNs() - start;
+}
+
+/* Stream writes from the first half of the region into the second half, returns GB/s */
+static double streamRegion(struct RDMAResource* res, struct ibv_mr* mr, char* region, size_t size)
+{
+    size_t half = size / 2 < OdpStreamLimit ? size / 2 : OdpStreamLimit;
+    uint64_t messages = half / OdpMessageSize;
+
+    struct ibv_sge sge;
+    sge.length = OdpMessageSize;
+    sge.lkey = mr->lkey;
+
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_RDMA_WRITE;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.wr.rdma.rkey = mr->rkey;
+
+    uint64_t posted = 0, completed = 0;
+    uint64_t start = nowNs();
+    while (completed < messages) {
+        while (posted < messages && posted - completed < OdpWindow) {
+            wr.wr_id = posted;
+            sge.addr = (uintptr_t)region + posted * OdpMessageSize;
+            wr.wr.rdma.remote_addr = (uintptr_t)region + size / 2 + posted * OdpMessageSize;
+            if (ibv_post_send(res->queuePair, &wr, &badWR))
+                return 0;
+            posted++;
+        }
+
+        struct ibv_wc wc[OdpWindow];
+        int polled = ibv_poll_cq(res->compQueue, OdpWindow, wc);
+        for (int i = 0; i < polled; i++) {
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                fprintf(stderr, "Stream write failed with %s\n", ibv_wc_status_str(wc[i].status));
+                return 0;
+            }
+        }
+        if (polled < 0)
+            return 0;
+        completed += polled;
+    }
+    return (double)messages * OdpMessageSize / (nowNs() - start);
+}
+
+/* Registration time, first touch fault latency and bandwidth for one size and mode */
+static int runOdpCase(struct RDMAResource* res, size_t size, enum RegistrationMode mode)
+{
+    char* region = (char*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %zu bytes\n", size);
+        return 1;
+    }
+
+    int access = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
+    enum RegistrationMode used;
+    uint64_t start = nowNs();
+    struct ibv_mr* mr = registerMemory(res, region, size, access, mode, &used);
+    uint64_t registerNs = nowNs() - start;
+    if (!mr || used != mode) {
+        if (mr)
+            ibv_dereg_mr(mr);
+        munmap(region, size);
+        fprintf(stdout, "%6zuG %-9s not supported\n", size >> 30, registrationModeName(mode));
+        return mr ? 0 : 1;
+    }
+
+    /* First write to pages nobody touched yet */
+    std::vector<uint64_t> faults;
+    size_t stride = (size / 2 / OdpFaultSamples) & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+    for (int i = 0; i < OdpFaultSamples; i++) {
+        uint64_t latency = writeOnce(res, res->memoryHandle->lkey, (uintptr_t)res->buffer, mr->rkey,
+            (uintptr_t)region + size / 2 + i * stride, BufferSize);
+        if (!latency)
+            break;
+        faults.push_back(latency);
+    }
+    struct LatencyStats faultStats;
+    computeLatencyStats(faults, &faultStats);
+
+    start = nowNs();
+    if (used != RegisterPinned)
+        prefetchMemory(res, mr, region, size / 2 < OdpStreamLimit ? size / 2 : OdpStreamLimit, false);
+    uint64_t prefetchNs = nowNs() - start;
+
+    double firstPass = streamRegion(res, mr, region, size);
+    double steady = streamRegion(res, mr, region, size);
+
+    start = nowNs();
+    ibv_dereg_mr(mr);
+    uint64_t deregisterNs = nowNs() - start;
+    munmap(region, size);
+
+    fprintf(stdout, "%6zuG %-9s %10.3f %10.3f %10.2f %10.2f %10.3f %10.2f %10.2f\n", size >> 30, registrationModeName(mode),
+        registerNs / 1e9, deregisterNs / 1e9, faultStats.p50Ns / 1000, faultStats.p99Ns / 1000, prefetchNs / 1e9, firstPass, steady);
+    return faults.size() == OdpFaultSamples && steady > 0 ? 0 : 1;
+}
+
+/* Pinned vs explicit ODP vs implicit ODP registration for 1 GB up to the maximum size */
+int benchOdp(const struct benchConfig_t* config)
+{
+    size_t maxSize = config->size ? config->size : OdpDefaultMaxSize;
+    size_t physical = (size_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+
+    struct RDMAResource res;
+    openBenchResource(config, &res);
+
+    struct ExtendedQueue eq;
+    if (createExtendedQueue(&res, &eq, OdpQueueDepth, 0, ExtendedQueueClassic) || connectLoopback(&res)) {
+        destroyExtendedQueue(&res, &eq);
+        destroyRDMAResource(&res);
+        return 1;
+    }
+
+    struct OdpCaps caps;
+    memset(&caps, 0, sizeof(OdpCaps));
+    if (!queryOdpCaps(&res, &caps))
+        fprintf(stdout, "ODP: %s, implicit: %s, RC caps 0x%x\n", caps.supported ? "yes" : "no", caps.implicit ? "yes" : "no", caps.rcCaps);
+    /* registerMemory() would fall back to pinning the whole region only to have it thrown away */
+    bool modeSupported[] = { true, caps.supported, caps.supported && caps.implicit };
+
+    fprintf(stdout, "%7s %-9s %10s %10s %10s %10s %10s %10s %10s\n", "size", "mode", "reg s", "dereg s",
+        "fault p50", "fault p99", "prefetch s", "1st GB/s", "GB/s");
+
+    int result = 0;
+    for (size_t size = OdpMinSize; size <= maxSize; size *= 2) {
+        /* Pinned registration of more than half the host would starve everything else */
+        if (size > physical / 2) {
+            fprintf(stdout, "%6zuG skipped, host has %zu GB\n", size >> 30, physical >> 30);
+            break;
+        }
+        for (int mode = RegisterPinned; mode <= RegisterImplicit; mode++) {
+            if (modeSupported[mode])
+                result |= runOdpCase(&res, size, (RegistrationMode)mode);
+            else
+                fprintf(stdout, "%6zuG %-9s not supported\n", size >> 30, registrationModeName((RegistrationMode)mode));
+        }
+    }
+
+    destroyExtendedQueue(&res, &eq);
+    destroyRDMAResource(&res);
+    return result;
+}
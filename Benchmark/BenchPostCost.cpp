@@ -0,0 +1,124 @@
+#include "Source.h"
+#include "WorkRequest.h"
+
+constexpr auto PostDepth = 128;
+constexpr auto SignalInterval = 32;
+constexpr auto PostMessageSize = 32;
+
+/* Keep the compiler from dropping stores into a WR that is never posted */
+static inline void keepStores(void* wr)
+{
+    asm volatile("" : : "r"(wr) : "memory");
+}
+
+/* Build an inline RDMA write the way the tutorial code does */
+static inline void buildClassic(struct ibv_send_wr* wr, struct ibv_sge* sge, const struct RDMAResource* res, uint64_t wrId, bool signaled)
+{
+    memset(sge, 0, sizeof(ibv_sge));
+    sge->addr = (uintptr_t)res->buffer;
+    sge->length = PostMessageSize;
+    sge->lkey = res->memoryHandle->lkey;
+
+    memset(wr, 0, sizeof(ibv_send_wr));
+    wr->wr_id = wrId;
+    wr->sg_list = sge;
+    wr->num_sge = 1;
+    wr->opcode = IBV_WR_RDMA_WRITE;
+    wr->send_flags = IBV_SEND_INLINE | (signaled ? IBV_SEND_SIGNALED : 0);
+    wr->wr.rdma.remote_addr = res->remoteBuffer + BufferSize / 2;
+    wr->wr.rdma.rkey = res->remoteKey;
+}
+
+static void printCost(const char* name, uint64_t elapsedNs, uint64_t count)
+{
+    fprintf(stdout, "%-28s %8.2f ns/msg  %6.2f Mmsg/s\n", name, (double)elapsedNs / count, count * 1e3 / elapsedNs);
+}
+
+/* CPU cost of building and posting small inline writes, classic vs preallocated ring */
+int benchPostCost(const struct benchConfig_t* config)
+{
+    VerbsResource owner;
+    struct RDMAResource res;
+    if (owner.create(config->deviceName, config->devicePort))
+        return 1;
+    if (createLoopbackQueuePair(&owner, &res, PostDepth, PostMessageSize))
+        return 1;
+
+    typedef SendRing<IBV_WR_RDMA_WRITE, true, false> WriteRing;
+    WriteRing ring(res.queuePair, res.memoryHandle->lkey, res.remoteKey, PostDepth);
+
+    uint64_t batches = (config->iterations + SignalInterval - 1) / SignalInterval;
+    uint64_t count = batches * SignalInterval;
+    uint64_t localAddr = (uintptr_t)res.buffer;
+    uint64_t remoteAddr = res.remoteBuffer + BufferSize / 2;
+
+    /* Build only, nothing is posted */
+    struct ibv_send_wr wr;
+    struct ibv_sge sge;
+    uint64_t start = nowNs();
+    for (uint64_t i = 0; i < count; i++) {
+        buildClassic(&wr, &sge, &res, i, (i % SignalInterval) == SignalInterval - 1);
+        keepStores(&wr);
+        keepStores(&sge);
+    }
+    printCost("build classic", nowNs() - start, count);
+
+    start = nowNs();
+    for (uint64_t i = 0; i < count; i++) {
+        struct ibv_send_wr* stamped = ring.stamp(i, localAddr, PostMessageSize, remoteAddr);
+        if ((i % SignalInterval) == SignalInterval - 1)
+            WriteRing::signal(stamped);
+        keepStores(stamped);
+    }
+    printCost("build ring", nowNs() - start, count);
+
+    /* Build and post, only time spent posting is counted */
+    struct ibv_wc wc;
+    uint64_t posting = 0;
+    for (uint64_t b = 0; b < batches; b++) {
+        start = nowNs();
+        for (int j = 0; j < SignalInterval; j++) {
+            struct ibv_send_wr* badWR = nullptr;
+            buildClassic(&wr, &sge, &res, b * SignalInterval + j, j == SignalInterval - 1);
+            if (ibv_post_send(res.queuePair, &wr, &badWR))
+                return 1;
+        }
+        posting += nowNs() - start;
+        if (waitCompletion(&res, &wc))
+            return 1;
+    }
+    printCost("build+post classic", posting, count);
+
+    posting = 0;
+    for (uint64_t b = 0; b < batches; b++) {
+        start = nowNs();
+        for (int j = 0; j < SignalInterval; j++) {
+            struct ibv_send_wr* stamped = ring.stamp(b * SignalInterval + j, localAddr, PostMessageSize, remoteAddr);
+            if (j == SignalInterval - 1)
+                WriteRing::signal(stamped);
+            if (ring.post(stamped))
+                return 1;
+        }
+        posting += nowNs() - start;
+        if (waitCompletion(&res, &wc))
+            return 1;
+    }
+    printCost("stamp+post ring", posting, count);
+
+    posting = 0;
+    for (uint64_t b = 0; b < batches; b++) {
+        start = nowNs();
+        struct ibv_send_wr* stamped = nullptr;
+        for (int j = 0; j < SignalInterval; j++)
+            stamped = ring.stamp(b * SignalInterval + j, localAddr, PostMessageSize, remoteAddr);
+        WriteRing::signal(stamped);
+        if (ring.postLast(SignalInterval))
+            return 1;
+        posting += nowNs() - start;
+        if (waitCompletion(&res, &wc))
+            return 1;
+    }
+    printCost("stamp+post ring chained", posting, count);
+
+    return 0;
+}
@@ -0,0 +1,244 @@
+#include "Source.h"
+#include "QueuePairPool.h"
+
+#include <thread>
+
+constexpr auto PoolBenchRate = 100;				/* New connections per second */
+constexpr auto PoolBenchCapacity = 64;
+constexpr auto PoolBenchWarm = 8;
+constexpr auto PoolBenchRecvSize = 64;			/* Direct path receives share the 1KB resource buffer */
+
+/* One end of a connection built the classic way, everything on the critical path */
+struct DirectEnd {
+    struct ibv_qp*      qp;
+    struct ibv_cq*      cq;
+};
+
+/* Connection setup time split into its phases */
+struct SetupPhases {
+    uint64_t    acquireNs;      /* Create + INIT + receives, or take from the pool */
+    uint64_t    connectNs;      /* RTR + RTS of both ends */
+    uint64_t    firstByteNs;    /* First SEND until the peer's receive completion */
+};
+
+static int openDirectEnd(struct RDMAResource* res, struct DirectEnd* end)
+{
+    end->qp = nullptr;
+    end->cq = ibv_create_cq(res->context, 2 * PoolRecvDepth, nullptr, nullptr, 0);
+    if (!end->cq)
+        return 1;
+
+    struct ibv_qp_init_attr qpInitAttr;
+    memset(&qpInitAttr, 0, sizeof(ibv_qp_init_attr));
+    qpInitAttr.qp_type = IBV_QPT_RC;
+    qpInitAttr.sq_sig_all = 1;
+    qpInitAttr.send_cq = end->cq;
+    qpInitAttr.recv_cq = end->cq;
+    qpInitAttr.cap.max_send_wr = PoolRecvDepth;
+    qpInitAttr.cap.max_recv_wr = PoolRecvDepth;
+    qpInitAttr.cap.max_send_sge = 1;
+    qpInitAttr.cap.max_recv_sge = 1;
+    end->qp = ibv_create_qp(res->protectedDomain, &qpInitAttr);
+    if (!end->qp)
+        return 1;
+
+    struct RDMAResource view = *res;
+    view.queuePair = end->qp;
+    view.compQueue = end->cq;
+    if (modifyQPtoInit(&view))
+        return 1;
+
+    for (int slot = 0; slot < PoolRecvDepth; slot++) {
+        struct ibv_sge sge;
+        sge.addr = (uintptr_t)res->buffer + slot * PoolBenchRecvSize;
+        sge.length = PoolBenchRecvSize;
+        sge.lkey = res->memoryHandle->lkey;
+
+        struct ibv_recv_wr wr, *badWR = nullptr;
+        memset(&wr, 0, sizeof(wr));
+        wr.wr_id = slot;
+        wr.sg_list = &sge;
+        wr.num_sge = 1;
+        if (ibv_post_recv(end->qp, &wr, &badWR))
+            return 1;
+    }
+    return 0;
+}
+
+static void closeDirectEnd(struct DirectEnd* end)
+{
+    if (end->qp)
+        ibv_destroy_qp(end->qp);
+    if (end->cq)
+        ibv_destroy_cq(end->cq);
+}
+
+static int connectDirectEnd(struct RDMAResource* res, struct DirectEnd* end, const struct RDMAResource* peer,
+    uint32_t peerQueueNum)
+{
+    struct RDMAResource view = *res;
+    view.queuePair = end->qp;
+    view.compQueue = end->cq;
+    view.remoteQueueNum = peerQueueNum;
+    view.remoteId = peer->portAttr.lid;
+    view.remoteGid = peer->localGid;
+    if (modifyQPtoRTR(&view))
+        return 1;
+    return modifyQPtoRTS(&view);
+}
+
+/* One byte SEND from the client, returns once the server saw it and the client got its completion */
+static int sendFirstByte(struct RDMAResource* client, struct ibv_qp* clientQP, struct ibv_cq* clientCQ,
+    struct ibv_cq* serverCQ, uint64_t* firstByteNs)
+{
+    struct ibv_sge sge;
+    sge.addr = (uintptr_t)client->buffer + BufferSize - 1;
+    sge.length = 1;
+    sge.lkey = client->memoryHandle->lkey;
+
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_SEND;
+    wr.send_flags = IBV_SEND_SIGNALED;
+
+    uint64_t start = nowNs();
+    if (ibv_post_send(clientQP, &wr, &badWR)) {
+        fprintf(stderr, "Failed to post first byte\n");
+        return 1;
+    }
+
+    struct ibv_cq* cqs[2] = { serverCQ, clientCQ };
+    for (int i = 0; i < 2; i++) {
+        struct ibv_wc wc;
+        int polled = 0;
+        while (!polled)
+            polled = ibv_poll_cq(cqs[i], 1, &wc);
+        if (polled < 0 || wc.status != IBV_WC_SUCCESS) {
+            fprintf(stderr, "First byte completion failed\n");
+            return 1;
+        }
+        if (i == 0)
+            *firstByteNs = nowNs() - start;
+    }
+    return 0;
+}
+
+/* Open, connect, send one byte and close `connections` connections at PoolBenchRate per second */
+static int runConnections(const struct benchConfig_t* config, struct RDMAResource* server, struct RDMAResource* client,
+    bool pooled)
+{
+    struct QueuePairPool serverPool, clientPool;
+    int result = 0;
+    int poolsCreated = 0;
+    if (pooled) {
+        result = createQPPool(&serverPool, server, PoolBenchCapacity, PoolBenchWarm, PoolRecvDepth, PoolBenchRecvSize);
+        poolsCreated++;
+        if (!result) {
+            result = createQPPool(&clientPool, client, PoolBenchCapacity, PoolBenchWarm, PoolRecvDepth, PoolBenchRecvSize);
+            poolsCreated++;
+        }
+    }
+
+    std::vector<uint64_t> samples;
+    struct SetupPhases total;
+    memset(&total, 0, sizeof(SetupPhases));
+    const uint64_t interval = 1000000000ull / PoolBenchRate;
+    uint64_t next = nowNs();
+
+    for (int i = 0; i < config->iterations && !result; i++) {
+        uint64_t now = nowNs();
+        if (next > now)
+            std::this_thread::sleep_for(std::chrono::nanoseconds(next - now));
+        next += interval;
+
+        struct SetupPhases phases;
+        uint64_t start = nowNs();
+        struct DirectEnd serverEnd = { nullptr, nullptr }, clientEnd = { nullptr, nullptr };
+        struct PooledQueuePair* serverPQP = nullptr;
+        struct PooledQueuePair* clientPQP = nullptr;
+
+        if (pooled) {
+            serverPQP = acquirePooledQP(&serverPool);
+            clientPQP = acquirePooledQP(&clientPool);
+            result = !serverPQP || !clientPQP;
+            if (!result) {
+                serverEnd = { serverPQP->qp, serverPQP->cq };
+                clientEnd = { clientPQP->qp, clientPQP->cq };
+            }
+        }
+        else {
+            result = openDirectEnd(server, &serverEnd) || openDirectEnd(client, &clientEnd);
+        }
+        uint64_t acquired = nowNs();
+        phases.acquireNs = acquired - start;
+
+        if (!result) {
+            if (pooled)
+                result = connectPooledQP(&serverPool, serverPQP, clientEnd.qp->qp_num, client->portAttr.lid, &client->localGid) ||
+                    connectPooledQP(&clientPool, clientPQP, serverEnd.qp->qp_num, server->portAttr.lid, &server->localGid);
+            else
+                result = connectDirectEnd(server, &serverEnd, client, clientEnd.qp->qp_num) ||
+                    connectDirectEnd(client, &clientEnd, server, serverEnd.qp->qp_num);
+        }
+        phases.connectNs = nowNs() - acquired;
+
+        if (!result)
+            result = sendFirstByte(client, clientEnd.qp, clientEnd.cq, serverEnd.cq, &phases.firstByteNs);
+        if (!result) {
+            samples.push_back(phases.acquireNs + phases.connectNs + phases.firstByteNs);
+            total.acquireNs += phases.acquireNs;
+            total.connectNs += phases.connectNs;
+            total.firstByteNs += phases.firstByteNs;
+        }
+
+        /* Teardown is off the measured path in both modes */
+        if (pooled) {
+            if (serverPQP)
+                releasePooledQP(&serverPool, serverPQP);
+            if (clientPQP)
+                releasePooledQP(&clientPool, clientPQP);
+        }
+        else {
+            closeDirectEnd(&serverEnd);
+            closeDirectEnd(&clientEnd);
+        }
+    }
+
+    if (!result && !samples.empty()) {
+        struct LatencyStats stats;
+        computeLatencyStats(samples, &stats);
+        printLatencyStats(pooled ? "TTFB pooled QPs" : "TTFB create per conn", &stats);
+        fprintf(stdout, "%-24s acquire %.2fus, RTR+RTS %.2fus, first byte %.2fus (averages)\n", "",
+            total.acquireNs / 1000.0 / samples.size(), total.connectNs / 1000.0 / samples.size(),
+            total.firstByteNs / 1000.0 / samples.size());
+    }
+
+    if (poolsCreated > 1)
+        destroyQPPool(&clientPool);
+    if (poolsCreated > 0)
+        destroyQPPool(&serverPool);
+
+    /* Refill threads update the counters until destroyQPPool() joined them */
+    if (!result && !samples.empty() && pooled)
+        fprintf(stdout, "%-24s pool hits %lu, misses %lu, recycled %lu\n", "",
+            (unsigned long)(serverPool.hits + clientPool.hits), (unsigned long)(serverPool.misses + clientPool.misses),
+            (unsigned long)(serverPool.recycled + clientPool.recycled));
+    return result;
+}
+
+/* Time to first byte of new connections at a steady arrival rate, with and without the QP pool */
+int benchQPPool(const struct benchConfig_t* config)
+{
+    struct RDMAResource server, client;
+    openBenchResource(config, &server);
+    openBenchResource(config, &client);
+
+    fprintf(stdout, "%d connections at %d/s, both ends on the local HCA\n", config->iterations, PoolBenchRate);
+    int result = runConnections(config, &server, &client, false) || runConnections(config, &server, &client, true);
+
+    destroyRDMAResource(&client);
+    destroyRDMAResource(&server);
+    return result;
+}
@@ -0,0 +1,102 @@
+#include "Source.h"
+#include "AsyncEvents.h"
+
+constexpr auto RecoveryTimeoutNs = 5000000000ull;
+
+/* Loopback QP talks to itself, only the QP number has to be refreshed */
+static int loopbackExchange(struct RDMAResource* res, void*)
+{
+    res->remoteQueueNum = res->queuePair->qp_num;
+    return 0;
+}
+
+/* Measure time from QP failure to the first successful completion of a replayed request */
+int benchRecovery(const struct benchConfig_t* config)
+{
+    struct RDMAResource res;
+    openBenchResource(config, &res);
+    if (connectLoopback(&res)) {
+        destroyRDMAResource(&res);
+        return 1;
+    }
+
+    struct AsyncEventHandler handler;
+    handler.policy = RecoveryReplay;
+    handler.exchangeInfo = loopbackExchange;
+    handler.requestFailed = nullptr;
+    handler.userData = nullptr;
+    if (startAsyncEventHandler(&handler, &res, QueueSize)) {
+        destroyRDMAResource(&res);
+        return 1;
+    }
+
+    struct ibv_sge sge;
+    memset(&sge, 0, sizeof(sge));
+    sge.addr = (uintptr_t)res.buffer;
+    sge.length = 64;
+    sge.lkey = res.memoryHandle->lkey;
+
+    struct ibv_send_wr writeWR;
+    memset(&writeWR, 0, sizeof(writeWR));
+    writeWR.opcode = IBV_WR_RDMA_WRITE;
+    writeWR.send_flags = IBV_SEND_SIGNALED;
+    writeWR.sg_list = &sge;
+    writeWR.num_sge = 1;
+    writeWR.wr.rdma.remote_addr = res.remoteBuffer + BufferSize / 2;
+    writeWR.wr.rdma.rkey = res.remoteKey;
+
+    std::vector<uint64_t> userVisible, transition;
+    int result = 0;
+
+    for (int i = 0; i < config->iterations && !result; i++) {
+        /* Simulate a transport error, the write below is flushed and triggers recovery */
+        struct ibv_qp_attr errAttr;
+        memset(&errAttr, 0, sizeof(ibv_qp_attr));
+        errAttr.qp_state = IBV_QPS_ERR;
+
+        uint64_t start = nowNs();
+        if (ibv_modify_qp(res.queuePair, &errAttr, IBV_QP_STATE)) {
+            fprintf(stderr, "Failed to modify Queue Pair to ERR state\n");
+            result = 1;
+            break;
+        }
+
+        writeWR.wr_id = i;
+        if (postTrackedSend(&handler, &writeWR)) {
+            fprintf(stderr, "Failed to post tracked write\n");
+            result = 1;
+            break;
+        }
+
+        struct ibv_wc wc;
+        int delivered = 0;
+        while (!delivered) {
+            delivered = pollTrackedCompletions(&handler, &wc, 1);
+            if (delivered < 0 || nowNs() - start > RecoveryTimeoutNs) {
+                fprintf(stderr, "Request %d was not recovered\n", i);
+                result = 1;
+                break;
+            }
+        }
+        if (delivered > 0 && (wc.status != IBV_WC_SUCCESS || wc.wr_id != (uint64_t)i)) {
+            fprintf(stderr, "Unexpected completion wr_id %lu status %s\n", (unsigned long)wc.wr_id, ibv_wc_status_str(wc.status));
+            result = 1;
+        }
+
+        userVisible.push_back(nowNs() - start);
+        transition.push_back(handler.stats.lastRecoveryNs);
+    }
+
+    stopAsyncEventHandler(&handler);
+
+    struct LatencyStats stats;
+    computeLatencyStats(userVisible, &stats);
+    printLatencyStats("failure-to-completion", &stats);
+    computeLatencyStats(transition, &stats);
+    printLatencyStats("RESET->RTS+replay", &stats);
+    fprintf(stdout, "recoveries=%lu failed=%lu replayed=%lu\n", (unsigned long)handler.stats.recoveries,
+        (unsigned long)handler.stats.failedRecoveries, (unsigned long)handler.stats.replayed);
+
+    destroyRDMAResource(&res);
+    return result;
+}
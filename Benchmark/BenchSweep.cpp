@@ -0,0 +1,541 @@
+#include "Source.h"
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <thread>
+
+constexpr auto SweepDefaultSizes = "2:1M";
+constexpr auto SweepDefaultDepths = "1,128";
+constexpr auto SweepDefaultQps = "1";
+constexpr auto SweepDefaultThreads = "1";
+constexpr auto SweepDefaultOps = "write,read,send";
+constexpr auto SweepWindows = 10;				/* Run slices, the fastest one gives the peak bandwidth */
+constexpr auto SweepPollBatch = 16;
+constexpr auto SweepRecvFlag = 1ull << 63;		/* wr_id of receives, low bits hold the QP index */
+constexpr auto SweepMegabyte = 1024.0 * 1024;	/* perftest reports MB/sec in units of 2^20 */
+
+enum SweepOp {
+    SweepWrite,
+    SweepRead,
+    SweepSend,
+    SweepOpCount
+};
+
+static const char* sweepOpNames[SweepOpCount] = { "write", "read", "send" };
+static const char* sweepOpTitles[SweepOpCount] = { "RDMA_Write", "RDMA_Read", "Send" };
+
+/* One combination of the sweep parameters */
+struct SweepPoint {
+    enum SweepOp    op;
+    size_t          size;
+    int             depth;          /* Outstanding operations per QP */
+    int             qps;            /* QPs per thread */
+    int             threads;
+};
+
+struct SweepResult {
+    struct SweepPoint       point;
+    uint64_t                iterations;     /* Operations of every thread together */
+    double                  bwPeakMBs;
+    double                  bwAvgMBs;
+    double                  msgRateMpps;
+    struct LatencyStats     latency;        /* Post to completion, includes queueing when depth > 1 */
+};
+
+/* Per thread state of one measured point */
+struct SweepWorker {
+    struct VerbsResource*       owner;          /* Device context and buffer of this thread */
+    const struct SweepPoint*    point;
+    uint64_t                    iterations;
+    std::atomic<int>*           ready;
+    std::atomic<bool>*          go;
+    int                         result;
+    uint64_t                    elapsedNs;
+    uint64_t                    fastestWindowNs;
+    std::vector<uint64_t>       samples;
+};
+
+/* Parse number with optional K, M or G suffix */
+static int parseValue(const char* text, uint64_t* value)
+{
+    char* end = nullptr;
+    *value = strtoull(text, &end, 0);
+    if (*end == 'K' || *end == 'k')
+        *value <<= 10, end++;
+    else if (*end == 'M' || *end == 'm')
+        *value <<= 20, end++;
+    else if (*end == 'G' || *end == 'g')
+        *value <<= 30, end++;
+    return end == text || *end != '\0' || *value == 0;
+}
+
+/* Comma separated values and first:last ranges doubling from first */
+static int parseList(const char* text, std::vector<uint64_t>* values)
+{
+    char* copy = strdup(text);
+    char* saved = nullptr;
+    int result = 0;
+
+    for (char* token = strtok_r(copy, ",", &saved); token && !result; token = strtok_r(nullptr, ",", &saved)) {
+        char* colon = strchr(token, ':');
+        uint64_t first, last;
+        if (colon)
+            *colon = '\0';
+        result = parseValue(token, &first) || (colon && parseValue(colon + 1, &last));
+        if (result)
+            break;
+        if (!colon)
+            last = first;
+        for (uint64_t value = first; value <= last; value *= 2)
+            values->push_back(value);
+    }
+    free(copy);
+
+    if (result || values->empty()) {
+        fprintf(stderr, "Invalid sweep list '%s'\n", text);
+        return 1;
+    }
+    return 0;
+}
+
+static int parseOps(const char* text, std::vector<SweepOp>* ops)
+{
+    char* copy = strdup(text);
+    char* saved = nullptr;
+    int result = 0;
+
+    for (char* token = strtok_r(copy, ",", &saved); token && !result; token = strtok_r(nullptr, ",", &saved)) {
+        result = 1;
+        for (int op = 0; op < SweepOpCount; op++) {
+            if (!strcmp(token, sweepOpNames[op])) {
+                ops->push_back((SweepOp)op);
+                result = 0;
+            }
+        }
+        if (result)
+            fprintf(stderr, "Unknown sweep operation '%s'\n", token);
+    }
+    free(copy);
+    return result || ops->empty();
+}
+
+/* Signaled operation from the lower half of the buffer to the upper half */
+static int postSweepOp(struct ibv_qp* qp, const struct SweepPoint* point, const struct VerbsResource* owner, uint64_t wrId)
+{
+    size_t half = owner->buffer.size() / 2;
+
+    struct ibv_sge sge;
+    sge.addr = (uintptr_t)owner->buffer.get();
+    sge.length = point->size;
+    sge.lkey = owner->memoryHandle.lkey();
+
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = wrId;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = point->op == SweepWrite ? IBV_WR_RDMA_WRITE : point->op == SweepRead ? IBV_WR_RDMA_READ : IBV_WR_SEND;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.wr.rdma.remote_addr = (uintptr_t)owner->buffer.get() + half;
+    wr.wr.rdma.rkey = owner->memoryHandle.rkey();
+    return ibv_post_send(qp, &wr, &badWR);
+}
+
+/* Receive into the upper half of the buffer for loopback sends */
+static int postSweepRecv(struct ibv_qp* qp, const struct SweepPoint* point, const struct VerbsResource* owner, int qpIndex)
+{
+    size_t half = owner->buffer.size() / 2;
+
+    struct ibv_sge sge;
+    sge.addr = (uintptr_t)owner->buffer.get() + half;
+    sge.length = point->size;
+    sge.lkey = owner->memoryHandle.lkey();
+
+    struct ibv_recv_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = SweepRecvFlag | qpIndex;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    return ibv_post_recv(qp, &wr, &badWR);
+}
+
+/* RDMA reads in flight per QP, the device limit as perftest uses it. A loopback QP is its own responder,
+   so it takes the lower of the initiator and responder limits */
+static int sweepReadDepth(const struct VerbsResource* owner)
+{
+    return std::min({ owner->deviceAttr.max_qp_init_rd_atom, owner->deviceAttr.max_qp_rd_atom, 255 });
+}
+
+/* Create loopback QPs for the point, then keep `depth` operations in flight on each of them */
+static void runSweepWorker(struct SweepWorker* worker)
+{
+    const struct SweepPoint* point = worker->point;
+    struct VerbsResource* owner = worker->owner;
+    bool sends = point->op == SweepSend;
+    int result = 0;
+
+    CompletionQueue cq(owner->context, point->qps * point->depth * (sends ? 2 : 1));
+    std::vector<QueuePair> queuePairs;
+    result = !cq;
+
+    for (int q = 0; q < point->qps && !result; q++) {
+        struct ibv_qp_init_attr qpInitAttr;
+        memset(&qpInitAttr, 0, sizeof(ibv_qp_init_attr));
+        qpInitAttr.qp_type = IBV_QPT_RC;
+        qpInitAttr.send_cq = cq.get();
+        qpInitAttr.recv_cq = cq.get();
+        qpInitAttr.cap.max_send_wr = point->depth;
+        qpInitAttr.cap.max_recv_wr = sends ? point->depth : 1;
+        qpInitAttr.cap.max_send_sge = 1;
+        qpInitAttr.cap.max_recv_sge = 1;
+
+        queuePairs.emplace_back(owner->protectedDomain, &qpInitAttr);
+        struct RDMAResource view;
+        owner->view(&view);
+        view.compQueue = cq.get();
+        view.queuePair = queuePairs.back().get();
+        view.initiatorDepth = sweepReadDepth(owner);
+        view.responderDepth = sweepReadDepth(owner);
+        result = !view.queuePair || connectLoopback(&view);
+
+        for (int r = 0; r < point->depth && sends && !result; r++)
+            result = postSweepRecv(view.queuePair, point, owner, q);
+    }
+
+    std::vector<uint64_t> postedAt(point->qps * point->depth);
+    worker->samples.clear();
+    worker->samples.reserve(worker->iterations);
+
+    /* Every thread is set up before the clock starts */
+    (*worker->ready)++;
+    while (!*worker->go)
+        ;
+    if (result) {
+        worker->result = 1;
+        return;
+    }
+
+    uint64_t window = worker->iterations / SweepWindows ? worker->iterations / SweepWindows : 1;
+    uint64_t posted = 0, completed = 0;
+    uint64_t start = nowNs(), windowStart = start;
+    worker->fastestWindowNs = UINT64_MAX;
+
+    for (int slot = 0; slot < point->depth && !result; slot++) {
+        for (int q = 0; q < point->qps && posted < worker->iterations && !result; q++) {
+            uint64_t wrId = q * point->depth + slot;
+            postedAt[wrId] = nowNs();
+            result = postSweepOp(queuePairs[q].get(), point, owner, wrId);
+            posted++;
+        }
+    }
+
+    struct ibv_wc wc[SweepPollBatch];
+    while (completed < worker->iterations && !result) {
+        int polled = ibv_poll_cq(cq.get(), SweepPollBatch, wc);
+        if (polled < 0) {
+            fprintf(stderr, "Poll CQ failed\n");
+            result = 1;
+        }
+        uint64_t now = polled > 0 ? nowNs() : 0;
+
+        for (int i = 0; i < polled && !result; i++) {
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                fprintf(stderr, "%s completion with status %s\n", sweepOpNames[point->op], ibv_wc_status_str(wc[i].status));
+                result = 1;
+                break;
+            }
+            if (wc[i].wr_id & SweepRecvFlag) {
+                int q = wc[i].wr_id & ~SweepRecvFlag;
+                result = postSweepRecv(queuePairs[q].get(), point, owner, q);
+                continue;
+            }
+
+            worker->samples.push_back(now - postedAt[wc[i].wr_id]);
+            if (++completed % window == 0) {
+                worker->fastestWindowNs = std::min(worker->fastestWindowNs, now - windowStart);
+                windowStart = now;
+            }
+            if (posted < worker->iterations) {
+                postedAt[wc[i].wr_id] = now;
+                result = postSweepOp(queuePairs[wc[i].wr_id / point->depth].get(), point, owner, wc[i].wr_id);
+                posted++;
+            }
+        }
+    }
+    worker->elapsedNs = nowNs() - start;
+    if (worker->fastestWindowNs == UINT64_MAX)
+        worker->fastestWindowNs = worker->elapsedNs;
+
+    /* Outstanding receives of the send test are flushed with the QPs */
+    worker->result = result;
+}
+
+/* Run one point on every thread and combine the per thread numbers */
+static int measurePoint(std::vector<VerbsResource>& contexts, const struct SweepPoint* point, uint64_t iterations,
+    struct SweepResult* sweepResult)
+{
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<SweepWorker> workers(point->threads);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < point->threads; t++) {
+        workers[t].owner = &contexts[t];
+        workers[t].point = point;
+        workers[t].iterations = iterations;
+        workers[t].ready = &ready;
+        workers[t].go = &go;
+        workers[t].result = 0;
+        workers[t].elapsedNs = 0;
+        workers[t].fastestWindowNs = 0;
+        threads.emplace_back(runSweepWorker, &workers[t]);
+    }
+    while (ready < point->threads)
+        ;
+    go = true;
+    for (auto& thread : threads)
+        thread.join();
+
+    uint64_t slowest = 0;
+    double peak = 0;
+    std::vector<uint64_t> samples;
+    for (auto& worker : workers) {
+        if (worker.result)
+            return 1;
+        slowest = std::max(slowest, worker.elapsedNs);
+        uint64_t window = iterations / SweepWindows ? iterations / SweepWindows : 1;
+        peak += (double)point->size * window / worker.fastestWindowNs;
+        samples.insert(samples.end(), worker.samples.begin(), worker.samples.end());
+    }
+
+    sweepResult->point = *point;
+    sweepResult->iterations = iterations * point->threads;
+    sweepResult->bwPeakMBs = peak * 1e9 / SweepMegabyte;
+    sweepResult->bwAvgMBs = (double)point->size * sweepResult->iterations * 1e9 / slowest / SweepMegabyte;
+    sweepResult->msgRateMpps = sweepResult->iterations * 1e3 / slowest;
+    computeLatencyStats(samples, &sweepResult->latency);
+    return 0;
+}
+
+static bool sameGroup(const struct SweepPoint* a, const struct SweepPoint* b)
+{
+    return a->op == b->op && a->depth == b->depth && a->qps == b->qps && a->threads == b->threads;
+}
+
+/* ib_write_bw / ib_send_lat style tables, one banner per operation, depth, QP and thread count */
+static void printTables(FILE* out, const std::vector<SweepResult>& results, int readDepth)
+{
+    const char* rule = "---------------------------------------------------------------------------------------";
+    for (size_t first = 0; first < results.size();) {
+        const struct SweepPoint* group = &results[first].point;
+        size_t end = first;
+        while (end < results.size() && sameGroup(&results[end].point, group))
+            end++;
+
+        fprintf(out, "%s\n", rule);
+        fprintf(out, "                    %s BW Test\n", sweepOpTitles[group->op]);
+        fprintf(out, " Number of qps   : %-8d Threads        : %d\n", group->qps, group->threads);
+        fprintf(out, " Connection type : RC       Loopback       : ON\n");
+        fprintf(out, " TX depth        : %d\n", group->depth);
+        if (group->op == SweepRead)
+            fprintf(out, " Outstand reads  : %d\n", readDepth);
+        fprintf(out, "%s\n", rule);
+        fprintf(out, " #bytes     #iterations    BW peak[MB/sec]    BW average[MB/sec]   MsgRate[Mpps]\n");
+        for (size_t i = first; i < end; i++) {
+            const struct SweepResult* r = &results[i];
+            fprintf(out, " %-7zu    %-7lu          %-7.2f            %-7.2f\t\t   %-7.6f\n", r->point.size,
+                (unsigned long)r->iterations, r->bwPeakMBs, r->bwAvgMBs, r->msgRateMpps);
+        }
+
+        fprintf(out, "%s\n", rule);
+        fprintf(out, " #bytes #iterations    t_min[usec]    t_max[usec]  t_typical[usec]    t_avg[usec]    t_stdev[usec]"
+            "   99%% percentile[usec]   99.9%% percentile[usec]\n");
+        for (size_t i = first; i < end; i++) {
+            const struct LatencyStats* l = &results[i].latency;
+            fprintf(out, " %-7zu %-7lu          %-7.2f        %-7.2f      %-7.2f  \t     %-7.2f     \t%-7.2f\t\t%-7.2f\t\t%-7.2f\n",
+                results[i].point.size, (unsigned long)results[i].iterations, l->minNs / 1000, l->maxNs / 1000,
+                l->p50Ns / 1000, l->avgNs / 1000, l->stdevNs / 1000, l->p99Ns / 1000, l->p999Ns / 1000);
+        }
+        fprintf(out, "%s\n", rule);
+        first = end;
+    }
+}
+
+static const char* csvHeader = "op,size,depth,qps,threads,iterations,bw_peak_mbs,bw_avg_mbs,msg_rate_mpps,"
+    "lat_min_us,lat_max_us,lat_typical_us,lat_avg_us,lat_stdev_us,lat_p99_us,lat_p999_us";
+
+static void printCsv(FILE* out, const std::vector<SweepResult>& results)
+{
+    fprintf(out, "%s\n", csvHeader);
+    for (const auto& r : results) {
+        const struct LatencyStats* l = &r.latency;
+        fprintf(out, "%s,%zu,%d,%d,%d,%lu,%.2f,%.2f,%.6f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", sweepOpNames[r.point.op],
+            r.point.size, r.point.depth, r.point.qps, r.point.threads, (unsigned long)r.iterations, r.bwPeakMBs, r.bwAvgMBs,
+            r.msgRateMpps, l->minNs / 1000, l->maxNs / 1000, l->p50Ns / 1000, l->avgNs / 1000, l->stdevNs / 1000,
+            l->p99Ns / 1000, l->p999Ns / 1000);
+    }
+}
+
+static void printJson(FILE* out, const std::vector<SweepResult>& results)
+{
+    fprintf(out, "[\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const struct SweepResult* r = &results[i];
+        const struct LatencyStats* l = &r->latency;
+        fprintf(out, "  {\"op\": \"%s\", \"size\": %zu, \"depth\": %d, \"qps\": %d, \"threads\": %d, \"iterations\": %lu, "
+            "\"bw_peak_mbs\": %.2f, \"bw_avg_mbs\": %.2f, \"msg_rate_mpps\": %.6f, \"lat_min_us\": %.3f, \"lat_max_us\": %.3f, "
+            "\"lat_typical_us\": %.3f, \"lat_avg_us\": %.3f, \"lat_stdev_us\": %.3f, \"lat_p99_us\": %.3f, \"lat_p999_us\": %.3f}%s\n",
+            sweepOpNames[r->point.op], r->point.size, r->point.depth, r->point.qps, r->point.threads,
+            (unsigned long)r->iterations, r->bwPeakMBs, r->bwAvgMBs, r->msgRateMpps, l->minNs / 1000, l->maxNs / 1000,
+            l->p50Ns / 1000, l->avgNs / 1000, l->stdevNs / 1000, l->p99Ns / 1000, l->p999Ns / 1000,
+            i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "]\n");
+}
+
+/* Read a CSV report written by printCsv */
+static int loadBaseline(const char* path, std::vector<SweepResult>* baseline)
+{
+    FILE* in = fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "Failed to open baseline '%s': %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    char line[512], op[16];
+    while (fgets(line, sizeof(line), in)) {
+        struct SweepResult r;
+        struct LatencyStats* l = &r.latency;
+        unsigned long iterations;
+        memset(&r, 0, sizeof(SweepResult));
+        if (sscanf(line, "%15[^,],%zu,%d,%d,%d,%lu,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf", op, &r.point.size,
+            &r.point.depth, &r.point.qps, &r.point.threads, &iterations, &r.bwPeakMBs, &r.bwAvgMBs, &r.msgRateMpps,
+            &l->minNs, &l->maxNs, &l->p50Ns, &l->avgNs, &l->stdevNs, &l->p99Ns, &l->p999Ns) != 16)
+            continue;
+
+        std::vector<SweepOp> ops;
+        if (parseOps(op, &ops))
+            continue;
+        r.point.op = ops[0];
+        r.iterations = iterations;
+        double* latencies[] = { &l->minNs, &l->maxNs, &l->p50Ns, &l->avgNs, &l->stdevNs, &l->p99Ns, &l->p999Ns };
+        for (double* latency : latencies)
+            *latency *= 1000;
+        baseline->push_back(r);
+    }
+    fclose(in);
+
+    if (baseline->empty()) {
+        fprintf(stderr, "Baseline '%s' has no sweep results\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+/* Compare average bandwidth and typical latency of every point found in the baseline */
+static int compareBaseline(FILE* out, const struct benchConfig_t* config, const std::vector<SweepResult>& results,
+    const std::vector<SweepResult>& baseline)
+{
+    int regressions = 0, compared = 0;
+    fprintf(out, "\nBaseline %s, thresholds: bandwidth -%.1f%%, latency +%.1f%%\n", config->baseline,
+        config->bwThreshold, config->latThreshold);
+    fprintf(out, "%-6s %9s %6s %4s %8s %12s %12s %8s %10s %10s %8s  %s\n", "op", "bytes", "depth", "qps", "threads",
+        "base MB/s", "MB/s", "delta", "base us", "us", "delta", "verdict");
+
+    for (const auto& r : results) {
+        const struct SweepResult* base = nullptr;
+        for (const auto& b : baseline) {
+            if (sameGroup(&b.point, &r.point) && b.point.size == r.point.size)
+                base = &b;
+        }
+        if (!base)
+            continue;
+
+        compared++;
+        double bwDelta = base->bwAvgMBs > 0 ? 100 * (r.bwAvgMBs - base->bwAvgMBs) / base->bwAvgMBs : 0;
+        double latDelta = base->latency.p50Ns > 0 ? 100 * (r.latency.p50Ns - base->latency.p50Ns) / base->latency.p50Ns : 0;
+        bool regressed = -bwDelta > config->bwThreshold || latDelta > config->latThreshold;
+        regressions += regressed;
+
+        fprintf(out, "%-6s %9zu %6d %4d %8d %12.2f %12.2f %+7.1f%% %10.2f %10.2f %+7.1f%%  %s\n", sweepOpNames[r.point.op],
+            r.point.size, r.point.depth, r.point.qps, r.point.threads, base->bwAvgMBs, r.bwAvgMBs, bwDelta,
+            base->latency.p50Ns / 1000, r.latency.p50Ns / 1000, latDelta, regressed ? "REGRESSION" : "ok");
+    }
+
+    fprintf(out, "%d of %zu points compared, %d regressions\n", compared, results.size(), regressions);
+    return regressions ? 1 : 0;
+}
+
+/* Sweep size, depth, QP count, thread count and operation over loopback RC QPs of the local HCA */
+int benchSweep(const struct benchConfig_t* config)
+{
+    std::vector<uint64_t> sizes, depths, qpCounts, threadCounts;
+    std::vector<SweepOp> ops;
+    const char* format = config->format ? config->format : "table";
+
+    if (parseList(config->sweepSizes ? config->sweepSizes : SweepDefaultSizes, &sizes) ||
+        parseList(config->sweepDepths ? config->sweepDepths : SweepDefaultDepths, &depths) ||
+        parseList(config->sweepQps ? config->sweepQps : SweepDefaultQps, &qpCounts) ||
+        parseList(config->sweepThreads ? config->sweepThreads : SweepDefaultThreads, &threadCounts) ||
+        parseOps(config->sweepOps ? config->sweepOps : SweepDefaultOps, &ops))
+        return 1;
+
+    if (strcmp(format, "table") && strcmp(format, "csv") && strcmp(format, "json")) {
+        fprintf(stderr, "Unknown report format '%s'\n", format);
+        return 1;
+    }
+
+    std::vector<SweepResult> baseline;
+    if (config->baseline && loadBaseline(config->baseline, &baseline))
+        return 1;
+
+    /* One device context and buffer per thread, shared by every point */
+    uint64_t maxSize = *std::max_element(sizes.begin(), sizes.end());
+    uint64_t maxThreads = *std::max_element(threadCounts.begin(), threadCounts.end());
+    std::vector<VerbsResource> contexts(maxThreads);
+    for (auto& owner : contexts) {
+        if (owner.create(config->deviceName, config->devicePort, 2 * maxSize,
+            IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE))
+            return 1;
+    }
+
+    std::vector<SweepResult> results;
+    for (SweepOp op : ops) {
+        for (uint64_t threads : threadCounts) {
+            for (uint64_t qps : qpCounts) {
+                for (uint64_t depth : depths) {
+                    for (uint64_t size : sizes) {
+                        struct SweepPoint point = { op, size, (int)depth, (int)qps, (int)threads };
+                        struct SweepResult result;
+                        if (measurePoint(contexts, &point, config->iterations, &result)) {
+                            fprintf(stderr, "%s of %zu bytes, depth %d, %d QPs, %d threads failed\n", sweepOpNames[op],
+                                point.size, point.depth, point.qps, point.threads);
+                            return 1;
+                        }
+                        results.push_back(result);
+                    }
+                }
+            }
+        }
+    }
+
+    FILE* out = config->output ? fopen(config->output, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Failed to open '%s': %s\n", config->output, strerror(errno));
+        return 1;
+    }
+    if (!strcmp(format, "csv"))
+        printCsv(out, results);
+    else if (!strcmp(format, "json"))
+        printJson(out, results);
+    else
+        printTables(out, results, sweepReadDepth(&contexts[0]));
+    if (out != stdout)
+        fclose(out);
+
+    /* Keep a machine readable report on stdout parseable */
+    if (!baseline.empty())
+        return compareBaseline(out == stdout && strcmp(format, "table") ? stderr : stdout, config, results, baseline);
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include "Source.h"
+
+struct benchEntry_t
+{
+	const char*	name;
+	benchFunc_t	func;
+	const char*	description;
+};
+
+static const struct benchEntry_t benchmarks[] =
+{
+    {"recovery", benchRecovery, "QP error recovery time with in-flight request replay"},
+    {"churn", benchChurn, "QP and resource create/destroy rate with leak check"},
+    {"postcost", benchPostCost, "CPU cost per posted message, memset builder vs WR ring"},
+    {"extpost", benchExtendedPost, "Message rate and CPU cycles, classic vs extended post/poll API"},
+    {"multirail", benchMultiRail, "Striped RDMA write bandwidth over 1..N active ports"},
+    {"odp", benchOdp, "Registration time, fault latency and bandwidth, pinned vs ODP MRs"},
+    {"mw", benchMemoryWindow, "Per-request grant cost, memory window bind/invalidate vs reg/dereg"},
+    {"kv", benchKeyValue, "Key-value GET latency, one-sided RDMA READ vs two-sided RPC"},
+    {"collectives", benchCollectives, "Broadcast/allreduce/allgather bandwidth vs size and rank count, ring vs tree"},
+    {"filestream", benchFileStream, "File to file streaming over pipelined RDMA writes, O_DIRECT vs mmap source"},
+    {"async", benchAsync, "Per-operation cost of coroutine awaitables vs raw and callback poll loops"},
+    {"sweep", benchSweep, "Write/read/send bandwidth and latency sweep with perftest style, CSV or JSON report"},
+    {"qppool", benchQPPool, "Time to first byte of new connections at 100/s with and without a pre-created QP pool"},
+    {"fairness", benchFairness, "RPC tail latency next to a bulk flow, plain, SL/TC, rate limited and DRR scheduled"},
+    {"integrity", benchIntegrity, "Bandwidth cost of CRC32C/xxHash message checksums per size, header vs immediate data"},
+};
+
+/* Print usage information */
+void usage(const char* argv0)
+{
+    fprintf(stdout, "Usage:\n");
+    fprintf(stdout, " %s -d <device> -t <test> run a benchmark on the local HCA\n", argv0);
+    fprintf(stdout, "\n");
+    fprintf(stdout, "Options:\n");
+    fprintf(stdout, " -d, --ib-device <name> kernel name of IB device\n");
+    fprintf(stdout, " -i, --ib-port <number> IB device port number (default 1)\n");
+    fprintf(stdout, " -t, --test <name> benchmark to run\n");
+    fprintf(stdout, " -n, --iterations <number> measured iterations (default 1000)\n");
+    fprintf(stdout, " -s, --size <bytes> message or transfer size (default depends on benchmark)\n");
+    fprintf(stdout, "\n");
+    fprintf(stdout, "Sweep options (lists are comma separated, first:last doubles from first to last):\n");
+    fprintf(stdout, " -S, --sizes <list> message sizes, K/M suffixes allowed (default 2:1M)\n");
+    fprintf(stdout, " -D, --depths <list> outstanding operations per QP (default 1,128)\n");
+    fprintf(stdout, " -Q, --qps <list> QPs per thread (default 1)\n");
+    fprintf(stdout, " -T, --threads <list> threads, each with its own device context (default 1)\n");
+    fprintf(stdout, " -O, --ops <list> write, read and/or send (default write,read,send)\n");
+    fprintf(stdout, " -f, --format <name> table, csv or json (default table)\n");
+    fprintf(stdout, " -o, --output <file> write the report to file instead of stdout\n");
+    fprintf(stdout, " -b, --baseline <file> CSV report of an earlier sweep, fail on regressions against it\n");
+    fprintf(stdout, " -B, --bw-threshold <percent> allowed bandwidth drop (default 5)\n");
+    fprintf(stdout, " -L, --lat-threshold <percent> allowed typical latency increase (default 10)\n");
+    fprintf(stdout, "\n");
+    fprintf(stdout, "Fairness options:\n");
+    fprintf(stdout, " -l, --sl <number> service level of the RPC flow (default 0)\n");
+    fprintf(stdout, " -c, --tclass <number> GRH traffic class of the RPC flow, RoCE only (default 0)\n");
+    fprintf(stdout, " -r, --rate <Mbps> rate limit of the bulk flow (default 10000)\n");
+    fprintf(stdout, "\n");
+    fprintf(stdout, "Benchmarks:\n");
+    for (const auto& bench : benchmarks)
+        fprintf(stdout, " %-16s %s\n", bench.name, bench.description);
+}
+
+/* Parse command line options */
+int fillOptions(struct benchConfig_t* config, int argc, char* argv[])
+{
+    struct option options[] =
+    {
+        {"ib-device", required_argument, NULL, 'd'},
+        {"ib-port", required_argument, NULL, 'i'},
+        {"test", required_argument, NULL, 't'},
+        {"iterations", required_argument, NULL, 'n'},
+        {"size", required_argument, NULL, 's'},
+        {"sizes", required_argument, NULL, 'S'},
+        {"depths", required_argument, NULL, 'D'},
+        {"qps", required_argument, NULL, 'Q'},
+        {"threads", required_argument, NULL, 'T'},
+        {"ops", required_argument, NULL, 'O'},
+        {"format", required_argument, NULL, 'f'},
+        {"output", required_argument, NULL, 'o'},
+        {"baseline", required_argument, NULL, 'b'},
+        {"bw-threshold", required_argument, NULL, 'B'},
+        {"lat-threshold", required_argument, NULL, 'L'},
+        {"sl", required_argument, NULL, 'l'},
+        {"tclass", required_argument, NULL, 'c'},
+        {"rate", required_argument, NULL, 'r'},
+        {NULL, no_argument, NULL, '\0'}
+    };
+
+    int c = 0;
+    while ((c = getopt_long(argc, argv, "d:i:t:n:s:S:D:Q:T:O:f:o:b:B:L:l:c:r:", options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'd':
+            config->deviceName = strdup(optarg);
+            break;
+        case 'i':
+            config->devicePort = strtol(optarg, NULL, 0);
+            if (config->devicePort <= 0)
+                return 1;
+            break;
+        case 't':
+            config->testName = strdup(optarg);
+            break;
+        case 'n':
+            config->iterations = strtol(optarg, NULL, 0);
+            if (config->iterations <= 0)
+                return 1;
+            break;
+        case 's':
+            config->size = strtoull(optarg, NULL, 0);
+            break;
+        case 'S':
+            config->sweepSizes = strdup(optarg);
+            break;
+        case 'D':
+            config->sweepDepths = strdup(optarg);
+            break;
+        case 'Q':
+            config->sweepQps = strdup(optarg);
+            break;
+        case 'T':
+            config->sweepThreads = strdup(optarg);
+            break;
+        case 'O':
+            config->sweepOps = strdup(optarg);
+            break;
+        case 'f':
+            config->format = strdup(optarg);
+            break;
+        case 'o':
+            config->output = strdup(optarg);
+            break;
+        case 'b':
+            config->baseline = strdup(optarg);
+            break;
+        case 'B':
+            config->bwThreshold = strtod(optarg, NULL);
+            if (config->bwThreshold < 0)
+                return 1;
+            break;
+        case 'L':
+            config->latThreshold = strtod(optarg, NULL);
+            if (config->latThreshold < 0)
+                return 1;
+            break;
+        case 'l':
+            config->serviceLevel = strtol(optarg, NULL, 0);
+            if (config->serviceLevel < 0 || config->serviceLevel > 15)
+                return 1;
+            break;
+        case 'c':
+            config->trafficClass = strtol(optarg, NULL, 0);
+            if (config->trafficClass < 0 || config->trafficClass > 255)
+                return 1;
+            break;
+        case 'r':
+            config->rateLimit = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    return !config->deviceName || !config->testName;
+}
+
+int main(int argc, char* argv[])
+{
+    struct benchConfig_t config;
+    memset(&config, 0, sizeof(benchConfig_t));
+    config.devicePort = 1;
+    config.iterations = 1000;
+    config.bwThreshold = 5;
+    config.latThreshold = 10;
+
+    if (fillOptions(&config, argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (const auto& bench : benchmarks) {
+        if (!strcmp(bench.name, config.testName))
+            return bench.func(&config);
+    }
+
+    fprintf(stderr, "Unknown benchmark: %s\n", config.testName);
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <getopt.h>
+#include <vector>
+
+#include "LibVerbsHelper.h"
+#include "VerbsResources.h"
+
+struct benchConfig_t
+{
+	const char*	deviceName;		/* HCA kernel device name */
+	int			devicePort;		/* HCA device port */
+	const char*	testName;		/* Benchmark to run */
+	int			iterations;		/* Number of measured iterations */
+	size_t		size;			/* Message or transfer size, 0 for benchmark default */
+	const char*	sweepSizes;		/* Sweep lists, comma separated values or first:last doubling ranges */
+	const char*	sweepDepths;
+	const char*	sweepQps;
+	const char*	sweepThreads;
+	const char*	sweepOps;
+	const char*	format;			/* Sweep report: table, csv or json */
+	const char*	output;			/* Sweep report file, stdout when NULL */
+	const char*	baseline;		/* CSV of an earlier sweep to compare against */
+	double		bwThreshold;	/* Allowed bandwidth drop against the baseline in percent */
+	double		latThreshold;	/* Allowed typical latency increase against the baseline in percent */
+	int			serviceLevel;	/* SL of the latency sensitive flow */
+	int			trafficClass;	/* GRH traffic class of the latency sensitive flow, RoCE ports only */
+	uint32_t	rateLimit;		/* Bulk flow rate limit in Mb/s, 0 for benchmark default */
+};
+
+struct LatencyStats
+{
+	uint64_t	samples;
+	double		minNs;
+	double		avgNs;
+	double		stdevNs;
+	double		p50Ns;
+	double		p99Ns;
+	double		p999Ns;
+	double		p9999Ns;
+	double		maxNs;
+};
+
+/* Benchmark entry point, returns 0 on success */
+typedef int (*benchFunc_t)(const struct benchConfig_t* config);
+
+/* CPU timestamp counter, nanoseconds where no TSC is available */
+uint64_t readCycles();
+
+/* Open device and create resources selected by the config */
+void openBenchResource(const struct benchConfig_t* config, struct RDMAResource* res);
+
+/* Connect resource QP to itself and move it to RTS */
+int connectLoopback(struct RDMAResource* res);
+
+/* Connect the QPs of two resources to each other and move both to RTS */
+int connectPair(struct RDMAResource* first, struct RDMAResource* second);
+
+/* Replace resource QP with one of the given send/recv depth and inline size,
+ * connected to itself. `res` is filled with a non owning view */
+int createLoopbackQueuePair(struct VerbsResource* owner, struct RDMAResource* res, uint32_t depth, uint32_t maxInline);
+
+/* Wait for one completion on the resource CQ, returns 0 on success */
+int waitCompletion(struct RDMAResource* res, struct ibv_wc* wc);
+
+/* Sort samples and compute latency percentiles */
+void computeLatencyStats(std::vector<uint64_t>& samples, struct LatencyStats* stats);
+
+/* Print latency percentiles in microseconds */
+void printLatencyStats(const char* name, const struct LatencyStats* stats);
+
+/* Benchmarks */
+int benchRecovery(const struct benchConfig_t* config);
+int benchChurn(const struct benchConfig_t* config);
+int benchPostCost(const struct benchConfig_t* config);
+int benchExtendedPost(const struct benchConfig_t* config);
+int benchMultiRail(const struct benchConfig_t* config);
+int benchOdp(const struct benchConfig_t* config);
+int benchMemoryWindow(const struct benchConfig_t* config);
+int benchKeyValue(const struct benchConfig_t* config);
+int benchCollectives(const struct benchConfig_t* config);
+int benchFileStream(const struct benchConfig_t* config);
+int benchAsync(const struct benchConfig_t* config);
+int benchSweep(const struct benchConfig_t* config);
+int benchQPPool(const struct benchConfig_t* config);
+int benchFairness(const struct benchConfig_t* config);
+int benchIntegrity(const struct benchConfig_t* config);
@@ -0,0 +1,441 @@
+#include "AsyncEvents.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+static uint64_t makeTrackedId(uint32_t slot, uint32_t generation)
+{
+    return ((uint64_t)generation << 32) | slot;
+}
+
+/* Interrupt poll() in the async event thread */
+static void wakeupAsyncThread(struct AsyncEventHandler* handler)
+{
+    uint64_t value = 1;
+    if (write(handler->wakeupFd, &value, sizeof(value)) < 0)
+        fprintf(stderr, "Failed to wake up async event handler\n");
+}
+
+/* Find a free in-flight slot, -1 if table is full. Called with lock held */
+static int allocInflightSlot(struct AsyncEventHandler* handler)
+{
+    for (size_t i = 0; i < handler->inflight.size(); i++) {
+        if (!handler->inflight[i].used)
+            return (int)i;
+    }
+    return -1;
+}
+
+/* Post the request stored in slot with a fresh generation. Called with lock held */
+static int postInflightSlot(struct AsyncEventHandler* handler, uint32_t slot)
+{
+    struct InflightRequest& req = handler->inflight[slot];
+    req.generation++;
+
+    int result = 0;
+    if (req.isRecv) {
+        struct ibv_recv_wr* badWR = nullptr;
+        req.recvWR.wr_id = makeTrackedId(slot, req.generation);
+        req.recvWR.sg_list = req.sgeList;
+        req.recvWR.next = nullptr;
+        result = ibv_post_recv(handler->res->queuePair, &req.recvWR, &badWR);
+    }
+    else {
+        struct ibv_send_wr* badWR = nullptr;
+        req.sendWR.wr_id = makeTrackedId(slot, req.generation);
+        req.sendWR.sg_list = req.sgeList;
+        req.sendWR.next = nullptr;
+        result = ibv_post_send(handler->res->queuePair, &req.sendWR, &badWR);
+    }
+    return result;
+}
+
+/* Drop every in-flight request, reporting it to the caller. Called with lock held */
+static void failInflightRequests(struct AsyncEventHandler* handler)
+{
+    for (auto& req : handler->inflight) {
+        if (!req.used)
+            continue;
+        req.used = false;
+        handler->stats.failed++;
+        if (handler->requestFailed)
+            handler->requestFailed(req.userWrId, IBV_WC_WR_FLUSH_ERR, handler->userData);
+    }
+}
+
+/* Replace an overrun CQ, the QP attached to it has to be recreated as well */
+static int recreateCompletionQueue(struct RDMAResource* res)
+{
+    int cqSize = res->compQueue ? res->compQueue->cqe * 2 : QueueSize;
+    if (cqSize > res->deviceAttr.max_cqe)
+        cqSize = res->deviceAttr.max_cqe;
+
+    if (res->queuePair) {
+        ibv_destroy_qp(res->queuePair);
+        res->queuePair = NULL;
+    }
+    if (res->compQueue) {
+        ibv_destroy_cq(res->compQueue);
+        res->compQueue = NULL;
+    }
+
+    res->compQueue = ibv_create_cq(res->context, cqSize, nullptr, nullptr, 0);
+    if (!res->compQueue) {
+        fprintf(stderr, "Failed to recreate CQ with %d entries\n", cqSize);
+        return 1;
+    }
+    fprintf(stdout, "Recreate Completion Queue with %d entries\n", cqSize);
+
+    return createQueuePair(res);
+}
+
+/* Move failed QP through RESET->INIT->RTR->RTS and replay or fail in-flight requests */
+int recoverQueuePair(struct AsyncEventHandler* handler)
+{
+    struct RDMAResource* res = handler->res;
+    std::lock_guard<std::mutex> guard(handler->lock);
+
+    handler->recovering = true;
+    handler->recoveryRequested = false;
+    uint64_t start = nowNs();
+
+    int result = 0;
+    uint32_t oldQueueNum = res->queuePair ? res->queuePair->qp_num : 0;
+
+    if (handler->cqOverrun) {
+        handler->cqOverrun = false;
+        result = recreateCompletionQueue(res);
+    }
+    else {
+        struct ibv_qp_attr resetAttr;
+        memset(&resetAttr, 0, sizeof(ibv_qp_attr));
+        resetAttr.qp_state = IBV_QPS_RESET;
+        result = ibv_modify_qp(res->queuePair, &resetAttr, IBV_QP_STATE);
+        if (result)
+            fprintf(stderr, "Failed to modify Queue Pair to RESET state\n");
+    }
+
+    if (!result)
+        result = modifyQPtoInit(res);
+
+    /* New QP number or PSNs must be agreed with the remote side before RTR */
+    if (!result && handler->exchangeInfo)
+        result = handler->exchangeInfo(res, handler->userData);
+    else if (!result && res->queuePair->qp_num != oldQueueNum) {
+        fprintf(stderr, "QP number changed and no exchange callback is set\n");
+        result = 1;
+    }
+
+    /* Receive requests must be in place before the remote side can send */
+    if (!result && handler->policy == RecoveryReplay) {
+        for (uint32_t i = 0; i < handler->inflight.size() && !result; i++) {
+            if (handler->inflight[i].used && handler->inflight[i].isRecv)
+                result = postInflightSlot(handler, i);
+        }
+    }
+
+    if (!result)
+        result = modifyQPtoRTR(res);
+    if (!result)
+        result = modifyQPtoRTS(res);
+
+    if (!result && handler->policy == RecoveryReplay) {
+        for (uint32_t i = 0; i < handler->inflight.size() && !result; i++) {
+            if (handler->inflight[i].used && !handler->inflight[i].isRecv) {
+                result = postInflightSlot(handler, i);
+                handler->stats.replayed++;
+            }
+        }
+    }
+
+    if (result || handler->policy == RecoveryFail)
+        failInflightRequests(handler);
+
+    uint64_t elapsed = nowNs() - start;
+    if (result) {
+        handler->stats.failedRecoveries++;
+        fprintf(stderr, "QP 0x%x recovery failed\n", oldQueueNum);
+    }
+    else {
+        handler->stats.recoveries++;
+        handler->stats.lastRecoveryNs = elapsed;
+        if (elapsed > handler->stats.maxRecoveryNs)
+            handler->stats.maxRecoveryNs = elapsed;
+        fprintf(stdout, "QP 0x%x recovered in %lu us\n", res->queuePair->qp_num, (unsigned long)(elapsed / 1000));
+    }
+
+    handler->recovering = false;
+    return result;
+}
+
+/* Dispatch one async event. Returns 1 if the QP has to be recovered,
+ * 2 if the CQ overran and CQ and QP have to be recreated */
+static int handleAsyncEvent(struct AsyncEventHandler* handler, struct ibv_async_event* event)
+{
+    struct RDMAResource* res = handler->res;
+
+    switch (event->event_type) {
+    case IBV_EVENT_PORT_ACTIVE:
+        if (event->element.port_num == res->devicePort) {
+            fprintf(stdout, "Port %d in device '%s' is active\n", res->devicePort, res->deviceName);
+            handler->portActive = true;
+        }
+        break;
+    case IBV_EVENT_PORT_ERR:
+        if (event->element.port_num == res->devicePort) {
+            fprintf(stderr, "Port %d in device '%s' is down\n", res->devicePort, res->deviceName);
+            handler->portActive = false;
+            handler->stats.portDownEvents++;
+        }
+        break;
+    case IBV_EVENT_QP_FATAL:
+    case IBV_EVENT_QP_REQ_ERR:
+    case IBV_EVENT_QP_ACCESS_ERR:
+        fprintf(stderr, "QP 0x%x error event: %s\n", event->element.qp->qp_num, ibv_event_type_str(event->event_type));
+        /* Other QPs of the context belong to someone else */
+        return event->element.qp == res->queuePair;
+    case IBV_EVENT_CQ_ERR:
+        fprintf(stderr, "CQ overrun event, CQ has %d entries\n", event->element.cq->cqe);
+        if (event->element.cq != res->compQueue)
+            break;
+        handler->stats.cqOverruns++;
+        return 2;
+    case IBV_EVENT_PATH_MIG:
+        fprintf(stdout, "QP 0x%x migrated to alternate path\n", event->element.qp->qp_num);
+        handler->stats.pathMigrations++;
+        break;
+    case IBV_EVENT_PATH_MIG_ERR:
+        fprintf(stderr, "QP 0x%x path migration failed\n", event->element.qp->qp_num);
+        return event->element.qp == res->queuePair;
+    case IBV_EVENT_DEVICE_FATAL: {
+        fprintf(stderr, "Device '%s' fatal error, recovery is not possible\n", res->deviceName);
+        /* Nothing in flight will complete any more, new requests are refused */
+        std::lock_guard<std::mutex> guard(handler->lock);
+        handler->deviceFatal = true;
+        handler->recoveryRequested = false;
+        failInflightRequests(handler);
+        break;
+    }
+    default:
+        fprintf(stdout, "Async event: %s\n", ibv_event_type_str(event->event_type));
+        break;
+    }
+    return 0;
+}
+
+static void asyncEventLoop(struct AsyncEventHandler* handler)
+{
+    struct RDMAResource* res = handler->res;
+    struct pollfd pfd[2];
+    pfd[0].fd = res->context->async_fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = handler->wakeupFd;
+    pfd[1].events = POLLIN;
+
+    while (handler->running) {
+        pfd[0].revents = pfd[1].revents = 0;
+        poll(pfd, 2, AsyncPollTimeoutMs);
+
+        if (pfd[1].revents & POLLIN) {
+            uint64_t value;
+            if (read(handler->wakeupFd, &value, sizeof(value)) < 0)
+                fprintf(stderr, "Failed to read async handler wakeup event\n");
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            struct ibv_async_event event;
+            while (!ibv_get_async_event(res->context, &event)) {
+                int action = handleAsyncEvent(handler, &event);
+                /* Ack before touching the CQ or QP, destroy waits for outstanding events */
+                ibv_ack_async_event(&event);
+                if (action == 2)
+                    handler->cqOverrun = true;
+                if (action)
+                    handler->recoveryRequested = true;
+            }
+        }
+
+        /* Wait for the link before trying to bring QP back to RTS */
+        if (handler->recoveryRequested && handler->portActive && !handler->deviceFatal)
+            recoverQueuePair(handler);
+    }
+}
+
+/* Start async event thread for the resource. In-flight table holds `slots` requests */
+int startAsyncEventHandler(struct AsyncEventHandler* handler, struct RDMAResource* res, int slots)
+{
+    handler->res = res;
+    handler->inflight.assign(slots, InflightRequest());
+    memset(&handler->stats, 0, sizeof(RecoveryStats));
+    handler->portActive = res->portAttr.state == IBV_PORT_ACTIVE;
+    handler->recoveryRequested = false;
+    handler->recovering = false;
+    handler->cqOverrun = false;
+    handler->deviceFatal = false;
+
+    /* Non-blocking async fd lets the thread notice stop requests */
+    int flags = fcntl(res->context->async_fd, F_GETFL);
+    if (fcntl(res->context->async_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        fprintf(stderr, "Failed to change async event file descriptor to non-blocking\n");
+        return 1;
+    }
+
+    handler->wakeupFd = eventfd(0, EFD_NONBLOCK);
+    if (handler->wakeupFd < 0) {
+        fprintf(stderr, "Failed to create async handler wakeup event\n");
+        return 1;
+    }
+
+    handler->running = true;
+    handler->thread = std::thread(asyncEventLoop, handler);
+    fprintf(stdout, "Async event handler started for device '%s'\n", res->deviceName);
+    return 0;
+}
+
+/* Stop async event thread */
+void stopAsyncEventHandler(struct AsyncEventHandler* handler)
+{
+    handler->running = false;
+    wakeupAsyncThread(handler);
+    if (handler->thread.joinable())
+        handler->thread.join();
+    if (handler->wakeupFd >= 0) {
+        close(handler->wakeupFd);
+        handler->wakeupFd = -1;
+    }
+}
+
+/* Ask the event thread to recover the QP (e.g. after an error completion) */
+void requestRecovery(struct AsyncEventHandler* handler)
+{
+    handler->recoveryRequested = true;
+    wakeupAsyncThread(handler);
+}
+
+/* Fill a free slot with a copy of the request. Called with lock held */
+static int storeInflight(struct AsyncEventHandler* handler, uint64_t wrId, struct ibv_sge* sgList, int numSge, bool isRecv)
+{
+    if (numSge > MaxTrackedSge) {
+        fprintf(stderr, "Tracked request supports up to %d SGEs\n", MaxTrackedSge);
+        return -1;
+    }
+
+    int slot = allocInflightSlot(handler);
+    if (slot < 0) {
+        fprintf(stderr, "In-flight request table is full\n");
+        return -1;
+    }
+
+    struct InflightRequest& req = handler->inflight[slot];
+    req.used = true;
+    req.isRecv = isRecv;
+    req.userWrId = wrId;
+    memcpy(req.sgeList, sgList, numSge * sizeof(ibv_sge));
+    return slot;
+}
+
+/* Post send request and keep it until completion. Queued while recovery is running */
+int postTrackedSend(struct AsyncEventHandler* handler, struct ibv_send_wr* wr)
+{
+    std::lock_guard<std::mutex> guard(handler->lock);
+    if (handler->deviceFatal)
+        return ENODEV;
+
+    for (; wr; wr = wr->next) {
+        int slot = storeInflight(handler, wr->wr_id, wr->sg_list, wr->num_sge, false);
+        if (slot < 0)
+            return ENOMEM;
+        handler->inflight[slot].sendWR = *wr;
+
+        /* Replayed once the QP is back in RTS */
+        if (handler->recoveryRequested || handler->recovering)
+            continue;
+
+        int result = postInflightSlot(handler, slot);
+        if (result) {
+            handler->inflight[slot].used = false;
+            return result;
+        }
+    }
+    return 0;
+}
+
+/* Post receive request and keep it until completion. Queued while recovery is running */
+int postTrackedRecv(struct AsyncEventHandler* handler, struct ibv_recv_wr* wr)
+{
+    std::lock_guard<std::mutex> guard(handler->lock);
+    if (handler->deviceFatal)
+        return ENODEV;
+
+    for (; wr; wr = wr->next) {
+        int slot = storeInflight(handler, wr->wr_id, wr->sg_list, wr->num_sge, true);
+        if (slot < 0)
+            return ENOMEM;
+        handler->inflight[slot].recvWR = *wr;
+
+        if (handler->recoveryRequested || handler->recovering)
+            continue;
+
+        int result = postInflightSlot(handler, slot);
+        if (result) {
+            handler->inflight[slot].used = false;
+            return result;
+        }
+    }
+    return 0;
+}
+
+/* Translate a completion of a tracked request. Returns 1 if the completion
+ * should be delivered to the caller, 0 if it was consumed by the recovery path.
+ * Called with lock held */
+static int completeTrackedRequest(struct AsyncEventHandler* handler, struct ibv_wc* wc)
+{
+    uint32_t slot = (uint32_t)wc->wr_id;
+    uint32_t generation = (uint32_t)(wc->wr_id >> 32);
+    if (slot >= handler->inflight.size())
+        return 0;
+
+    struct InflightRequest& req = handler->inflight[slot];
+
+    /* Flushed completion of a request that has been reposted since */
+    if (!req.used || req.generation != generation)
+        return 0;
+
+    if (wc->status != IBV_WC_SUCCESS) {
+        /* Keep the request, the recovery path replays or fails it */
+        handler->recoveryRequested = true;
+        wakeupAsyncThread(handler);
+        return 0;
+    }
+
+    req.used = false;
+    wc->wr_id = req.userWrId;
+    return 1;
+}
+
+/* Poll CQ for tracked completions. Returns number of completions stored in wc
+ * with the caller's wr_id restored, or -1 on poll error */
+int pollTrackedCompletions(struct AsyncEventHandler* handler, struct ibv_wc* wc, int count)
+{
+    std::lock_guard<std::mutex> guard(handler->lock);
+
+    /* CQ is about to be recreated */
+    if (handler->cqOverrun)
+        return 0;
+
+    int polled = ibv_poll_cq(handler->res->compQueue, count, wc);
+    if (polled < 0) {
+        handler->recoveryRequested = true;
+        wakeupAsyncThread(handler);
+        return -1;
+    }
+
+    int delivered = 0;
+    for (int i = 0; i < polled; i++) {
+        if (completeTrackedRequest(handler, &wc[i]))
+            wc[delivered++] = wc[i];
+    }
+    return delivered;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "LibVerbsHelper.h"
+
+constexpr auto MaxTrackedSge = 4;
+constexpr auto AsyncPollTimeoutMs = 100;
+
+/* What to do with requests that were in flight when the QP failed */
+enum RecoveryPolicy {
+	RecoveryReplay,		/* Repost requests once QP is back in RTS */
+	RecoveryFail		/* Report requests back to the caller as failed */
+};
+
+/* Re-exchange QP information with the remote side, return 0 on success */
+typedef int (*exchangeQPInfo_t)(struct RDMAResource* res, void* userData);
+
+/* Report a request that will not be completed */
+typedef void (*requestFailed_t)(uint64_t wrId, enum ibv_wc_status status, void* userData);
+
+struct InflightRequest {
+	union {
+		struct ibv_send_wr	sendWR;
+		struct ibv_recv_wr	recvWR;
+	};
+	struct ibv_sge			sgeList[MaxTrackedSge];
+	uint64_t				userWrId;		/* wr_id supplied by the caller */
+	uint32_t				generation;		/* Bumped on every (re)post */
+	bool					isRecv;
+	bool					used;
+};
+
+struct RecoveryStats {
+	uint64_t	recoveries;			/* Successful QP recoveries */
+	uint64_t	failedRecoveries;	/* Recoveries that could not reach RTS */
+	uint64_t	replayed;			/* Requests reposted after recovery */
+	uint64_t	failed;				/* Requests reported back as failed */
+	uint64_t	portDownEvents;		/* IBV_EVENT_PORT_ERR count */
+	uint64_t	cqOverruns;			/* IBV_EVENT_CQ_ERR count */
+	uint64_t	pathMigrations;		/* IBV_EVENT_PATH_MIG count */
+	uint64_t	lastRecoveryNs;		/* Duration of last recovery */
+	uint64_t	maxRecoveryNs;		/* Longest recovery seen */
+};
+
+struct AsyncEventHandler {
+	struct RDMAResource*			res;
+	std::thread						thread;
+	int								wakeupFd;			/* eventfd to interrupt poll() */
+	std::mutex						lock;				/* Guards QP transitions and in-flight table */
+	std::vector<InflightRequest>	inflight;			/* Indexed by wr_id slot */
+	std::atomic<bool>				running;
+	std::atomic<bool>				portActive;
+	std::atomic<bool>				recoveryRequested;
+	std::atomic<bool>				recovering;
+	std::atomic<bool>				cqOverrun;			/* CQ and QP must be recreated */
+	std::atomic<bool>				deviceFatal;
+	RecoveryPolicy					policy;
+	exchangeQPInfo_t				exchangeInfo;		/* Optional, called between INIT and RTR */
+	requestFailed_t					requestFailed;		/* Optional, called for dropped requests */
+	void*							userData;
+	struct RecoveryStats			stats;
+};
+
+/* Start async event thread for the resource. In-flight table holds `slots` requests */
+int startAsyncEventHandler(struct AsyncEventHandler* handler, struct RDMAResource* res, int slots);
+
+/* Stop async event thread */
+void stopAsyncEventHandler(struct AsyncEventHandler* handler);
+
+/* Ask the event thread to recover the QP (e.g. after an error completion) */
+void requestRecovery(struct AsyncEventHandler* handler);
+
+/* Move failed QP through RESET->INIT->RTR->RTS and replay or fail in-flight requests */
+int recoverQueuePair(struct AsyncEventHandler* handler);
+
+/* Post send request and keep it until completion. Queued while recovery is running,
+ * ENODEV after a fatal device error */
+int postTrackedSend(struct AsyncEventHandler* handler, struct ibv_send_wr* wr);
+
+/* Post receive request and keep it until completion. Queued while recovery is running,
+ * ENODEV after a fatal device error */
+int postTrackedRecv(struct AsyncEventHandler* handler, struct ibv_recv_wr* wr);
+
+/* Poll CQ for tracked completions. Returns number of completions stored in wc
+ * with the caller's wr_id restored, or -1 on poll error. Completions of failed
+ * requests are consumed here and handled by the recovery path */
+int pollTrackedCompletions(struct AsyncEventHandler* handler, struct ibv_wc* wc, int count);
@@ -0,0 +1,244 @@
+#include "AsyncVerbs.h"
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <sched.h>
+
+std::atomic<uint64_t> asyncFrameAllocations(0);
+
+/* Free frames of this thread by size class, returned to the heap when the thread exits */
+struct FramePool {
+    std::vector<void*>  classes[AsyncFrameClasses];
+
+    ~FramePool() {
+        for (auto& frames : classes) {
+            for (void* frame : frames)
+                ::operator delete(frame);
+        }
+    }
+};
+
+static thread_local struct FramePool framePool;
+
+void* allocateAsyncFrame(size_t size)
+{
+    size_t sizeClass = (size + AsyncFrameGranule - 1) / AsyncFrameGranule;
+    if (sizeClass < AsyncFrameClasses && !framePool.classes[sizeClass].empty()) {
+        void* frame = framePool.classes[sizeClass].back();
+        framePool.classes[sizeClass].pop_back();
+        return frame;
+    }
+
+    asyncFrameAllocations++;
+    if (sizeClass < AsyncFrameClasses)
+        return ::operator new(sizeClass * AsyncFrameGranule);
+    return ::operator new(size);
+}
+
+void freeAsyncFrame(void* frame, size_t size)
+{
+    size_t sizeClass = (size + AsyncFrameGranule - 1) / AsyncFrameGranule;
+    if (sizeClass < AsyncFrameClasses)
+        framePool.classes[sizeClass].push_back(frame);
+    else
+        ::operator delete(frame);
+}
+
+void AsyncTask::promise_type::return_void()
+{
+    /* Last task takes the slot of this one */
+    auto& tasks = executor->tasks;
+    tasks[slot] = tasks.back();
+    tasks[slot].promise().slot = slot;
+    tasks.pop_back();
+    executor->live--;
+}
+
+/* Post the request, resumes at once (returns false) when posting failed */
+bool AsyncOperation::await_suspend(std::coroutine_handle<> handle)
+{
+    waiter = handle;
+    int posted;
+    if (isRecv) {
+        struct ibv_recv_wr* badWR = nullptr;
+        recvWR.wr_id = (uintptr_t)this;
+        recvWR.sg_list = &sge;
+        posted = ibv_post_recv(executor->res->queuePair, &recvWR, &badWR);
+    }
+    else {
+        struct ibv_send_wr* badWR = nullptr;
+        sendWR.wr_id = (uintptr_t)this;
+        sendWR.sg_list = &sge;
+        posted = ibv_post_send(executor->res->queuePair, &sendWR, &badWR);
+    }
+
+    if (posted) {
+        fprintf(stderr, "Failed to post async %s, error %d\n", isRecv ? "receive" : "send", posted);
+        result.status = -1;
+        return false;
+    }
+    executor->posted++;
+    return true;
+}
+
+/* Set up executor for `res`, `maxReady` tasks may be spawned between two polls without allocation */
+int createAsyncExecutor(struct AsyncExecutor* exec, struct RDMAResource* res, int core, size_t maxReady)
+{
+    exec->res = res;
+    exec->core = core;
+    exec->live = 0;
+    exec->posted = 0;
+    exec->completed = 0;
+    exec->ready.clear();
+    exec->running.clear();
+    exec->tasks.clear();
+    exec->ready.reserve(maxReady);
+    exec->running.reserve(maxReady);
+    exec->tasks.reserve(maxReady);
+
+    if (!res->queuePair || !res->compQueue) {
+        fprintf(stderr, "Async executor needs a QP and CQ\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Hand task to the executor, it starts on the next turn of the run loop */
+void spawnAsync(struct AsyncExecutor* exec, AsyncTask task)
+{
+    task.handle.promise().executor = exec;
+    task.handle.promise().slot = exec->tasks.size();
+    exec->live++;
+    exec->tasks.push_back(task.handle);
+    exec->ready.push_back(task.handle);
+}
+
+/* Free the frames of every task that did not return, none of them is resumed again */
+static void destroyAsyncTasks(struct AsyncExecutor* exec)
+{
+    for (auto task : exec->tasks)
+        task.destroy();
+    exec->tasks.clear();
+    exec->ready.clear();
+    exec->running.clear();
+    exec->live = 0;
+}
+
+/* Poll the CQ and resume coroutines until every spawned task returned, tasks left after a failure are destroyed */
+int runAsyncExecutor(struct AsyncExecutor* exec)
+{
+    if (exec->core >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(exec->core, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+            fprintf(stderr, "Failed to pin async executor to CPU %d\n", exec->core);
+    }
+
+    struct ibv_wc wc[AsyncPollBatch];
+    while (exec->live) {
+        /* Tasks spawned by resumed coroutines wait for the next turn */
+        if (!exec->ready.empty()) {
+            exec->running.swap(exec->ready);
+            for (size_t i = 0; i < exec->running.size(); i++)
+                exec->running[i].resume();
+            exec->running.clear();
+            continue;
+        }
+
+        int polled = ibv_poll_cq(exec->res->compQueue, AsyncPollBatch, wc);
+        if (polled < 0) {
+            fprintf(stderr, "Poll CQ failed\n");
+            destroyAsyncTasks(exec);
+            return 1;
+        }
+        for (int i = 0; i < polled; i++) {
+            struct AsyncOperation* op = (struct AsyncOperation*)(uintptr_t)wc[i].wr_id;
+            op->result.status = wc[i].status;
+            op->result.byteLen = wc[i].byte_len;
+            op->result.immData = (wc[i].wc_flags & IBV_WC_WITH_IMM) ? ntohl(wc[i].imm_data) : 0;
+            exec->completed++;
+            op->waiter.resume();
+        }
+    }
+    return 0;
+}
+
+static struct AsyncOperation sendOperation(struct AsyncExecutor* exec, enum ibv_wr_opcode opcode, void* addr,
+    uint32_t length, uint32_t lkey)
+{
+    struct AsyncOperation op;
+    memset(&op.sendWR, 0, sizeof(op.sendWR));
+    op.executor = exec;
+    op.isRecv = false;
+    op.sge.addr = (uintptr_t)addr;
+    op.sge.length = length;
+    op.sge.lkey = lkey;
+    op.sendWR.num_sge = 1;
+    op.sendWR.opcode = opcode;
+    op.sendWR.send_flags = IBV_SEND_SIGNALED;
+    op.result.status = 0;
+    op.result.byteLen = 0;
+    op.result.immData = 0;
+    return op;
+}
+
+struct AsyncOperation asyncSend(struct AsyncExecutor* exec, void* addr, uint32_t length, uint32_t lkey)
+{
+    return sendOperation(exec, IBV_WR_SEND, addr, length, lkey);
+}
+
+struct AsyncOperation asyncRecv(struct AsyncExecutor* exec, void* addr, uint32_t length, uint32_t lkey)
+{
+    struct AsyncOperation op;
+    memset(&op.recvWR, 0, sizeof(op.recvWR));
+    op.executor = exec;
+    op.isRecv = true;
+    op.sge.addr = (uintptr_t)addr;
+    op.sge.length = length;
+    op.sge.lkey = lkey;
+    op.recvWR.num_sge = 1;
+    op.result.status = 0;
+    op.result.byteLen = 0;
+    op.result.immData = 0;
+    return op;
+}
+
+struct AsyncOperation asyncWrite(struct AsyncExecutor* exec, void* addr, uint32_t length, uint32_t lkey,
+    uint64_t remoteAddr, uint32_t rkey)
+{
+    struct AsyncOperation op = sendOperation(exec, IBV_WR_RDMA_WRITE, addr, length, lkey);
+    op.sendWR.wr.rdma.remote_addr = remoteAddr;
+    op.sendWR.wr.rdma.rkey = rkey;
+    return op;
+}
+
+struct AsyncOperation asyncRead(struct AsyncExecutor* exec, void* addr, uint32_t length, uint32_t lkey,
+    uint64_t remoteAddr, uint32_t rkey)
+{
+    struct AsyncOperation op = sendOperation(exec, IBV_WR_RDMA_READ, addr, length, lkey);
+    op.sendWR.wr.rdma.remote_addr = remoteAddr;
+    op.sendWR.wr.rdma.rkey = rkey;
+    return op;
+}
+
+struct AsyncOperation asyncFetchAdd(struct AsyncExecutor* exec, uint64_t* original, uint32_t lkey,
+    uint64_t remoteAddr, uint32_t rkey, uint64_t add)
+{
+    struct AsyncOperation op = sendOperation(exec, IBV_WR_ATOMIC_FETCH_AND_ADD, original, sizeof(uint64_t), lkey);
+    op.sendWR.wr.atomic.remote_addr = remoteAddr;
+    op.sendWR.wr.atomic.rkey = rkey;
+    op.sendWR.wr.atomic.compare_add = add;
+    return op;
+}
+
+struct AsyncOperation asyncCompareSwap(struct AsyncExecutor* exec, uint64_t* original, uint32_t lkey,
+    uint64_t remoteAddr, uint32_t rkey, uint64_t compare, uint64_t swap)
+{
+    struct AsyncOperation op = sendOperation(exec, IBV_WR_ATOMIC_CMP_AND_SWP, original, sizeof(uint64_t), lkey);
+    op.sendWR.wr.atomic.remote_addr = remoteAddr;
+    op.sendWR.wr.atomic.rkey = rkey;
+    op.sendWR.wr.atomic.compare_add = compare;
+    op.sendWR.wr.atomic.swap = swap;
+    return op;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <vector>
+
+#include "LibVerbsHelper.h"
+
+constexpr auto AsyncPollBatch = 16;
+constexpr auto AsyncFrameGranule = 64;			/* Frame pool size classes */
+constexpr auto AsyncFrameClasses = 64;			/* Frames above 4KB go straight to the heap */
+
+struct AsyncExecutor;
+
+/* Coroutine frames are recycled through a per thread free list, so spawning a
+ * task per request does not reach the heap once the pool is warm */
+void* allocateAsyncFrame(size_t size);
+void freeAsyncFrame(void* frame, size_t size);
+
+/* Frames taken from the heap so far, every thread */
+extern std::atomic<uint64_t> asyncFrameAllocations;
+
+/* Coroutine run by an executor. Starts once spawned, its frame is released when it returns */
+struct AsyncTask {
+	struct promise_type {
+		struct AsyncExecutor*	executor = nullptr;
+		size_t					slot = 0;			/* Index in the executor's task list */
+
+		AsyncTask get_return_object() { return AsyncTask{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void();
+		void unhandled_exception() { std::terminate(); }
+
+		static void* operator new(size_t size) { return allocateAsyncFrame(size); }
+		static void operator delete(void* frame, size_t size) { freeAsyncFrame(frame, size); }
+	};
+
+	std::coroutine_handle<promise_type>	handle;
+};
+
+/* Value of co_await on an operation */
+struct AsyncResult {
+	int						status;			/* 0 on success, ibv_wc_status of the completion or -1 when posting failed */
+	uint32_t				byteLen;		/* Bytes received by a recv */
+	uint32_t				immData;		/* Host order immediate data of a recv, 0 without */
+};
+
+/* One work request awaited by a coroutine. Lives in the coroutine frame, its address
+ * is the wr_id, so the poller finds the coroutine to resume without any lookup */
+struct AsyncOperation {
+	struct AsyncExecutor*	executor;
+	bool					isRecv;
+	union {
+		struct ibv_send_wr	sendWR;
+		struct ibv_recv_wr	recvWR;
+	};
+	struct ibv_sge			sge;
+	std::coroutine_handle<>	waiter;
+	struct AsyncResult		result;
+
+	bool await_ready() const noexcept { return false; }
+	/* Post the request, resumes at once (returns false) when posting failed */
+	bool await_suspend(std::coroutine_handle<> handle);
+	struct AsyncResult await_resume() const noexcept { return result; }
+};
+
+/* Single threaded executor driving the coroutines of one QP/CQ. Run one per core */
+struct AsyncExecutor {
+	struct RDMAResource*					res;		/* Connected QP and its CQ, owned by the caller */
+	int										core;		/* CPU the run loop is pinned to, -1 to leave as is */
+	uint64_t								live;		/* Spawned tasks that did not return yet */
+	uint64_t								posted;
+	uint64_t								completed;
+	std::vector<std::coroutine_handle<>>	ready;		/* Spawned and not started yet */
+	std::vector<std::coroutine_handle<>>	running;	/* Batch of ready tasks being started */
+	std::vector<std::coroutine_handle<AsyncTask::promise_type>>	tasks;	/* Every live task, destroyed when the run fails */
+};
+
+/* Set up executor for `res`, `maxReady` tasks may be spawned between two polls without allocation */
+int createAsyncExecutor(struct AsyncExecutor* exec, struct RDMAResource* res, int core, size_t maxReady);
+
+/* Hand task to the executor, it starts on the next turn of the run loop */
+void spawnAsync(struct AsyncExecutor* exec, AsyncTask task);
+
+/* Poll the CQ and resume coroutines until every spawned task returned. Returns 0 on success.
+ * On failure the frames of the suspended tasks are freed while their work requests may still be
+ * posted, destroy the QP or move it to error and drain the CQ without resuming anything */
+int runAsyncExecutor(struct AsyncExecutor* exec);
+
+/* Awaitable operations on the executor's QP, every one is signaled */
+struct AsyncOperation asyncSend(struct AsyncExecutor* exec, void* addr, uint32_t length, uint32_t lkey);
+struct AsyncOperation asyncRecv(struct AsyncExecutor* exec, void* addr, uint32_t length, uint32_t lkey);
+struct AsyncOperation asyncWrite(struct AsyncExecutor* exec, void* addr, uint32_t length, uint32_t lkey,
+	uint64_t remoteAddr, uint32_t rkey);
+struct AsyncOperation asyncRead(struct AsyncExecutor* exec, void* addr, uint32_t length, uint32_t lkey,
+	uint64_t remoteAddr, uint32_t rkey);
+
+/* Remote atomics, the original remote value lands in `original` */
+struct AsyncOperation asyncFetchAdd(struct AsyncExecutor* exec, uint64_t* original, uint32_t lkey,
+	uint64_t remoteAddr, uint32_t rkey, uint64_t add);
+struct AsyncOperation asyncCompareSwap(struct AsyncExecutor* exec, uint64_t* original, uint32_t lkey,
+	uint64_t remoteAddr, uint32_t rkey, uint64_t compare, uint64_t swap);
@@ -0,0 +1,721 @@
+#include "Collectives.h"
+
+#include <arpa/inet.h>
+
+/* Immediate data: phase (4 bits) | step (8 bits) | chunk (20 bits) */
+enum CollectivePhase {
+    PhaseReady = 0,         /* Sender entered the next collective, its buffers may be written */
+    PhaseData = 1,          /* Chunk landed in data */
+    PhaseStaging = 2        /* Partial result landed in staging */
+};
+
+constexpr auto CollectiveMaxChunks = 1u << 20;
+
+static uint32_t makeImm(uint32_t phase, uint32_t step, uint32_t chunk)
+{
+    return (phase << 28) | (step << 20) | chunk;
+}
+
+/* Create CQ, one QP per peer and data/staging buffers of `capacity` bytes */
+int createCommunicator(struct Communicator* comm, struct RDMAResource* res, int rank, int size, size_t capacity)
+{
+    comm->res = res;
+    comm->rank = rank;
+    comm->size = size;
+    comm->cq = nullptr;
+    comm->peers.assign(size > 0 ? size : 0, CollectivePeer());
+    comm->data = nullptr;
+    comm->capacity = capacity;
+    comm->dataMR = nullptr;
+    comm->staging = nullptr;
+    comm->stagingSize = 0;
+    comm->stagingMR = nullptr;
+    comm->chunkSize = CollectiveChunkSize;
+    comm->sequence = 0;
+    comm->isa = reduceBestIsa();
+    comm->arrivals.clear();
+    comm->arrivalHead = 0;
+    comm->abort = nullptr;
+
+    if (size < 1 || size > CollectiveMaxRanks || rank < 0 || rank >= size) {
+        fprintf(stderr, "Invalid rank %d of %d\n", rank, size);
+        return 1;
+    }
+
+    /* Ring reduce-scatter needs (size - 1) segments, a tree reduction one slot per tree level */
+    int levels = 1;
+    while ((1 << levels) < size)
+        levels++;
+    comm->stagingSize = levels * capacity + size * sizeof(uint64_t);
+
+    void* memory = nullptr;
+    if (posix_memalign(&memory, 4096, capacity)) {
+        fprintf(stderr, "Failed to allocate %zu bytes collective buffer\n", capacity);
+        destroyCommunicator(comm);
+        return 1;
+    }
+    comm->data = (char*)memory;
+
+    if (posix_memalign(&memory, 4096, comm->stagingSize)) {
+        fprintf(stderr, "Failed to allocate %zu bytes staging buffer\n", comm->stagingSize);
+        destroyCommunicator(comm);
+        return 1;
+    }
+    comm->staging = (char*)memory;
+    memset(comm->data, 0, capacity);
+    memset(comm->staging, 0, comm->stagingSize);
+
+    int mrFlags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE;
+    comm->dataMR = ibv_reg_mr(res->protectedDomain, comm->data, capacity, mrFlags);
+    comm->stagingMR = ibv_reg_mr(res->protectedDomain, comm->staging, comm->stagingSize, mrFlags);
+    if (!comm->dataMR || !comm->stagingMR) {
+        fprintf(stderr, "Register collective buffers failed with mr_flags=0x%x\n", mrFlags);
+        destroyCommunicator(comm);
+        return 1;
+    }
+
+    /* Every peer QP may have its sends and twice as many receives completing */
+    int cqEntries = (size > 1 ? size - 1 : 1) * 3 * CollectiveQueueDepth;
+    comm->cq = ibv_create_cq(res->context, cqEntries, nullptr, nullptr, 0);
+    if (!comm->cq) {
+        fprintf(stderr, "Failed to create CQ with %d entries\n", cqEntries);
+        destroyCommunicator(comm);
+        return 1;
+    }
+
+    for (int peer = 0; peer < size; peer++) {
+        if (peer == rank)
+            continue;
+
+        struct ibv_qp_init_attr qpInitAttr;
+        memset(&qpInitAttr, 0, sizeof(ibv_qp_init_attr));
+        qpInitAttr.qp_type = IBV_QPT_RC;
+        qpInitAttr.sq_sig_all = 1;
+        qpInitAttr.send_cq = comm->cq;
+        qpInitAttr.recv_cq = comm->cq;
+        qpInitAttr.cap.max_send_wr = CollectiveQueueDepth;
+        qpInitAttr.cap.max_recv_wr = 2 * CollectiveQueueDepth;
+        qpInitAttr.cap.max_send_sge = 1;
+        qpInitAttr.cap.max_recv_sge = 1;
+
+        comm->peers[peer].qp = ibv_create_qp(res->protectedDomain, &qpInitAttr);
+        if (!comm->peers[peer].qp) {
+            fprintf(stderr, "Failed to create Queue Pair for rank %d\n", peer);
+            destroyCommunicator(comm);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Destroy QPs, CQ and buffers */
+void destroyCommunicator(struct Communicator* comm)
+{
+    for (auto& peer : comm->peers) {
+        if (peer.qp)
+            ibv_destroy_qp(peer.qp);
+        peer.qp = nullptr;
+    }
+    if (comm->cq)
+        ibv_destroy_cq(comm->cq);
+    if (comm->dataMR)
+        ibv_dereg_mr(comm->dataMR);
+    if (comm->stagingMR)
+        ibv_dereg_mr(comm->stagingMR);
+    free(comm->data);
+    free(comm->staging);
+    comm->cq = nullptr;
+    comm->dataMR = nullptr;
+    comm->stagingMR = nullptr;
+    comm->data = nullptr;
+    comm->staging = nullptr;
+}
+
+/* Details of the QP used to talk to `peer` */
+void communicatorInfo(const struct Communicator* comm, int peer, struct CollectivePeerInfo* info)
+{
+    memset(info, 0, sizeof(CollectivePeerInfo));
+    info->qpNum = comm->peers[peer].qp->qp_num;
+    info->lid = comm->res->portAttr.lid;
+    memcpy(info->gid, &comm->res->localGid, sizeof(info->gid));
+    info->dataAddr = (uintptr_t)comm->data;
+    info->dataRkey = comm->dataMR->rkey;
+    info->stagingAddr = (uintptr_t)comm->staging;
+    info->stagingRkey = comm->stagingMR->rkey;
+}
+
+/* Receive for one write with immediate from `peer`, no data lands in it */
+static int postRecv(struct Communicator* comm, int peer)
+{
+    struct ibv_recv_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = peer;
+
+    int result = ibv_post_recv(comm->peers[peer].qp, &wr, &badWR);
+    if (result)
+        fprintf(stderr, "Failed to post receive for rank %d\n", peer);
+    return result;
+}
+
+/* Connect QP of `peer` to the details it sent and move it to RTS */
+int connectCommunicatorPeer(struct Communicator* comm, int peer, const struct CollectivePeerInfo* info)
+{
+    struct CollectivePeer& p = comm->peers[peer];
+    p.dataAddr = info->dataAddr;
+    p.dataRkey = info->dataRkey;
+    p.stagingAddr = info->stagingAddr;
+    p.stagingRkey = info->stagingRkey;
+    p.inflight = 0;
+    p.readyCount = 0;
+
+    /* modifyQPto* work on one QP of an RDMAResource */
+    struct RDMAResource qpRes = *comm->res;
+    qpRes.queuePair = p.qp;
+    qpRes.remoteQueueNum = info->qpNum;
+    qpRes.remoteId = info->lid;
+    memcpy(&qpRes.remoteGid, info->gid, sizeof(info->gid));
+
+    if (modifyQPtoInit(&qpRes))
+        return 1;
+    for (int i = 0; i < 2 * CollectiveQueueDepth; i++) {
+        if (postRecv(comm, peer))
+            return 1;
+    }
+    if (modifyQPtoRTR(&qpRes))
+        return 1;
+    return modifyQPtoRTS(&qpRes);
+}
+
+/* Connect every pair of ranks living in this process */
+int connectLocalCommunicators(struct Communicator** comms, int size)
+{
+    for (int a = 0; a < size; a++) {
+        for (int b = 0; b < size; b++) {
+            if (a == b)
+                continue;
+            struct CollectivePeerInfo info;
+            communicatorInfo(comms[b], a, &info);
+            if (connectCommunicatorPeer(comms[a], b, &info))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* Poll completions, queue received chunks and return send credits */
+static int progress(struct Communicator* comm)
+{
+    /* A failed rank never sends what the others wait for */
+    if (comm->abort && comm->abort->load())
+        return 1;
+
+    struct ibv_wc wc[CollectivePollBatch];
+    int polled = ibv_poll_cq(comm->cq, CollectivePollBatch, wc);
+    if (polled < 0) {
+        fprintf(stderr, "Poll CQ failed\n");
+        return 1;
+    }
+
+    for (int i = 0; i < polled; i++) {
+        if (wc[i].status != IBV_WC_SUCCESS) {
+            fprintf(stderr, "Rank %d completion with status %s, peer %lu\n", comm->rank,
+                ibv_wc_status_str(wc[i].status), (unsigned long)wc[i].wr_id);
+            return 1;
+        }
+
+        int peer = (int)wc[i].wr_id;
+        if (wc[i].opcode != IBV_WC_RECV_RDMA_WITH_IMM) {
+            comm->peers[peer].inflight--;
+            continue;
+        }
+
+        if (postRecv(comm, peer))
+            return 1;
+
+        uint32_t imm = ntohl(wc[i].imm_data);
+        uint32_t phase = imm >> 28;
+        if (phase == PhaseReady) {
+            comm->peers[peer].readyCount++;
+            continue;
+        }
+
+        struct CollectiveArrival arrival;
+        arrival.peer = peer;
+        arrival.phase = phase;
+        arrival.step = (imm >> 20) & 0xff;
+        arrival.chunk = imm & (CollectiveMaxChunks - 1);
+        comm->arrivals.push_back(arrival);
+    }
+    return 0;
+}
+
+/* Wait for the next chunk written to this rank */
+static int nextArrival(struct Communicator* comm, struct CollectiveArrival* arrival)
+{
+    while (comm->arrivalHead == comm->arrivals.size()) {
+        if (progress(comm))
+            return 1;
+    }
+
+    *arrival = comm->arrivals[comm->arrivalHead++];
+    if (comm->arrivalHead == comm->arrivals.size()) {
+        comm->arrivals.clear();
+        comm->arrivalHead = 0;
+    }
+    return 0;
+}
+
+/* Post one signaled write with immediate, waiting for a free send slot first */
+static int postWriteImm(struct Communicator* comm, int peer, const char* local, uint32_t lkey, uint32_t length,
+    uint64_t remoteAddr, uint32_t rkey, uint32_t imm)
+{
+    struct CollectivePeer& p = comm->peers[peer];
+    while (p.inflight >= CollectiveQueueDepth) {
+        if (progress(comm))
+            return 1;
+    }
+
+    struct ibv_sge sge;
+    sge.addr = (uintptr_t)local;
+    sge.length = length;
+    sge.lkey = lkey;
+
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = peer;
+    wr.sg_list = &sge;
+    wr.num_sge = length ? 1 : 0;
+    wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.imm_data = htonl(imm);
+    wr.wr.rdma.remote_addr = remoteAddr;
+    wr.wr.rdma.rkey = rkey;
+
+    if (ibv_post_send(p.qp, &wr, &badWR)) {
+        fprintf(stderr, "Failed to post collective write to rank %d\n", peer);
+        return 1;
+    }
+    p.inflight++;
+    return 0;
+}
+
+/* Write into a peer only after it entered the current collective. Until then its caller
+ * may still be reading the previous result from data */
+static int waitPeerReady(struct Communicator* comm, int peer)
+{
+    while (comm->peers[peer].readyCount < comm->sequence) {
+        if (progress(comm))
+            return 1;
+    }
+    return 0;
+}
+
+/* Write data[offset, offset + length) to the same offset of the peer's data */
+static int writeData(struct Communicator* comm, int peer, size_t offset, size_t length, uint32_t imm)
+{
+    struct CollectivePeer& p = comm->peers[peer];
+    if (waitPeerReady(comm, peer))
+        return 1;
+    return postWriteImm(comm, peer, comm->data + offset, comm->dataMR->lkey, length, p.dataAddr + offset, p.dataRkey, imm);
+}
+
+/* Write data[offset, offset + length) into the peer's staging area */
+static int writeStaging(struct Communicator* comm, int peer, size_t offset, size_t length, size_t stagingOffset, uint32_t imm)
+{
+    struct CollectivePeer& p = comm->peers[peer];
+    if (waitPeerReady(comm, peer))
+        return 1;
+    return postWriteImm(comm, peer, comm->data + offset, comm->dataMR->lkey, length, p.stagingAddr + stagingOffset, p.stagingRkey, imm);
+}
+
+/* The caller is done with the previous result, let the peers write into data and staging */
+static int beginCollective(struct Communicator* comm)
+{
+    for (int peer = 0; peer < comm->size; peer++) {
+        if (peer == comm->rank)
+            continue;
+        struct CollectivePeer& p = comm->peers[peer];
+        if (postWriteImm(comm, peer, nullptr, 0, 0, p.dataAddr, p.dataRkey, makeImm(PhaseReady, 0, 0)))
+            return 1;
+    }
+    comm->sequence++;
+    return 0;
+}
+
+/* Wait until the HCA read every local buffer. The result stays untouched until the next collective begins */
+static int finishCollective(struct Communicator* comm, int result)
+{
+    if (result)
+        return result;
+
+    for (int peer = 0; peer < comm->size; peer++) {
+        while (comm->peers[peer].inflight) {
+            if (progress(comm))
+                return 1;
+        }
+    }
+
+    if (comm->arrivalHead != comm->arrivals.size()) {
+        fprintf(stderr, "Rank %d has %zu unexpected chunks\n", comm->rank, comm->arrivals.size() - comm->arrivalHead);
+        return 1;
+    }
+    return 0;
+}
+
+static uint32_t chunkCount(const struct Communicator* comm, size_t length)
+{
+    return (uint32_t)((length + comm->chunkSize - 1) / comm->chunkSize);
+}
+
+static size_t chunkLength(const struct Communicator* comm, size_t length, uint32_t chunk)
+{
+    size_t offset = (size_t)chunk * comm->chunkSize;
+    return length - offset < comm->chunkSize ? length - offset : comm->chunkSize;
+}
+
+static int ringMod(int value, int size)
+{
+    return ((value % size) + size) % size;
+}
+
+/* Span of the binomial subtree rooted at virtual rank v, the root spans the whole group */
+static int subtreeSpan(int v, int size)
+{
+    if (v)
+        return v & -v;
+    int span = 1;
+    while (span < size)
+        span <<= 1;
+    return span;
+}
+
+static int treeLevel(int span)
+{
+    int level = 0;
+    while ((1 << level) < span)
+        level++;
+    return level;
+}
+
+/* Root writes every chunk to rank + 1, which forwards it on arrival */
+static int ringBroadcast(struct Communicator* comm, size_t length, int root)
+{
+    int right = (comm->rank + 1) % comm->size;
+    uint32_t chunks = chunkCount(comm, length);
+
+    if (comm->rank == root) {
+        for (uint32_t c = 0; c < chunks; c++) {
+            if (writeData(comm, right, (size_t)c * comm->chunkSize, chunkLength(comm, length, c), makeImm(PhaseData, 0, c)))
+                return 1;
+        }
+        return 0;
+    }
+
+    for (uint32_t received = 0; received < chunks; received++) {
+        struct CollectiveArrival arrival;
+        if (nextArrival(comm, &arrival))
+            return 1;
+        if (right != root && writeData(comm, right, (size_t)arrival.chunk * comm->chunkSize,
+            chunkLength(comm, length, arrival.chunk), makeImm(PhaseData, 0, arrival.chunk)))
+            return 1;
+    }
+    return 0;
+}
+
+/* Chunks are forwarded to the children, largest subtree first, as soon as they arrive */
+static int treeBroadcast(struct Communicator* comm, size_t length, int root)
+{
+    int size = comm->size;
+    int v = ringMod(comm->rank - root, size);
+    int span = subtreeSpan(v, size);
+    uint32_t chunks = chunkCount(comm, length);
+
+    for (uint32_t c = 0; c < chunks; c++) {
+        uint32_t chunk = c;
+        if (v) {
+            struct CollectiveArrival arrival;
+            if (nextArrival(comm, &arrival))
+                return 1;
+            chunk = arrival.chunk;
+        }
+
+        for (int mask = span >> 1; mask > 0; mask >>= 1) {
+            if (v + mask >= size)
+                continue;
+            int child = (v + mask + root) % size;
+            if (writeData(comm, child, (size_t)chunk * comm->chunkSize, chunkLength(comm, length, chunk), makeImm(PhaseData, 0, chunk)))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* Step t sends segment rank - t to rank + 1, every chunk forwarded on arrival */
+static int ringAllgather(struct Communicator* comm, size_t length)
+{
+    int size = comm->size;
+    int right = (comm->rank + 1) % size;
+    uint32_t chunks = chunkCount(comm, length);
+
+    for (uint32_t c = 0; c < chunks; c++) {
+        if (writeData(comm, right, comm->rank * length + (size_t)c * comm->chunkSize, chunkLength(comm, length, c),
+            makeImm(PhaseData, 0, c)))
+            return 1;
+    }
+
+    for (uint32_t received = 0; received < (size - 1) * chunks; received++) {
+        struct CollectiveArrival arrival;
+        if (nextArrival(comm, &arrival))
+            return 1;
+        if ((int)arrival.step + 1 >= size - 1)
+            continue;
+
+        int segment = ringMod(comm->rank - 1 - arrival.step, size);
+        if (writeData(comm, right, segment * length + (size_t)arrival.chunk * comm->chunkSize,
+            chunkLength(comm, length, arrival.chunk), makeImm(PhaseData, arrival.step + 1, arrival.chunk)))
+            return 1;
+    }
+    return 0;
+}
+
+/* Segments travel up the tree to rank 0 and, in the same pass, down to every
+ * subtree that does not have them yet. The step field carries the segment owner */
+static int treeAllgather(struct Communicator* comm, size_t length)
+{
+    int size = comm->size;
+    int v = comm->rank;
+    int span = subtreeSpan(v, size);
+    int parent = v & (v - 1);
+    uint32_t chunks = chunkCount(comm, length);
+
+    for (uint32_t c = 0; c < chunks; c++) {
+        size_t offset = v * length + (size_t)c * comm->chunkSize;
+        size_t chunkBytes = chunkLength(comm, length, c);
+        if (v && writeData(comm, parent, offset, chunkBytes, makeImm(PhaseData, v, c)))
+            return 1;
+        for (int mask = span >> 1; mask > 0; mask >>= 1) {
+            if (v + mask < size && writeData(comm, v + mask, offset, chunkBytes, makeImm(PhaseData, v, c)))
+                return 1;
+        }
+    }
+
+    for (uint32_t received = 0; received < (size - 1) * chunks; received++) {
+        struct CollectiveArrival arrival;
+        if (nextArrival(comm, &arrival))
+            return 1;
+
+        size_t offset = arrival.step * length + (size_t)arrival.chunk * comm->chunkSize;
+        size_t chunkBytes = chunkLength(comm, length, arrival.chunk);
+        uint32_t imm = makeImm(PhaseData, arrival.step, arrival.chunk);
+        bool fromParent = v && arrival.peer == parent;
+
+        /* Segments from a child go up and to the sibling subtrees, from the parent only down */
+        if (!fromParent && v && writeData(comm, parent, offset, chunkBytes, imm))
+            return 1;
+        for (int mask = span >> 1; mask > 0; mask >>= 1) {
+            if (v + mask < size && v + mask != arrival.peer && writeData(comm, v + mask, offset, chunkBytes, imm))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* Element split of a ring allreduce into one segment per rank */
+struct RingSegments {
+    size_t      count;
+    int         size;
+    size_t      elementSize;
+    size_t      chunkElements;
+    size_t      stepBytes;          /* Staging space per reduce-scatter step */
+};
+
+static size_t segmentFirst(const struct RingSegments* rs, int segment)
+{
+    return rs->count * segment / rs->size;
+}
+
+static uint32_t segmentChunks(const struct RingSegments* rs, int segment)
+{
+    size_t elements = segmentFirst(rs, segment + 1) - segmentFirst(rs, segment);
+    return (uint32_t)((elements + rs->chunkElements - 1) / rs->chunkElements);
+}
+
+/* Byte offset in data and length of chunk c of a segment */
+static void segmentChunk(const struct RingSegments* rs, int segment, uint32_t c, size_t* offset, size_t* length)
+{
+    size_t first = segmentFirst(rs, segment) + c * rs->chunkElements;
+    size_t last = segmentFirst(rs, segment + 1);
+    size_t elements = last - first < rs->chunkElements ? last - first : rs->chunkElements;
+    *offset = first * rs->elementSize;
+    *length = elements * rs->elementSize;
+}
+
+/* Reduce-scatter into staging followed by allgather into data, both pipelined per chunk:
+ * a chunk is reduced and forwarded while the next ones are still on the wire */
+static int ringAllreduce(struct Communicator* comm, size_t count, enum ReduceType type, enum ReduceOp op)
+{
+    int size = comm->size;
+    int rank = comm->rank;
+    int right = (rank + 1) % size;
+
+    struct RingSegments rs;
+    rs.count = count;
+    rs.size = size;
+    rs.elementSize = reduceTypeSize(type);
+    rs.chunkElements = comm->chunkSize / rs.elementSize;
+    rs.stepBytes = (count + size - 1) / size * rs.elementSize;
+
+    uint32_t expected = 0;
+    for (int t = 0; t < size - 1; t++)
+        expected += segmentChunks(&rs, ringMod(rank - 1 - t, size)) + segmentChunks(&rs, ringMod(rank - t, size));
+
+    size_t offset, length;
+    for (uint32_t c = 0; c < segmentChunks(&rs, rank); c++) {
+        segmentChunk(&rs, rank, c, &offset, &length);
+        if (writeStaging(comm, right, offset, length, c * comm->chunkSize, makeImm(PhaseStaging, 0, c)))
+            return 1;
+    }
+
+    for (uint32_t received = 0; received < expected; received++) {
+        struct CollectiveArrival arrival;
+        if (nextArrival(comm, &arrival))
+            return 1;
+        uint32_t step = arrival.step;
+        uint32_t c = arrival.chunk;
+
+        if (arrival.phase == PhaseStaging) {
+            int segment = ringMod(rank - 1 - step, size);
+            segmentChunk(&rs, segment, c, &offset, &length);
+            size_t stagingOffset = step * rs.stepBytes + (size_t)c * comm->chunkSize;
+            reduceInto(comm->data + offset, comm->staging + stagingOffset, length / rs.elementSize, type, op, comm->isa);
+
+            /* Last step completes segment rank + 1, which starts the allgather */
+            int result = (int)step + 1 < size - 1 ?
+                writeStaging(comm, right, offset, length, (step + 1) * rs.stepBytes + (size_t)c * comm->chunkSize,
+                    makeImm(PhaseStaging, step + 1, c)) :
+                writeData(comm, right, offset, length, makeImm(PhaseData, 0, c));
+            if (result)
+                return 1;
+        }
+        else if ((int)step + 1 < size - 1) {
+            segmentChunk(&rs, ringMod(rank - step, size), c, &offset, &length);
+            if (writeData(comm, right, offset, length, makeImm(PhaseData, step + 1, c)))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* Binomial reduction into rank 0, every child owns a staging slot of the parent.
+ * A chunk goes up as soon as every child's copy of it was reduced, and rank 0
+ * starts the broadcast of a chunk while later chunks are still being reduced */
+static int treeAllreduce(struct Communicator* comm, size_t count, enum ReduceType type, enum ReduceOp op)
+{
+    int size = comm->size;
+    int v = comm->rank;
+    int span = subtreeSpan(v, size);
+    int parent = v & (v - 1);
+    size_t elementSize = reduceTypeSize(type);
+    size_t bytes = count * elementSize;
+    uint32_t chunks = chunkCount(comm, bytes);
+
+    uint32_t children = 0;
+    for (int mask = span >> 1; mask > 0; mask >>= 1) {
+        if (v + mask < size)
+            children++;
+    }
+
+    uint32_t slot = treeLevel(span);
+    comm->chunkCounts.assign(chunks, 0);
+
+    if (!children) {
+        for (uint32_t c = 0; c < chunks; c++) {
+            size_t offset = (size_t)c * comm->chunkSize;
+            if (writeStaging(comm, parent, offset, chunkLength(comm, bytes, c), slot * bytes + offset, makeImm(PhaseStaging, slot, c)))
+                return 1;
+        }
+    }
+
+    uint32_t expected = children * chunks + (v ? chunks : 0);
+    for (uint32_t received = 0; received < expected; received++) {
+        struct CollectiveArrival arrival;
+        if (nextArrival(comm, &arrival))
+            return 1;
+        uint32_t c = arrival.chunk;
+        size_t offset = (size_t)c * comm->chunkSize;
+        size_t length = chunkLength(comm, bytes, c);
+
+        if (arrival.phase == PhaseStaging) {
+            reduceInto(comm->data + offset, comm->staging + arrival.step * bytes + offset, length / elementSize, type, op, comm->isa);
+            if (++comm->chunkCounts[c] < children)
+                continue;
+            if (v) {
+                if (writeStaging(comm, parent, offset, length, slot * bytes + offset, makeImm(PhaseStaging, slot, c)))
+                    return 1;
+                continue;
+            }
+        }
+
+        /* Fully reduced chunk at rank 0, or the result coming down from the parent */
+        for (int mask = span >> 1; mask > 0; mask >>= 1) {
+            if (v + mask < size && writeData(comm, v + mask, offset, length, makeImm(PhaseData, 0, c)))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* Broadcast `length` bytes of root's data */
+int collectiveBroadcast(struct Communicator* comm, size_t length, int root, enum CollectiveAlgorithm algorithm)
+{
+    if (length > comm->capacity || chunkCount(comm, length) > CollectiveMaxChunks || root < 0 || root >= comm->size) {
+        fprintf(stderr, "Invalid broadcast of %zu bytes from rank %d\n", length, root);
+        return 1;
+    }
+    if (comm->size == 1)
+        return 0;
+    if (beginCollective(comm))
+        return 1;
+
+    int result = algorithm == CollectiveRing ? ringBroadcast(comm, length, root) : treeBroadcast(comm, length, root);
+    return finishCollective(comm, result);
+}
+
+/* Every rank contributes `length` bytes at data + rank * length and receives all the others */
+int collectiveAllgather(struct Communicator* comm, size_t length, enum CollectiveAlgorithm algorithm)
+{
+    if (length * comm->size > comm->capacity || chunkCount(comm, length) > CollectiveMaxChunks) {
+        fprintf(stderr, "Invalid allgather of %zu bytes per rank\n", length);
+        return 1;
+    }
+    if (comm->size == 1)
+        return 0;
+    if (beginCollective(comm))
+        return 1;
+
+    int result = algorithm == CollectiveRing ? ringAllgather(comm, length) : treeAllgather(comm, length);
+    return finishCollective(comm, result);
+}
+
+/* Reduce `count` elements of every rank's data, every rank receives the result */
+int collectiveAllreduce(struct Communicator* comm, size_t count, enum ReduceType type, enum ReduceOp op,
+    enum CollectiveAlgorithm algorithm)
+{
+    size_t bytes = count * reduceTypeSize(type);
+    if (bytes > comm->capacity || chunkCount(comm, bytes) > CollectiveMaxChunks) {
+        fprintf(stderr, "Invalid allreduce of %zu %s elements\n", count, reduceTypeName(type));
+        return 1;
+    }
+    if (comm->size == 1)
+        return 0;
+    if (beginCollective(comm))
+        return 1;
+
+    int result = algorithm == CollectiveRing ? ringAllreduce(comm, count, type, op) : treeAllreduce(comm, count, type, op);
+    return finishCollective(comm, result);
+}
+
+const char* collectiveAlgorithmName(enum CollectiveAlgorithm algorithm)
+{
+    return algorithm == CollectiveRing ? "ring" : "tree";
+}
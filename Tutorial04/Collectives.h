@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "LibVerbsHelper.h"
+#include "Reduce.h"
+
+constexpr auto CollectiveMaxRanks = 256;
+constexpr auto CollectiveChunkSize = 256 * 1024;	/* Pipeline unit, a multiple of every element size */
+constexpr auto CollectiveQueueDepth = 128;			/* Writes in flight per peer */
+constexpr auto CollectivePollBatch = 16;
+
+enum CollectiveAlgorithm {
+	CollectiveRing,			/* Chunks travel rank -> rank + 1, bandwidth optimal for large messages */
+	CollectiveTree			/* Binomial tree, log2(size) hops for small messages */
+};
+
+/* RC connection to one other rank */
+struct CollectivePeer {
+	struct ibv_qp*		qp;
+	uint64_t			dataAddr;			/* Peer data buffer */
+	uint32_t			dataRkey;
+	uint64_t			stagingAddr;		/* Peer receive area for partial results */
+	uint32_t			stagingRkey;
+	uint32_t			inflight;			/* Writes posted and not completed */
+	uint32_t			readyCount;			/* Collectives the peer has entered */
+};
+
+/* Write with immediate received by the collective in progress */
+struct CollectiveArrival {
+	int					peer;
+	uint32_t			phase;
+	uint32_t			step;
+	uint32_t			chunk;
+};
+
+/* Connection details one rank hands to a peer */
+struct CollectivePeerInfo {
+	uint32_t			qpNum;
+	uint16_t			lid;
+	uint8_t				gid[16];
+	uint64_t			dataAddr;
+	uint32_t			dataRkey;
+	uint64_t			stagingAddr;
+	uint32_t			stagingRkey;
+};
+
+/* One rank of a group. Collectives operate in place on `data`, a result stays there until
+ * this rank enters the next collective */
+struct Communicator {
+	struct RDMAResource*				res;			/* Device, port and PD, owned by the caller */
+	int									rank;
+	int									size;
+	struct ibv_cq*						cq;				/* Shared by every peer QP */
+	std::vector<CollectivePeer>			peers;			/* Indexed by rank, own entry unused */
+	char*								data;
+	size_t								capacity;
+	struct ibv_mr*						dataMR;
+	char*								staging;
+	size_t								stagingSize;
+	struct ibv_mr*						stagingMR;
+	uint32_t							chunkSize;
+	uint32_t							sequence;		/* Collectives entered by this rank */
+	enum ReduceIsa						isa;			/* Reduction kernels */
+	std::vector<CollectiveArrival>		arrivals;		/* Received and not yet handled */
+	size_t								arrivalHead;
+	std::vector<uint32_t>				chunkCounts;	/* Per chunk child arrivals of a tree reduction */
+	const std::atomic<bool>*			abort;			/* Optional, set by another thread to fail a waiting collective */
+};
+
+/* Create CQ, one QP per peer and data/staging buffers of `capacity` bytes */
+int createCommunicator(struct Communicator* comm, struct RDMAResource* res, int rank, int size, size_t capacity);
+
+/* Destroy QPs, CQ and buffers */
+void destroyCommunicator(struct Communicator* comm);
+
+/* Details of the QP used to talk to `peer` */
+void communicatorInfo(const struct Communicator* comm, int peer, struct CollectivePeerInfo* info);
+
+/* Connect QP of `peer` to the details it sent and move it to RTS */
+int connectCommunicatorPeer(struct Communicator* comm, int peer, const struct CollectivePeerInfo* info);
+
+/* Connect every pair of ranks living in this process */
+int connectLocalCommunicators(struct Communicator** comms, int size);
+
+/* Broadcast `length` bytes of root's data */
+int collectiveBroadcast(struct Communicator* comm, size_t length, int root, enum CollectiveAlgorithm algorithm);
+
+/* Every rank contributes `length` bytes at data + rank * length and receives all the others */
+int collectiveAllgather(struct Communicator* comm, size_t length, enum CollectiveAlgorithm algorithm);
+
+/* Reduce `count` elements of every rank's data, every rank receives the result */
+int collectiveAllreduce(struct Communicator* comm, size_t count, enum ReduceType type, enum ReduceOp op,
+	enum CollectiveAlgorithm algorithm);
+
+/* Printable algorithm name */
+const char* collectiveAlgorithmName(enum CollectiveAlgorithm algorithm);
@@ -0,0 +1,279 @@
+#include "ExtendedVerbs.h"
+
+/* Release domains allocated for the lock free setup */
+static void destroyDomains(struct ExtendedQueue* eq)
+{
+    if (eq->parentDomain) {
+        ibv_dealloc_pd(eq->parentDomain);
+        eq->parentDomain = nullptr;
+    }
+    if (eq->threadDomain) {
+        ibv_dealloc_td(eq->threadDomain);
+        eq->threadDomain = nullptr;
+    }
+}
+
+/* Thread domain lets the provider drop the send queue lock. Leaves no domain behind on failure */
+static void allocateDomains(struct RDMAResource* res, struct ExtendedQueue* eq)
+{
+    struct ibv_td_init_attr tdAttr;
+    memset(&tdAttr, 0, sizeof(tdAttr));
+    eq->threadDomain = ibv_alloc_td(res->context, &tdAttr);
+    if (eq->threadDomain) {
+        struct ibv_parent_domain_init_attr pdAttr;
+        memset(&pdAttr, 0, sizeof(pdAttr));
+        pdAttr.pd = res->protectedDomain;
+        pdAttr.td = eq->threadDomain;
+        eq->parentDomain = ibv_alloc_parent_domain(res->context, &pdAttr);
+    }
+    if (!eq->parentDomain)
+        destroyDomains(eq);
+}
+
+/* CQ attributes shared by both paths. With a thread domain only one thread polls, the provider may
+ * skip CQ locking */
+static void initCQAttr(struct ibv_cq_init_attr_ex* cqAttr, const struct ExtendedQueue* eq, uint32_t depth, uint64_t wcFlags)
+{
+    memset(cqAttr, 0, sizeof(ibv_cq_init_attr_ex));
+    cqAttr->cqe = depth;
+    cqAttr->wc_flags = wcFlags;
+    if (eq->parentDomain) {
+        cqAttr->comp_mask = IBV_CQ_INIT_ATTR_MASK_FLAGS;
+        cqAttr->flags = IBV_CREATE_CQ_ATTR_SINGLE_THREADED;
+    }
+}
+
+/* Create classic CQ and QP of the requested depth, on the same PD and CQ flags as the extended path */
+static int createClassicQueue(struct RDMAResource* res, struct ExtendedQueue* eq, uint32_t depth, uint32_t maxInline)
+{
+    if (eq->parentDomain) {
+        struct ibv_cq_init_attr_ex cqAttr;
+        initCQAttr(&cqAttr, eq, depth, IBV_WC_STANDARD_FLAGS);
+        struct ibv_cq_ex* cqEx = ibv_create_cq_ex(res->context, &cqAttr);
+        if (cqEx)
+            res->compQueue = ibv_cq_ex_to_cq(cqEx);
+        else
+            destroyDomains(eq);
+    }
+    if (!res->compQueue)
+        res->compQueue = ibv_create_cq(res->context, depth, nullptr, nullptr, 0);
+    if (!res->compQueue) {
+        fprintf(stderr, "Failed to create CQ with %u entries\n", depth);
+        return 1;
+    }
+
+    struct ibv_qp_init_attr qpInitAttr;
+    memset(&qpInitAttr, 0, sizeof(ibv_qp_init_attr));
+    qpInitAttr.qp_type = IBV_QPT_RC;
+    qpInitAttr.sq_sig_all = 0;
+    qpInitAttr.send_cq = res->compQueue;
+    qpInitAttr.recv_cq = res->compQueue;
+    qpInitAttr.cap.max_send_wr = depth;
+    qpInitAttr.cap.max_recv_wr = depth;
+    qpInitAttr.cap.max_send_sge = 1;
+    qpInitAttr.cap.max_recv_sge = 1;
+    qpInitAttr.cap.max_inline_data = maxInline;
+
+    res->queuePair = ibv_create_qp(eq->parentDomain ? eq->parentDomain : res->protectedDomain, &qpInitAttr);
+    if (!res->queuePair) {
+        fprintf(stderr, "Failed to create Queue Pair\n");
+        return 1;
+    }
+    fprintf(stdout, "Classic QP 0x%x with depth %u was created, lock free %s\n", res->queuePair->qp_num, depth,
+        eq->parentDomain ? "yes" : "no");
+    return 0;
+}
+
+/* Try extended CQ and QP, leaves res untouched on failure */
+static int createExtendedQueueEx(struct RDMAResource* res, struct ExtendedQueue* eq, uint32_t depth, uint32_t maxInline)
+{
+    struct ibv_device_attr_ex deviceAttrEx;
+    memset(&deviceAttrEx, 0, sizeof(deviceAttrEx));
+    if (ibv_query_device_ex(res->context, nullptr, &deviceAttrEx))
+        return 1;
+
+    eq->timestamps = deviceAttrEx.completion_timestamp_mask && deviceAttrEx.hca_core_clock;
+    eq->hcaCoreClockKHz = deviceAttrEx.hca_core_clock;
+
+    struct ibv_cq_init_attr_ex cqAttr;
+    initCQAttr(&cqAttr, eq, depth, IBV_WC_EX_WITH_BYTE_LEN | (eq->timestamps ? IBV_WC_EX_WITH_COMPLETION_TIMESTAMP : 0));
+
+    eq->cqEx = ibv_create_cq_ex(res->context, &cqAttr);
+    if (!eq->cqEx && eq->timestamps) {
+        cqAttr.wc_flags = IBV_WC_EX_WITH_BYTE_LEN;
+        eq->timestamps = false;
+        eq->cqEx = ibv_create_cq_ex(res->context, &cqAttr);
+    }
+    if (!eq->cqEx)
+        return 1;
+
+    struct ibv_qp_init_attr_ex qpInitAttr;
+    memset(&qpInitAttr, 0, sizeof(qpInitAttr));
+    qpInitAttr.qp_type = IBV_QPT_RC;
+    qpInitAttr.sq_sig_all = 0;
+    qpInitAttr.send_cq = ibv_cq_ex_to_cq(eq->cqEx);
+    qpInitAttr.recv_cq = ibv_cq_ex_to_cq(eq->cqEx);
+    qpInitAttr.cap.max_send_wr = depth;
+    qpInitAttr.cap.max_recv_wr = depth;
+    qpInitAttr.cap.max_send_sge = 1;
+    qpInitAttr.cap.max_recv_sge = 1;
+    qpInitAttr.cap.max_inline_data = maxInline;
+    qpInitAttr.pd = eq->parentDomain ? eq->parentDomain : res->protectedDomain;
+    qpInitAttr.comp_mask = IBV_QP_INIT_ATTR_PD | IBV_QP_INIT_ATTR_SEND_OPS_FLAGS;
+    qpInitAttr.send_ops_flags = IBV_QP_EX_WITH_RDMA_WRITE | IBV_QP_EX_WITH_RDMA_WRITE_WITH_IMM |
+        IBV_QP_EX_WITH_SEND | IBV_QP_EX_WITH_SEND_WITH_IMM | IBV_QP_EX_WITH_RDMA_READ;
+
+    struct ibv_qp* qp = ibv_create_qp_ex(res->context, &qpInitAttr);
+    if (!qp) {
+        ibv_destroy_cq(ibv_cq_ex_to_cq(eq->cqEx));
+        eq->cqEx = nullptr;
+        return 1;
+    }
+
+    eq->qpEx = ibv_qp_to_qp_ex(qp);
+    res->queuePair = qp;
+    res->compQueue = ibv_cq_ex_to_cq(eq->cqEx);
+    fprintf(stdout, "Extended QP 0x%x with depth %u was created, lock free %s, HW timestamps %s\n",
+        qp->qp_num, depth, eq->parentDomain ? "yes" : "no", eq->timestamps ? "yes" : "no");
+    return 0;
+}
+
+/* Replace res->queuePair and res->compQueue with extended ones (or classic ones of the
+ * requested depth when ExtendedQueueClassic is set or the device has no support) */
+int createExtendedQueue(struct RDMAResource* res, struct ExtendedQueue* eq, uint32_t depth, uint32_t maxInline, unsigned flags)
+{
+    memset(eq, 0, sizeof(ExtendedQueue));
+
+    if (res->queuePair) {
+        ibv_destroy_qp(res->queuePair);
+        res->queuePair = NULL;
+    }
+    if (res->compQueue) {
+        ibv_destroy_cq(res->compQueue);
+        res->compQueue = NULL;
+    }
+
+    if (flags & ExtendedQueueLockFree) {
+        allocateDomains(res, eq);
+        if (!eq->parentDomain)
+            fprintf(stdout, "Thread domains are not supported by '%s', QP keeps its locks\n", res->deviceName);
+    }
+
+    if (!(flags & ExtendedQueueClassic)) {
+        if (!createExtendedQueueEx(res, eq, depth, maxInline)) {
+            eq->extended = true;
+            return 0;
+        }
+        fprintf(stdout, "Extended verbs are not supported by '%s', using classic path\n", res->deviceName);
+    }
+
+    eq->timestamps = false;
+    return createClassicQueue(res, eq, depth, maxInline);
+}
+
+/* Destroy QP, CQ and domains. Must be called before destroyRDMAResource() */
+void destroyExtendedQueue(struct RDMAResource* res, struct ExtendedQueue* eq)
+{
+    if (res->queuePair) {
+        ibv_destroy_qp(res->queuePair);
+        res->queuePair = NULL;
+    }
+    if (res->compQueue) {
+        ibv_destroy_cq(res->compQueue);
+        res->compQueue = NULL;
+    }
+    destroyDomains(eq);
+    eq->cqEx = nullptr;
+    eq->qpEx = nullptr;
+}
+
+/* Post `count` RDMA writes of `length` bytes from consecutive slots, the last one signaled */
+int postExtendedWrites(struct RDMAResource* res, struct ExtendedQueue* eq, uint64_t wrId, int count,
+    uint64_t localAddr, uint32_t length, uint64_t remoteAddr, bool inlineData)
+{
+    if (eq->extended) {
+        struct ibv_qp_ex* qpx = eq->qpEx;
+        ibv_wr_start(qpx);
+        for (int i = 0; i < count; i++) {
+            qpx->wr_id = wrId + i;
+            qpx->wr_flags = (i == count - 1 ? IBV_SEND_SIGNALED : 0);
+            ibv_wr_rdma_write(qpx, res->remoteKey, remoteAddr + (uint64_t)i * length);
+            if (inlineData)
+                ibv_wr_set_inline_data(qpx, (void*)(localAddr + (uint64_t)i * length), length);
+            else
+                ibv_wr_set_sge(qpx, res->memoryHandle->lkey, localAddr + (uint64_t)i * length, length);
+        }
+        return ibv_wr_complete(qpx);
+    }
+
+    struct ibv_sge sge;
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_RDMA_WRITE;
+    wr.wr.rdma.rkey = res->remoteKey;
+    sge.lkey = res->memoryHandle->lkey;
+    sge.length = length;
+
+    for (int i = 0; i < count; i++) {
+        wr.wr_id = wrId + i;
+        wr.send_flags = (inlineData ? IBV_SEND_INLINE : 0) | (i == count - 1 ? IBV_SEND_SIGNALED : 0);
+        wr.wr.rdma.remote_addr = remoteAddr + (uint64_t)i * length;
+        sge.addr = localAddr + (uint64_t)i * length;
+        int result = ibv_post_send(res->queuePair, &wr, &badWR);
+        if (result)
+            return result;
+    }
+    return 0;
+}
+
+/* Poll up to `count` completions, returns number polled or -1 on error */
+int pollExtendedQueue(struct RDMAResource* res, struct ExtendedQueue* eq, struct ExtendedCompletion* completions, int count)
+{
+    if (eq->extended) {
+        struct ibv_poll_cq_attr pollAttr;
+        memset(&pollAttr, 0, sizeof(pollAttr));
+
+        int result = ibv_start_poll(eq->cqEx, &pollAttr);
+        if (result == ENOENT)
+            return 0;
+        if (result)
+            return -1;
+
+        int polled = 0;
+        do {
+            struct ExtendedCompletion& completion = completions[polled++];
+            completion.wrId = eq->cqEx->wr_id;
+            completion.status = eq->cqEx->status;
+            completion.opcode = ibv_wc_read_opcode(eq->cqEx);
+            completion.byteLen = ibv_wc_read_byte_len(eq->cqEx);
+            completion.timestamp = eq->timestamps ? ibv_wc_read_completion_ts(eq->cqEx) : 0;
+        } while (polled < count && !ibv_next_poll(eq->cqEx));
+
+        ibv_end_poll(eq->cqEx);
+        return polled;
+    }
+
+    struct ibv_wc wc[QueueSize];
+    if (count > QueueSize)
+        count = QueueSize;
+
+    int polled = ibv_poll_cq(res->compQueue, count, wc);
+    for (int i = 0; i < polled; i++) {
+        completions[i].wrId = wc[i].wr_id;
+        completions[i].status = wc[i].status;
+        completions[i].opcode = wc[i].opcode;
+        completions[i].byteLen = wc[i].byte_len;
+        completions[i].timestamp = 0;
+    }
+    return polled;
+}
+
+/* Convert HW timestamp difference to nanoseconds */
+uint64_t timestampToNs(const struct ExtendedQueue* eq, uint64_t ticks)
+{
+    if (!eq->hcaCoreClockKHz)
+        return 0;
+    return ticks * 1000000ull / eq->hcaCoreClockKHz;
+}
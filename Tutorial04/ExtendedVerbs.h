@@ -0,0 +1,48 @@
+#pragma once
+
+#include "LibVerbsHelper.h"
+
+/* createExtendedQueue flags */
+enum ExtendedQueueFlags {
+	ExtendedQueueClassic	= 1,				/* Classic ibv_post_send/ibv_poll_cq path */
+	ExtendedQueueLockFree	= 2					/* Thread domain and single threaded CQ, one thread per queue */
+};
+
+/* QP and CQ created through the extended verbs API when the device supports it.
+ * Falls back to classic ibv_post_send/ibv_poll_cq otherwise */
+struct ExtendedQueue {
+	struct ibv_cq_ex*		cqEx;				/* Extended CQ, NULL on classic path */
+	struct ibv_qp_ex*		qpEx;				/* Extended QP, NULL on classic path */
+	struct ibv_td*			threadDomain;		/* Lock free QP when requested and the provider supports it */
+	struct ibv_pd*			parentDomain;		/* PD wrapping threadDomain */
+	uint64_t				hcaCoreClockKHz;	/* Completion timestamp clock */
+	bool					extended;			/* Extended post/poll path is used */
+	bool					timestamps;			/* Completions carry HW timestamps */
+};
+
+/* Completion as reported by pollExtendedQueue */
+struct ExtendedCompletion {
+	uint64_t				wrId;
+	enum ibv_wc_status		status;
+	enum ibv_wc_opcode		opcode;
+	uint32_t				byteLen;
+	uint64_t				timestamp;			/* Raw HW timestamp, 0 without timestamps */
+};
+
+/* Replace res->queuePair and res->compQueue with extended ones (or classic ones of the
+ * requested depth when ExtendedQueueClassic is set or the device has no support).
+ * Check eq->extended and eq->parentDomain for what was actually created */
+int createExtendedQueue(struct RDMAResource* res, struct ExtendedQueue* eq, uint32_t depth, uint32_t maxInline, unsigned flags);
+
+/* Destroy QP, CQ and domains. Must be called before destroyRDMAResource() */
+void destroyExtendedQueue(struct RDMAResource* res, struct ExtendedQueue* eq);
+
+/* Post `count` RDMA writes of `length` bytes from consecutive slots, the last one signaled */
+int postExtendedWrites(struct RDMAResource* res, struct ExtendedQueue* eq, uint64_t wrId, int count,
+	uint64_t localAddr, uint32_t length, uint64_t remoteAddr, bool inlineData);
+
+/* Poll up to `count` completions, returns number polled or -1 on error */
+int pollExtendedQueue(struct RDMAResource* res, struct ExtendedQueue* eq, struct ExtendedCompletion* completions, int count);
+
+/* Convert HW timestamp difference to nanoseconds */
+uint64_t timestampToNs(const struct ExtendedQueue* eq, uint64_t ticks);
@@ -0,0 +1,177 @@
+#include "FairScheduler.h"
+
+#include <errno.h>
+
+/* Limit QP send rate in the HCA */
+int setQPRateLimit(struct ibv_qp* qp, uint32_t rateKbps)
+{
+    struct ibv_device_attr_ex deviceAttrEx;
+    memset(&deviceAttrEx, 0, sizeof(deviceAttrEx));
+    if (ibv_query_device_ex(qp->context, nullptr, &deviceAttrEx) ||
+        !(deviceAttrEx.packet_pacing_caps.supported_qpts & (1 << IBV_QPT_RC)))
+        return EOPNOTSUPP;
+
+    const struct ibv_packet_pacing_caps* caps = &deviceAttrEx.packet_pacing_caps;
+    if (rateKbps < caps->qp_rate_limit_min || rateKbps > caps->qp_rate_limit_max) {
+        fprintf(stderr, "Rate limit %u kbps is out of the device range %u..%u kbps\n", rateKbps,
+            caps->qp_rate_limit_min, caps->qp_rate_limit_max);
+        return EINVAL;
+    }
+
+    /* Burst and packet size are left to the provider defaults */
+    struct ibv_qp_rate_limit_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.rate_limit = rateKbps;
+
+    int result = ibv_modify_qp_rate_limit(qp, &attr);
+    if (result && result != EOPNOTSUPP)
+        fprintf(stderr, "Failed to set rate limit of QP 0x%x: %s\n", qp->qp_num, strerror(result));
+    return result;
+}
+
+void createFairScheduler(struct FairScheduler* sched, uint32_t quantum, uint64_t maxInflightBytes)
+{
+    sched->tenants.clear();
+    sched->quantum = quantum;
+    sched->maxInflightBytes = maxInflightBytes;
+    sched->inflightBytes = 0;
+    sched->cursor = 0;
+}
+
+/* Add tenant, HCA pacing first and token bucket in the scheduler as fallback */
+int addFairTenant(struct FairScheduler* sched, struct ibv_qp* qp, uint32_t weight, uint32_t rateKbps)
+{
+    sched->tenants.emplace_back();
+    struct FairTenant* tenant = &sched->tenants.back();
+    tenant->qp = qp;
+    tenant->weight = weight ? weight : 1;
+    tenant->rateBytesPerSec = 0;
+    tenant->hardwarePaced = false;
+    tenant->tokens = 0;
+    tenant->lastRefillNs = nowNs();
+    tenant->deficit = 0;
+    tenant->credited = false;
+    tenant->sentBytes = 0;
+    tenant->sentMessages = 0;
+
+    if (rateKbps) {
+        tenant->hardwarePaced = !setQPRateLimit(qp, rateKbps);
+        if (!tenant->hardwarePaced)
+            tenant->rateBytesPerSec = (uint64_t)rateKbps * 1000 / 8;
+    }
+    return (int)sched->tenants.size() - 1;
+}
+
+/* Queue copy of the WR, it is always posted signaled */
+void enqueueFair(struct FairScheduler* sched, int tenant, const struct ibv_send_wr* wr)
+{
+    struct FairRequest request;
+    request.wr = *wr;
+    request.wr.next = nullptr;
+    request.wr.send_flags |= IBV_SEND_SIGNALED;
+    request.wr.num_sge = wr->num_sge ? 1 : 0;
+    memset(&request.sge, 0, sizeof(ibv_sge));
+    if (wr->num_sge)
+        request.sge = wr->sg_list[0];
+
+    /* sg_list is pointed at the queued copy when the WR is posted */
+    sched->tenants[tenant].queue.push_back(request);
+}
+
+/* Add pacing credit for the time since the last refill, at most FairBurstNs worth */
+static void refillTokens(struct FairTenant* tenant, uint64_t now)
+{
+    if (!tenant->rateBytesPerSec)
+        return;
+
+    double burst = (double)tenant->rateBytesPerSec * FairBurstNs / 1e9;
+    tenant->tokens += (double)tenant->rateBytesPerSec * (now - tenant->lastRefillNs) / 1e9;
+    if (tenant->tokens > burst)
+        tenant->tokens = burst;
+    tenant->lastRefillNs = now;
+}
+
+/* Post queued WRs in DRR order */
+int scheduleFair(struct FairScheduler* sched)
+{
+    uint32_t count = (uint32_t)sched->tenants.size();
+    uint64_t now = nowNs();
+    uint32_t stalled = 0;
+    int posted = 0;
+
+    /* Stop after a full round in which no tenant could make progress */
+    while (count && stalled < count) {
+        struct FairTenant* tenant = &sched->tenants[sched->cursor];
+        refillTokens(tenant, now);
+
+        if (tenant->queue.empty()) {
+            /* Idle tenants do not save up credit */
+            tenant->deficit = 0;
+            tenant->credited = false;
+            sched->cursor = (sched->cursor + 1) % count;
+            stalled++;
+            continue;
+        }
+
+        if (!tenant->credited) {
+            tenant->deficit += (int64_t)sched->quantum * tenant->weight;
+            tenant->credited = true;
+        }
+
+        bool paced = false;
+        while (!tenant->queue.empty()) {
+            struct FairRequest* request = &tenant->queue.front();
+            uint32_t length = request->sge.length;
+            if ((int64_t)length > tenant->deficit)
+                break;
+            /* Budget used up, the round resumes with this tenant once completions come back */
+            if (sched->inflightBytes && sched->inflightBytes + length > sched->maxInflightBytes)
+                return posted;
+            if (tenant->rateBytesPerSec && tenant->tokens < 0) {
+                paced = true;
+                break;
+            }
+
+            struct ibv_send_wr* badWR = nullptr;
+            request->wr.sg_list = &request->sge;
+            if (ibv_post_send(tenant->qp, &request->wr, &badWR)) {
+                fprintf(stderr, "Failed to post send of tenant %u on QP 0x%x\n", sched->cursor, tenant->qp->qp_num);
+                return -1;
+            }
+
+            tenant->deficit -= length;
+            tenant->tokens -= length;
+            tenant->inflight.push_back(length);
+            tenant->sentBytes += length;
+            tenant->sentMessages++;
+            sched->inflightBytes += length;
+            tenant->queue.pop_front();
+            posted++;
+        }
+
+        /* Deficit limited tenants progress by their next quantum. Paced ones wait for
+         * tokens and keep the credit of this round instead of collecting more */
+        stalled = paced ? stalled + 1 : 0;
+        if (tenant->queue.empty())
+            tenant->deficit = 0;
+        tenant->credited = paced;
+        sched->cursor = (sched->cursor + 1) % count;
+    }
+    return posted;
+}
+
+/* Account send completion */
+int completeFair(struct FairScheduler* sched, const struct ibv_wc* wc)
+{
+    for (size_t i = 0; i < sched->tenants.size(); i++) {
+        struct FairTenant* tenant = &sched->tenants[i];
+        if (tenant->qp->qp_num != wc->qp_num)
+            continue;
+        if (!(wc->opcode & IBV_WC_RECV) && !tenant->inflight.empty()) {
+            sched->inflightBytes -= tenant->inflight.front();
+            tenant->inflight.pop_front();
+        }
+        return (int)i;
+    }
+    return -1;
+}
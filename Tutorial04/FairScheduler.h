@@ -0,0 +1,63 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "LibVerbsHelper.h"
+
+constexpr auto FairQuantum = 4096;				/* Bytes a tenant of weight 1 may send per round */
+constexpr auto FairMaxInflight = 256 * 1024;	/* Bytes posted to the HCA at once, bounds the wait of a late tenant */
+constexpr auto FairBurstNs = 1000000;			/* Software pacing credit saved up while idle */
+
+/* Send request waiting in a tenant queue, single SGE */
+struct FairRequest {
+	struct ibv_send_wr		wr;
+	struct ibv_sge			sge;
+};
+
+/* One tenant, a send queue sharing the port with the others */
+struct FairTenant {
+	struct ibv_qp*				qp;
+	uint32_t					weight;				/* Share of the port relative to the other tenants */
+	uint64_t					rateBytesPerSec;	/* Software pacing, 0 when unlimited or paced by the HCA */
+	bool						hardwarePaced;		/* Rate limit is enforced by the HCA */
+	double						tokens;				/* Pacing credit in bytes, negative while in debt */
+	uint64_t					lastRefillNs;
+	int64_t						deficit;			/* DRR credit in bytes */
+	bool						credited;			/* Quantum of the current round was added */
+	std::deque<FairRequest>		queue;
+	std::deque<uint32_t>		inflight;			/* Sizes of posted WRs, they complete in order */
+	uint64_t					sentBytes;
+	uint64_t					sentMessages;
+};
+
+/* Deficit round robin over the tenants' send queues. Only maxInflightBytes are
+ * handed to the HCA at once, the rest waits here where the order can be chosen */
+struct FairScheduler {
+	std::vector<FairTenant>		tenants;
+	uint32_t					quantum;
+	uint64_t					maxInflightBytes;
+	uint64_t					inflightBytes;
+	uint32_t					cursor;				/* Tenant of the current round */
+};
+
+/* Limit QP send rate in the HCA (RTR or RTS QPs). Returns 0 on success,
+ * EOPNOTSUPP when the device has no packet pacing for RC QPs */
+int setQPRateLimit(struct ibv_qp* qp, uint32_t rateKbps);
+
+/* Empty scheduler */
+void createFairScheduler(struct FairScheduler* sched, uint32_t quantum, uint64_t maxInflightBytes);
+
+/* Add tenant sending on `qp`, returns its index. Non zero rateKbps is enforced by
+ * the HCA when it supports packet pacing, by the scheduler otherwise */
+int addFairTenant(struct FairScheduler* sched, struct ibv_qp* qp, uint32_t weight, uint32_t rateKbps);
+
+/* Queue copy of the WR (first SGE only), it is always posted signaled */
+void enqueueFair(struct FairScheduler* sched, int tenant, const struct ibv_send_wr* wr);
+
+/* Post queued WRs in DRR order until the queues are empty, paced or the in-flight
+ * budget is used up. Returns number of WRs posted or -1 on failure */
+int scheduleFair(struct FairScheduler* sched);
+
+/* Account send completion, returns tenant of the WR or -1 for QPs of no tenant */
+int completeFair(struct FairScheduler* sched, const struct ibv_wc* wc);
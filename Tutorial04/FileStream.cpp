@@ -0,0 +1,495 @@
+#include "FileStream.h"
+#include "MemoryRegistration.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+
+/* Slot life cycle. Sender: Free -> Full (read) -> InFlight (posted) -> Free (released by the peer).
+ * Receiver: Free -> Full (arrived) -> Done (written) -> Free (release sent) */
+enum SlotState {
+    SlotFree,
+    SlotFull,
+    SlotInFlight,
+    SlotDone
+};
+
+static uint64_t chunkCount(uint64_t fileSize, uint32_t chunkSize)
+{
+    return (fileSize + chunkSize - 1) / chunkSize;
+}
+
+static size_t chunkLength(uint64_t fileSize, uint32_t chunkSize, uint64_t chunk)
+{
+    uint64_t offset = chunk * chunkSize;
+    return fileSize - offset < chunkSize ? fileSize - offset : chunkSize;
+}
+
+/* O_DIRECT needs whole blocks, the tail of the file is padded and truncated afterwards */
+static size_t ioLength(size_t length, bool direct)
+{
+    return direct ? (length + StreamBlockSize - 1) & ~(size_t)(StreamBlockSize - 1) : length;
+}
+
+/* Open file with O_DIRECT, falling back to buffered I/O where the file system refuses it */
+int openStreamFile(const char* path, bool forWrite, bool* direct)
+{
+    int flags = forWrite ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY;
+    int fd = open(path, flags | O_DIRECT, 0644);
+    *direct = fd >= 0;
+    if (fd < 0 && errno == EINVAL) {
+        fprintf(stdout, "O_DIRECT is not supported for '%s', using buffered I/O\n", path);
+        fd = open(path, flags, 0644);
+    }
+    if (fd < 0)
+        fprintf(stderr, "Failed to open '%s': %s\n", path, strerror(errno));
+    return fd;
+}
+
+static int createSlotRing(struct StreamSlotRing* ring, struct RDMAResource* res, uint32_t count, int access)
+{
+    ring->base = nullptr;
+    ring->mr = nullptr;
+    ring->count = count;
+    ring->chunkSize = StreamChunkSize;
+    ring->failed = false;
+    for (int i = 0; i < StreamMaxSlots; i++)
+        ring->state[i] = SlotFree;
+
+    if (count < 1 || count > StreamMaxSlots) {
+        fprintf(stderr, "Slot count %u is out of range 1..%d\n", count, StreamMaxSlots);
+        return 1;
+    }
+
+    size_t length = (size_t)count * ring->chunkSize;
+    void* memory = nullptr;
+    if (posix_memalign(&memory, StreamBlockSize, length)) {
+        fprintf(stderr, "Failed to allocate %zu bytes of stream slots\n", length);
+        return 1;
+    }
+    ring->base = (char*)memory;
+    memset(ring->base, 0, length);
+
+    ring->mr = ibv_reg_mr(res->protectedDomain, ring->base, length, access);
+    if (!ring->mr) {
+        fprintf(stderr, "Register stream slots failed with mr_flags=0x%x\n", access);
+        return 1;
+    }
+    return 0;
+}
+
+static void destroySlotRing(struct StreamSlotRing* ring)
+{
+    if (ring->mr)
+        ibv_dereg_mr(ring->mr);
+    free(ring->base);
+    ring->mr = nullptr;
+    ring->base = nullptr;
+}
+
+static char* slotAddr(const struct StreamSlotRing* ring, uint32_t slot)
+{
+    return ring->base + (size_t)slot * ring->chunkSize;
+}
+
+/* State change seen by the disk thread */
+static void setSlotState(struct StreamSlotRing* ring, uint32_t slot, int state)
+{
+    {
+        std::lock_guard<std::mutex> guard(ring->lock);
+        ring->state[slot] = state;
+    }
+    ring->changed.notify_all();
+}
+
+/* Disk thread sleeps until the RDMA thread hands it the slot, false if the transfer failed */
+static bool waitSlotState(struct StreamSlotRing* ring, uint32_t slot, int state)
+{
+    std::unique_lock<std::mutex> guard(ring->lock);
+    ring->changed.wait(guard, [&] { return ring->state[slot] == state || ring->failed; });
+    return !ring->failed;
+}
+
+static void failRing(struct StreamSlotRing* ring)
+{
+    {
+        std::lock_guard<std::mutex> guard(ring->lock);
+        ring->failed = true;
+    }
+    ring->changed.notify_all();
+}
+
+/* Receive for one write with immediate or one slot release, no data lands in it */
+static int postStreamRecv(struct RDMAResource* res)
+{
+    struct ibv_recv_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+
+    int result = ibv_post_recv(res->queuePair, &wr, &badWR);
+    if (result)
+        fprintf(stderr, "Failed to post stream receive\n");
+    return result;
+}
+
+/* One receive per slot but never more than the run consumes, the run reposts only for the chunks beyond the
+   first slots so a QP reused for another stream starts with the same receives posted */
+static int postStreamRecvs(struct RDMAResource* res, const struct StreamSlotRing* ring, uint64_t fileSize)
+{
+    uint64_t chunks = chunkCount(fileSize, ring->chunkSize);
+    for (uint64_t i = 0; i < chunks && i < ring->count; i++) {
+        if (postStreamRecv(res))
+            return 1;
+    }
+    return 0;
+}
+
+/* Allocate and register slots, map the file for StreamFromMmap and post receives for the slot releases */
+int createStreamSender(struct StreamSender* sender, struct RDMAResource* res, int fd, uint64_t fileSize, bool direct,
+    enum StreamSource source, uint32_t slotCount)
+{
+    sender->res = res;
+    sender->fd = fd;
+    sender->fileSize = fileSize;
+    sender->source = fd >= 0 ? source : StreamFromDirect;
+    sender->direct = direct;
+    sender->mapping = nullptr;
+    sender->mappingMR = nullptr;
+    sender->mappingOnDemand = false;
+    memset(&sender->remote, 0, sizeof(StreamLayout));
+
+    if (createSlotRing(&sender->slots, res, slotCount, IBV_ACCESS_LOCAL_WRITE))
+        return 1;
+
+    if (sender->source == StreamFromMmap && fileSize) {
+        void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            fprintf(stderr, "Failed to map %lu bytes of the file: %s\n", (unsigned long)fileSize, strerror(errno));
+            return 1;
+        }
+        sender->mapping = (char*)mapping;
+        madvise(sender->mapping, fileSize, MADV_SEQUENTIAL);
+
+        /* The HCA only reads the pages, page cache pages are registered in place */
+        enum RegistrationMode used;
+        sender->mappingMR = registerMemory(res, sender->mapping, fileSize, 0, RegisterOnDemand, &used);
+        if (!sender->mappingMR)
+            return 1;
+        sender->mappingOnDemand = used != RegisterPinned;
+    }
+
+    if (postStreamRecvs(res, &sender->slots, fileSize))
+        return 1;
+    return 0;
+}
+
+/* Allocate and register slots, post receives for the first chunks */
+int createStreamReceiver(struct StreamReceiver* receiver, struct RDMAResource* res, int fd, uint64_t fileSize, bool direct,
+    uint32_t slotCount)
+{
+    receiver->res = res;
+    receiver->fd = fd;
+    receiver->fileSize = fileSize;
+    receiver->direct = direct;
+
+    if (createSlotRing(&receiver->slots, res, slotCount, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE))
+        return 1;
+
+    if (postStreamRecvs(res, &receiver->slots, fileSize))
+        return 1;
+    return 0;
+}
+
+void destroyStreamSender(struct StreamSender* sender)
+{
+    if (sender->mappingMR)
+        ibv_dereg_mr(sender->mappingMR);
+    if (sender->mapping)
+        munmap(sender->mapping, sender->fileSize);
+    sender->mappingMR = nullptr;
+    sender->mapping = nullptr;
+    destroySlotRing(&sender->slots);
+}
+
+void destroyStreamReceiver(struct StreamReceiver* receiver)
+{
+    destroySlotRing(&receiver->slots);
+}
+
+/* Layout the receiver hands to the sender */
+void streamReceiverLayout(const struct StreamReceiver* receiver, struct StreamLayout* layout)
+{
+    layout->slotsAddr = (uintptr_t)receiver->slots.base;
+    layout->slotsRkey = receiver->slots.mr->rkey;
+    layout->slotCount = receiver->slots.count;
+    layout->chunkSize = receiver->slots.chunkSize;
+}
+
+/* Disk thread of the sender, fills slots in chunk order */
+static void readChunks(struct StreamSender* sender)
+{
+    struct StreamSlotRing* ring = &sender->slots;
+    uint64_t chunks = chunkCount(sender->fileSize, ring->chunkSize);
+
+    for (uint64_t chunk = 0; chunk < chunks; chunk++) {
+        uint32_t slot = chunk % ring->count;
+        if (!waitSlotState(ring, slot, SlotFree))
+            return;
+
+        size_t length = chunkLength(sender->fileSize, ring->chunkSize, chunk);
+        size_t wanted = ioLength(length, sender->direct);
+        size_t done = 0;
+        while (done < length) {
+            ssize_t result = pread(sender->fd, slotAddr(ring, slot) + done, wanted - done, chunk * ring->chunkSize + done);
+            if (result <= 0) {
+                fprintf(stderr, "Read of chunk %lu failed: %s\n", (unsigned long)chunk, result ? strerror(errno) : "end of file");
+                failRing(ring);
+                return;
+            }
+            done += result;
+        }
+        setSlotState(ring, slot, SlotFull);
+    }
+}
+
+/* Disk thread of the receiver, writes slots in chunk order */
+static void writeChunks(struct StreamReceiver* receiver)
+{
+    struct StreamSlotRing* ring = &receiver->slots;
+    uint64_t chunks = chunkCount(receiver->fileSize, ring->chunkSize);
+
+    for (uint64_t chunk = 0; chunk < chunks; chunk++) {
+        uint32_t slot = chunk % ring->count;
+        if (!waitSlotState(ring, slot, SlotFull))
+            return;
+
+        size_t wanted = ioLength(chunkLength(receiver->fileSize, ring->chunkSize, chunk), receiver->direct);
+        size_t done = 0;
+        while (done < wanted) {
+            ssize_t result = pwrite(receiver->fd, slotAddr(ring, slot) + done, wanted - done, chunk * ring->chunkSize + done);
+            if (result <= 0) {
+                fprintf(stderr, "Write of chunk %lu failed: %s\n", (unsigned long)chunk, strerror(errno));
+                failRing(ring);
+                return;
+            }
+            done += result;
+        }
+        setSlotState(ring, slot, SlotDone);
+    }
+}
+
+/* Signaled write with the chunk number as immediate data */
+static int postChunk(struct StreamSender* sender, uint64_t chunk)
+{
+    struct StreamSlotRing* ring = &sender->slots;
+    uint32_t slot = chunk % ring->count;
+    size_t length = chunkLength(sender->fileSize, ring->chunkSize, chunk);
+
+    struct ibv_sge sge;
+    sge.length = length;
+    if (sender->source == StreamFromMmap) {
+        sge.addr = (uintptr_t)sender->mapping + chunk * ring->chunkSize;
+        sge.lkey = sender->mappingMR->lkey;
+    }
+    else {
+        sge.addr = (uintptr_t)slotAddr(ring, slot);
+        sge.lkey = ring->mr->lkey;
+    }
+
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = chunk;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.imm_data = htonl((uint32_t)chunk);
+    wr.wr.rdma.remote_addr = sender->remote.slotsAddr + (uint64_t)slot * sender->remote.chunkSize;
+    wr.wr.rdma.rkey = sender->remote.slotsRkey;
+
+    if (ibv_post_send(sender->res->queuePair, &wr, &badWR)) {
+        fprintf(stderr, "Failed to post write of chunk %lu\n", (unsigned long)chunk);
+        return 1;
+    }
+    return 0;
+}
+
+/* Poll until every signaled send was completed */
+static int drainSends(struct RDMAResource* res, uint32_t* outstanding)
+{
+    while (*outstanding) {
+        struct ibv_wc wc;
+        int polled = ibv_poll_cq(res->compQueue, 1, &wc);
+        if (polled < 0 || (polled && wc.status != IBV_WC_SUCCESS)) {
+            fprintf(stderr, "Stream send completion failed\n");
+            return 1;
+        }
+        *outstanding -= polled;
+    }
+    return 0;
+}
+
+/* Read the file and RDMA WRITE it chunk by chunk into the receiver's slots */
+int runStreamSender(struct StreamSender* sender, const struct StreamLayout* layout)
+{
+    struct StreamSlotRing* ring = &sender->slots;
+    if (layout->slotCount != ring->count || layout->chunkSize != ring->chunkSize) {
+        fprintf(stderr, "Receiver has %u slots of %u bytes, sender %u of %u\n", layout->slotCount, layout->chunkSize,
+            ring->count, ring->chunkSize);
+        return 1;
+    }
+    sender->remote = *layout;
+
+    uint64_t chunks = chunkCount(sender->fileSize, ring->chunkSize);
+    bool fromMmap = sender->source == StreamFromMmap;
+    bool fromDisk = sender->fd >= 0 && !fromMmap;
+
+    /* Without a disk every slot is ready as soon as it is free */
+    int readyState = fromDisk ? SlotFull : SlotFree;
+    std::thread reader;
+    if (fromDisk)
+        reader = std::thread(readChunks, sender);
+
+    uint64_t next = 0, released = 0;
+    uint32_t outstanding = 0;
+    int result = 0;
+    while (released < chunks && !result) {
+        if (ring->failed) {
+            result = 1;
+            break;
+        }
+
+        if (next < chunks && ring->state[next % ring->count] == readyState) {
+            /* Fault in the pages of the chunk that will be posted once this slot comes back */
+            if (sender->mappingOnDemand && next + ring->count < chunks)
+                prefetchMemory(sender->res, sender->mappingMR, sender->mapping + (next + ring->count) * ring->chunkSize,
+                    chunkLength(sender->fileSize, ring->chunkSize, next + ring->count), false);
+
+            ring->state[next % ring->count] = SlotInFlight;
+            result = postChunk(sender, next);
+            outstanding++;
+            next++;
+            continue;
+        }
+
+        struct ibv_wc wc[StreamPollBatch];
+        int polled = ibv_poll_cq(sender->res->compQueue, StreamPollBatch, wc);
+        if (polled < 0) {
+            fprintf(stderr, "Poll CQ failed\n");
+            result = 1;
+        }
+        for (int i = 0; i < polled && !result; i++) {
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                fprintf(stderr, "Stream completion with status %s, wr_id %lu\n", ibv_wc_status_str(wc[i].status),
+                    (unsigned long)wc[i].wr_id);
+                result = 1;
+            }
+            else if (wc[i].opcode == IBV_WC_RECV) {
+                uint64_t chunk = ntohl(wc[i].imm_data);
+                if (released + ring->count < chunks)
+                    result = postStreamRecv(sender->res);
+                setSlotState(ring, chunk % ring->count, SlotFree);
+                released++;
+            }
+            else {
+                outstanding--;
+            }
+        }
+    }
+
+    if (result)
+        failRing(ring);
+    if (reader.joinable())
+        reader.join();
+    if (!result)
+        result = drainSends(sender->res, &outstanding);
+    return result;
+}
+
+/* Zero length send telling the sender the slot of `chunk` may be reused */
+static int postRelease(struct StreamReceiver* receiver, uint64_t chunk)
+{
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = chunk;
+    wr.num_sge = 0;
+    wr.opcode = IBV_WR_SEND_WITH_IMM;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.imm_data = htonl((uint32_t)chunk);
+
+    if (ibv_post_send(receiver->res->queuePair, &wr, &badWR)) {
+        fprintf(stderr, "Failed to post release of chunk %lu\n", (unsigned long)chunk);
+        return 1;
+    }
+    return 0;
+}
+
+/* Write arriving chunks to the file and release their slots */
+int runStreamReceiver(struct StreamReceiver* receiver)
+{
+    struct StreamSlotRing* ring = &receiver->slots;
+    uint64_t chunks = chunkCount(receiver->fileSize, ring->chunkSize);
+    bool toDisk = receiver->fd >= 0;
+
+    std::thread writer;
+    if (toDisk)
+        writer = std::thread(writeChunks, receiver);
+
+    uint64_t nextRelease = 0, arrived = 0;
+    uint32_t outstanding = 0;
+    int result = 0;
+    while (nextRelease < chunks && !result) {
+        if (ring->failed) {
+            result = 1;
+            break;
+        }
+
+        struct ibv_wc wc[StreamPollBatch];
+        int polled = ibv_poll_cq(receiver->res->compQueue, StreamPollBatch, wc);
+        if (polled < 0) {
+            fprintf(stderr, "Poll CQ failed\n");
+            result = 1;
+        }
+        for (int i = 0; i < polled && !result; i++) {
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                fprintf(stderr, "Stream completion with status %s, wr_id %lu\n", ibv_wc_status_str(wc[i].status),
+                    (unsigned long)wc[i].wr_id);
+                result = 1;
+            }
+            else if (wc[i].opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
+                uint64_t chunk = ntohl(wc[i].imm_data);
+                if (arrived + ring->count < chunks)
+                    result = postStreamRecv(receiver->res);
+                setSlotState(ring, chunk % ring->count, toDisk ? SlotFull : SlotDone);
+                arrived++;
+            }
+            else {
+                outstanding--;
+            }
+        }
+
+        /* Slots go back in chunk order once their data is on disk */
+        while (!result && nextRelease < chunks && ring->state[nextRelease % ring->count] == SlotDone) {
+            ring->state[nextRelease % ring->count] = SlotFree;
+            result = postRelease(receiver, nextRelease);
+            outstanding++;
+            nextRelease++;
+        }
+    }
+
+    if (result)
+        failRing(ring);
+    if (writer.joinable())
+        writer.join();
+    if (!result)
+        result = drainSends(receiver->res, &outstanding);
+
+    /* Drop the padding of the last O_DIRECT block */
+    if (!result && toDisk && receiver->direct && ftruncate(receiver->fd, receiver->fileSize)) {
+        fprintf(stderr, "Failed to truncate the file to %lu bytes: %s\n", (unsigned long)receiver->fileSize, strerror(errno));
+        result = 1;
+    }
+    return result;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include "LibVerbsHelper.h"
+
+constexpr auto StreamChunkSize = 4 * 1024 * 1024;
+constexpr auto StreamSlots = 3;					/* Triple buffering: disk, wire and peer disk busy at once */
+constexpr auto StreamMaxSlots = 16;
+constexpr auto StreamBlockSize = 4096;			/* O_DIRECT offset, length and address alignment */
+constexpr auto StreamPollBatch = 16;
+
+enum StreamSource {
+	StreamFromDirect,		/* O_DIRECT pread into registered slots */
+	StreamFromMmap			/* RDMA WRITE straight from registered mmap'd file pages */
+};
+
+/* Ring of page aligned, registered chunk buffers shared by the RDMA thread and
+ * the disk thread. Chunk k always uses slot k % count on both ends */
+struct StreamSlotRing {
+	char*						base;
+	struct ibv_mr*				mr;
+	uint32_t					count;
+	uint32_t					chunkSize;
+	std::atomic<int>			state[StreamMaxSlots];
+	std::atomic<bool>			failed;				/* Either thread gave up, the other one stops too */
+	std::mutex					lock;				/* Only taken to sleep/wake the disk thread */
+	std::condition_variable		changed;
+};
+
+/* What the receiver hands to the sender */
+struct StreamLayout {
+	uint64_t					slotsAddr;
+	uint32_t					slotsRkey;
+	uint32_t					slotCount;
+	uint32_t					chunkSize;
+};
+
+struct StreamSender {
+	struct RDMAResource*		res;				/* Connected QP with at least 2 * slots send and recv WRs */
+	int							fd;					/* -1 streams without touching a disk */
+	uint64_t					fileSize;
+	enum StreamSource			source;
+	bool						direct;				/* fd was opened with O_DIRECT */
+	struct StreamSlotRing		slots;
+	char*						mapping;			/* StreamFromMmap only */
+	struct ibv_mr*				mappingMR;
+	bool						mappingOnDemand;	/* mappingMR is an ODP MR, chunks are prefetched */
+	struct StreamLayout			remote;
+};
+
+struct StreamReceiver {
+	struct RDMAResource*		res;
+	int							fd;					/* -1 discards the data */
+	uint64_t					fileSize;
+	bool						direct;
+	struct StreamSlotRing		slots;
+};
+
+/* Open file with O_DIRECT, falling back to buffered I/O where the file system refuses it */
+int openStreamFile(const char* path, bool forWrite, bool* direct);
+
+/* Allocate and register slots, map the file for StreamFromMmap and post receives
+ * for the slot releases. `fd` of -1 sends `fileSize` bytes of whatever is in the slots */
+int createStreamSender(struct StreamSender* sender, struct RDMAResource* res, int fd, uint64_t fileSize, bool direct,
+	enum StreamSource source, uint32_t slotCount);
+
+/* Allocate and register slots, post receives for the first chunks */
+int createStreamReceiver(struct StreamReceiver* receiver, struct RDMAResource* res, int fd, uint64_t fileSize, bool direct,
+	uint32_t slotCount);
+
+void destroyStreamSender(struct StreamSender* sender);
+void destroyStreamReceiver(struct StreamReceiver* receiver);
+
+/* Layout the receiver hands to the sender */
+void streamReceiverLayout(const struct StreamReceiver* receiver, struct StreamLayout* layout);
+
+/* Read the file and RDMA WRITE it chunk by chunk into the receiver's slots, returns 0 once every chunk was released */
+int runStreamSender(struct StreamSender* sender, const struct StreamLayout* layout);
+
+/* Write arriving chunks to the file and release their slots, returns 0 once the file is complete */
+int runStreamReceiver(struct StreamReceiver* receiver);
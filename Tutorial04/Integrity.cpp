@@ -0,0 +1,397 @@
+#include "Integrity.h"
+
+#include <stdio.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define INTEGRITY_X86 1
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+
+constexpr uint32_t Crc32cPoly = 0x82f63b78;     /* Reflected Castagnoli polynomial */
+constexpr auto Crc32cLong = 8192;               /* Interleaved stream lengths of the hardware kernel */
+constexpr auto Crc32cShort = 256;
+
+constexpr uint64_t XxPrime1 = 0x9e3779b185ebca87ull;
+constexpr uint64_t XxPrime2 = 0xc2b2ae3d27d4eb4full;
+constexpr uint64_t XxPrime3 = 0x165667b19e3779f9ull;
+constexpr uint64_t XxPrime4 = 0x85ebca77c2b2ae63ull;
+constexpr uint64_t XxPrime5 = 0x27d4eb2f165667c5ull;
+
+/* GF(2) 32x32 matrix times vector */
+static uint32_t gf2MatrixTimes(const uint32_t* matrix, uint32_t vector)
+{
+    uint32_t sum = 0;
+    for (; vector; vector >>= 1, matrix++) {
+        if (vector & 1)
+            sum ^= *matrix;
+    }
+    return sum;
+}
+
+static void gf2MatrixSquare(uint32_t* square, const uint32_t* matrix)
+{
+    for (int n = 0; n < 32; n++)
+        square[n] = gf2MatrixTimes(matrix, matrix[n]);
+}
+
+/* Byte tables of the operator that appends `length` zero bytes (a power of two) to a CRC */
+static void crc32cZeroTables(uint32_t zeros[4][256], size_t length)
+{
+    uint32_t even[32], odd[32];
+    odd[0] = Crc32cPoly;
+    for (int n = 1; n < 32; n++)
+        odd[n] = 1u << (n - 1);
+
+    /* Squaring doubles the number of zero bits, one bit -> 2 -> 4 -> one byte -> ... */
+    gf2MatrixSquare(even, odd);
+    gf2MatrixSquare(odd, even);
+    const uint32_t* op = odd;
+    for (;;) {
+        gf2MatrixSquare(even, odd);
+        op = even;
+        length >>= 1;
+        if (!length)
+            break;
+        gf2MatrixSquare(odd, even);
+        op = odd;
+        length >>= 1;
+        if (!length)
+            break;
+    }
+
+    for (uint32_t n = 0; n < 256; n++) {
+        zeros[0][n] = gf2MatrixTimes(op, n);
+        zeros[1][n] = gf2MatrixTimes(op, n << 8);
+        zeros[2][n] = gf2MatrixTimes(op, n << 16);
+        zeros[3][n] = gf2MatrixTimes(op, n << 24);
+    }
+}
+
+/* Slice-by-8 tables of the software kernel and zero operators of the hardware kernel */
+struct Crc32cTables {
+    uint32_t    slice[8][256];
+    uint32_t    longZeros[4][256];
+    uint32_t    shortZeros[4][256];
+    bool        hardware;
+
+    Crc32cTables()
+    {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t crc = n;
+            for (int k = 0; k < 8; k++)
+                crc = crc & 1 ? (crc >> 1) ^ Crc32cPoly : crc >> 1;
+            slice[0][n] = crc;
+        }
+        for (uint32_t n = 0; n < 256; n++) {
+            for (int k = 1; k < 8; k++)
+                slice[k][n] = (slice[k - 1][n] >> 8) ^ slice[0][slice[k - 1][n] & 0xff];
+        }
+        crc32cZeroTables(longZeros, Crc32cLong);
+        crc32cZeroTables(shortZeros, Crc32cShort);
+#ifdef INTEGRITY_X86
+        hardware = __builtin_cpu_supports("sse4.2");
+#else
+        hardware = false;
+#endif
+    }
+};
+
+static const Crc32cTables& crc32cTables()
+{
+    static const Crc32cTables tables;
+    return tables;
+}
+
+static inline uint64_t load64(const unsigned char* p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t load32(const unsigned char* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t crc32cSoftware(const Crc32cTables& tables, uint32_t crc, const unsigned char* next, size_t length)
+{
+    for (; length >= 8; length -= 8, next += 8) {
+        uint64_t word = load64(next) ^ crc;
+        crc = tables.slice[7][word & 0xff] ^ tables.slice[6][(word >> 8) & 0xff] ^
+            tables.slice[5][(word >> 16) & 0xff] ^ tables.slice[4][(word >> 24) & 0xff] ^
+            tables.slice[3][(word >> 32) & 0xff] ^ tables.slice[2][(word >> 40) & 0xff] ^
+            tables.slice[1][(word >> 48) & 0xff] ^ tables.slice[0][word >> 56];
+    }
+    for (; length; length--, next++)
+        crc = (crc >> 8) ^ tables.slice[0][(crc ^ *next) & 0xff];
+    return crc;
+}
+
+#ifdef INTEGRITY_X86
+static inline uint32_t crc32cShift(const uint32_t zeros[4][256], uint32_t crc)
+{
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^ zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+/* Three independent crc32 streams hide the latency of the instruction, the
+ * partial CRCs are combined by shifting them over the following streams */
+TARGET_SSE42 static uint32_t crc32cHardwareKernel(const Crc32cTables& tables, uint32_t crc, const unsigned char* next,
+    size_t length)
+{
+    uint64_t crc0 = crc;
+    while (length && ((uintptr_t)next & 7)) {
+        crc0 = _mm_crc32_u8((uint32_t)crc0, *next++);
+        length--;
+    }
+
+    while (length >= 3 * Crc32cLong) {
+        uint64_t crc1 = 0, crc2 = 0;
+        const unsigned char* end = next + Crc32cLong;
+        do {
+            crc0 = _mm_crc32_u64(crc0, load64(next));
+            crc1 = _mm_crc32_u64(crc1, load64(next + Crc32cLong));
+            crc2 = _mm_crc32_u64(crc2, load64(next + 2 * Crc32cLong));
+            next += 8;
+        } while (next < end);
+        crc0 = crc32cShift(tables.longZeros, (uint32_t)crc0) ^ crc1;
+        crc0 = crc32cShift(tables.longZeros, (uint32_t)crc0) ^ crc2;
+        next += 2 * Crc32cLong;
+        length -= 3 * Crc32cLong;
+    }
+
+    while (length >= 3 * Crc32cShort) {
+        uint64_t crc1 = 0, crc2 = 0;
+        const unsigned char* end = next + Crc32cShort;
+        do {
+            crc0 = _mm_crc32_u64(crc0, load64(next));
+            crc1 = _mm_crc32_u64(crc1, load64(next + Crc32cShort));
+            crc2 = _mm_crc32_u64(crc2, load64(next + 2 * Crc32cShort));
+            next += 8;
+        } while (next < end);
+        crc0 = crc32cShift(tables.shortZeros, (uint32_t)crc0) ^ crc1;
+        crc0 = crc32cShift(tables.shortZeros, (uint32_t)crc0) ^ crc2;
+        next += 2 * Crc32cShort;
+        length -= 3 * Crc32cShort;
+    }
+
+    for (; length >= 8; length -= 8, next += 8)
+        crc0 = _mm_crc32_u64(crc0, load64(next));
+    for (; length; length--)
+        crc0 = _mm_crc32_u8((uint32_t)crc0, *next++);
+    return (uint32_t)crc0;
+}
+#endif
+
+/* CRC32C of `length` bytes continuing from `crc` */
+uint32_t crc32c(uint32_t crc, const void* data, size_t length)
+{
+    const Crc32cTables& tables = crc32cTables();
+    const unsigned char* next = (const unsigned char*)data;
+    crc = ~crc;
+#ifdef INTEGRITY_X86
+    if (tables.hardware)
+        return ~crc32cHardwareKernel(tables, crc, next, length);
+#endif
+    return ~crc32cSoftware(tables, crc, next, length);
+}
+
+bool crc32cHardware()
+{
+    return crc32cTables().hardware;
+}
+
+static inline uint64_t rotl64(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t xxRound(uint64_t acc, uint64_t input)
+{
+    acc += input * XxPrime2;
+    return rotl64(acc, 31) * XxPrime1;
+}
+
+static inline uint64_t xxMergeRound(uint64_t acc, uint64_t value)
+{
+    acc ^= xxRound(0, value);
+    return acc * XxPrime1 + XxPrime4;
+}
+
+/* XXH64, four independent lanes over 32 byte stripes */
+uint64_t xxHash64(const void* data, size_t length, uint64_t seed)
+{
+    const unsigned char* next = (const unsigned char*)data;
+    const unsigned char* end = next + length;
+    uint64_t hash;
+
+    if (length >= 32) {
+        uint64_t v1 = seed + XxPrime1 + XxPrime2;
+        uint64_t v2 = seed + XxPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XxPrime1;
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = xxRound(v1, load64(next));
+            v2 = xxRound(v2, load64(next + 8));
+            v3 = xxRound(v3, load64(next + 16));
+            v4 = xxRound(v4, load64(next + 24));
+            next += 32;
+        } while (next <= limit);
+
+        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        hash = xxMergeRound(hash, v1);
+        hash = xxMergeRound(hash, v2);
+        hash = xxMergeRound(hash, v3);
+        hash = xxMergeRound(hash, v4);
+    }
+    else {
+        hash = seed + XxPrime5;
+    }
+    hash += length;
+
+    for (; next + 8 <= end; next += 8) {
+        hash ^= xxRound(0, load64(next));
+        hash = rotl64(hash, 27) * XxPrime1 + XxPrime4;
+    }
+    if (next + 4 <= end) {
+        hash ^= (uint64_t)load32(next) * XxPrime1;
+        hash = rotl64(hash, 23) * XxPrime2 + XxPrime3;
+        next += 4;
+    }
+    for (; next < end; next++) {
+        hash ^= *next * XxPrime5;
+        hash = rotl64(hash, 11) * XxPrime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= XxPrime2;
+    hash ^= hash >> 29;
+    hash *= XxPrime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/* Checksum of the given mode */
+uint64_t integrityChecksum(enum IntegrityMode mode, const void* data, size_t length)
+{
+    if (mode == IntegrityCrc32c)
+        return crc32c(0, data, length);
+    if (mode == IntegrityXxHash64)
+        return xxHash64(data, length, 0);
+    return 0;
+}
+
+static inline uint64_t* headerChecksums(struct IntegrityHeader* header)
+{
+    return (uint64_t*)(header + 1);
+}
+
+static inline const uint64_t* headerChecksums(const struct IntegrityHeader* header)
+{
+    return (const uint64_t*)(header + 1);
+}
+
+/* Header plus block checksums */
+size_t integrityHeaderSize(size_t length)
+{
+    size_t blocks = (length + IntegrityBlockSize - 1) / IntegrityBlockSize;
+    return sizeof(IntegrityHeader) + blocks * sizeof(uint64_t);
+}
+
+/* Fill header and block checksums for the payload */
+void sealIntegrityHeader(struct IntegrityHeader* header, enum IntegrityMode mode, const void* payload, size_t length)
+{
+    header->magic = IntegrityMagic;
+    header->mode = mode;
+    header->blockShift = __builtin_ctz(IntegrityBlockSize);
+    header->length = (uint32_t)length;
+    header->blocks = (uint32_t)((length + IntegrityBlockSize - 1) / IntegrityBlockSize);
+
+    uint64_t* checksums = headerChecksums(header);
+    const char* data = (const char*)payload;
+    for (uint32_t block = 0; block < header->blocks; block++) {
+        size_t offset = (size_t)block * IntegrityBlockSize;
+        size_t blockLength = length - offset < IntegrityBlockSize ? length - offset : IntegrityBlockSize;
+        checksums[block] = integrityChecksum(mode, data + offset, blockLength);
+    }
+}
+
+/* Check received payload against its header */
+int verifyIntegrity(const struct IntegrityHeader* header, const void* payload, size_t length,
+    struct IntegrityMismatch* mismatches, int maxMismatches)
+{
+    /* Checksum array size, integrityHeaderSize(), assumes IntegrityBlockSize blocks */
+    if (header->magic != IntegrityMagic || header->mode > IntegrityXxHash64 ||
+        header->blockShift != __builtin_ctz(IntegrityBlockSize)) {
+        fprintf(stderr, "Malformed integrity header, magic 0x%x mode %u block shift %u\n", header->magic, header->mode,
+            header->blockShift);
+        return -1;
+    }
+
+    uint64_t blockSize = IntegrityBlockSize;
+    if (header->length != length || header->blocks != (length + blockSize - 1) / blockSize) {
+        fprintf(stderr, "Integrity header covers %u bytes in %u blocks, %lu bytes received\n", header->length,
+            header->blocks, (unsigned long)length);
+        return -1;
+    }
+
+    const uint64_t* checksums = headerChecksums(header);
+    const char* data = (const char*)payload;
+    int count = 0;
+    for (uint32_t block = 0; block < header->blocks; block++) {
+        uint64_t offset = block * blockSize;
+        uint32_t blockLength = (uint32_t)(length - offset < blockSize ? length - offset : blockSize);
+        uint64_t actual = integrityChecksum((IntegrityMode)header->mode, data + offset, blockLength);
+        if (actual == checksums[block])
+            continue;
+        if (count < maxMismatches) {
+            mismatches[count].offset = offset;
+            mismatches[count].length = blockLength;
+            mismatches[count].expected = checksums[block];
+            mismatches[count].actual = actual;
+        }
+        count++;
+    }
+    return count;
+}
+
+/* 32 bit checksum for immediate data, XXH64 is folded */
+uint32_t integrityImmediate(enum IntegrityMode mode, const void* payload, size_t length)
+{
+    uint64_t checksum = integrityChecksum(mode, payload, length);
+    return (uint32_t)(checksum ^ (checksum >> 32));
+}
+
+/* Check payload against immediate data */
+int verifyIntegrityImmediate(enum IntegrityMode mode, const void* payload, size_t length, uint32_t immData,
+    struct IntegrityMismatch* mismatch)
+{
+    uint32_t actual = integrityImmediate(mode, payload, length);
+    if (actual == immData)
+        return 0;
+
+    mismatch->offset = 0;
+    mismatch->length = (uint32_t)length;
+    mismatch->expected = immData;
+    mismatch->actual = actual;
+    return 1;
+}
+
+/* Print mismatches of one message */
+void reportIntegrityMismatches(const char* name, const struct IntegrityMismatch* mismatches, int count)
+{
+    for (int i = 0; i < count; i++) {
+        fprintf(stderr, "%s: corrupted bytes %lu..%lu, checksum 0x%lx expected 0x%lx\n", name,
+            (unsigned long)mismatches[i].offset, (unsigned long)(mismatches[i].offset + mismatches[i].length - 1),
+            (unsigned long)mismatches[i].actual, (unsigned long)mismatches[i].expected);
+    }
+}
+
+const char* integrityModeName(enum IntegrityMode mode)
+{
+    return mode == IntegrityCrc32c ? "crc32c" : mode == IntegrityXxHash64 ? "xxh64" : "off";
+}
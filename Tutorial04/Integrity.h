@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+constexpr auto IntegrityMagic = 0x52494e54;		/* "RINT" */
+constexpr auto IntegrityBlockSize = 4096;		/* Granularity of the checksums and so of the reported offsets */
+constexpr auto IntegrityMaxMismatches = 8;
+
+enum IntegrityMode {
+	IntegrityOff,
+	IntegrityCrc32c,			/* Castagnoli CRC, SSE4.2 instruction where available */
+	IntegrityXxHash64
+};
+
+/* Header sent in front of the payload. It is followed by one uint64_t checksum
+ * per block, CRC32C values are zero extended */
+struct IntegrityHeader {
+	uint32_t			magic;
+	uint16_t			mode;				/* enum IntegrityMode */
+	uint16_t			blockShift;			/* log2 of the block size, only IntegrityBlockSize is accepted */
+	uint32_t			length;				/* Payload bytes */
+	uint32_t			blocks;
+};
+
+/* One block whose checksum did not match */
+struct IntegrityMismatch {
+	uint64_t			offset;				/* Payload offset of the block */
+	uint32_t			length;
+	uint64_t			expected;
+	uint64_t			actual;
+};
+
+/* CRC32C of `length` bytes continuing from `crc` (0 to start) */
+uint32_t crc32c(uint32_t crc, const void* data, size_t length);
+
+/* CRC32C uses the SSE4.2 instruction on this CPU */
+bool crc32cHardware();
+
+/* XXH64 of `length` bytes */
+uint64_t xxHash64(const void* data, size_t length, uint64_t seed);
+
+/* Checksum of the given mode, 0 for IntegrityOff */
+uint64_t integrityChecksum(enum IntegrityMode mode, const void* data, size_t length);
+
+/* Header plus block checksums of a `length` byte payload */
+size_t integrityHeaderSize(size_t length);
+
+/* Fill header and block checksums for the payload. `header` needs integrityHeaderSize(length) bytes */
+void sealIntegrityHeader(struct IntegrityHeader* header, enum IntegrityMode mode, const void* payload, size_t length);
+
+/* Check received payload against its header. Returns the number of mismatching blocks, the first
+ * maxMismatches of them are stored in `mismatches`, or -1 when the header itself is malformed */
+int verifyIntegrity(const struct IntegrityHeader* header, const void* payload, size_t length,
+	struct IntegrityMismatch* mismatches, int maxMismatches);
+
+/* 32 bit checksum for immediate data (host order), one per message */
+uint32_t integrityImmediate(enum IntegrityMode mode, const void* payload, size_t length);
+
+/* Check payload against immediate data. A mismatch covers the whole message */
+int verifyIntegrityImmediate(enum IntegrityMode mode, const void* payload, size_t length, uint32_t immData,
+	struct IntegrityMismatch* mismatch);
+
+/* Print mismatches of one message to stderr */
+void reportIntegrityMismatches(const char* name, const struct IntegrityMismatch* mismatches, int count);
+
+/* Printable name */
+const char* integrityModeName(enum IntegrityMode mode);
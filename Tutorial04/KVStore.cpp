@@ -0,0 +1,450 @@
+#include "KVStore.h"
+
+#include <stddef.h>
+
+constexpr auto KVLogAlignment = 64;
+
+/* Hash used for table placement, never 0 */
+uint64_t kvHash(const char* key, uint32_t keyLen)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint32_t i = 0; i < keyLen; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 0x100000001b3ull;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash ? hash : 1;
+}
+
+/* Checksum of value bytes and slot fields */
+uint32_t kvChecksum(const void* data, size_t length)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint32_t hash = 0x811c9dc5;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+/* Checksum over every slot field except the checksum itself */
+static uint32_t slotChecksum(const struct KVSlot* slot)
+{
+    struct KVSlot copy = *slot;
+    copy.checksum = 0;
+    return kvChecksum(&copy, sizeof(KVSlot));
+}
+
+/* Allocate and register table with `buckets` slots and a `logSize` byte value log */
+int createKVServer(struct KVServer* server, struct RDMAResource* res, uint64_t buckets, uint64_t logSize)
+{
+    server->res = res;
+    server->bucketCount = buckets;
+    server->logSize = logSize;
+    server->logTail = 0;
+    server->rpcCount = 0;
+    server->tableMR = nullptr;
+    server->running = false;
+
+    /* Window slots past the last bucket so a probe never wraps */
+    size_t tableBytes = (buckets + KVProbeWindow) * sizeof(KVSlot);
+    size_t regionBytes = tableBytes + logSize;
+
+    void* memory = nullptr;
+    if (posix_memalign(&memory, 4096, regionBytes)) {
+        fprintf(stderr, "Failed to allocate %zu bytes for key-value table\n", regionBytes);
+        return 1;
+    }
+    memset(memory, 0, regionBytes);
+    server->region = (char*)memory;
+    server->slots = (struct KVSlot*)server->region;
+    server->log = server->region + tableBytes;
+
+    /* Clients only ever read, every update goes through the server */
+    int mrFlags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ;
+    server->tableMR = ibv_reg_mr(res->protectedDomain, server->region, regionBytes, mrFlags);
+    if (!server->tableMR) {
+        fprintf(stderr, "Register key-value table failed with mr_flags=0x%x\n", mrFlags);
+        free(server->region);
+        server->region = nullptr;
+        return 1;
+    }
+
+    fprintf(stdout, "Key-value table with %lu buckets and %lu bytes log, rkey=0x%x\n",
+        (unsigned long)buckets, (unsigned long)logSize, server->tableMR->rkey);
+    return 0;
+}
+
+/* Deregister and free table */
+void destroyKVServer(struct KVServer* server)
+{
+    if (server->tableMR) {
+        ibv_dereg_mr(server->tableMR);
+        server->tableMR = nullptr;
+    }
+    free(server->region);
+    server->region = nullptr;
+}
+
+/* Layout to hand to clients */
+void kvServerLayout(const struct KVServer* server, struct KVLayout* layout)
+{
+    layout->tableAddr = (uintptr_t)server->slots;
+    layout->logAddr = (uintptr_t)server->log;
+    layout->bucketCount = server->bucketCount;
+    layout->rkey = server->tableMR->rkey;
+}
+
+/* Find slot holding key, or the first empty slot of its window. NULL if window is full */
+static struct KVSlot* findSlot(struct KVServer* server, uint64_t hash, const char* key, uint32_t keyLen)
+{
+    struct KVSlot* window = &server->slots[hash % server->bucketCount];
+    struct KVSlot* empty = nullptr;
+
+    for (int i = 0; i < KVProbeWindow; i++) {
+        struct KVSlot* slot = &window[i];
+        if (slot->keyHash == hash && slot->keyLen == keyLen && !memcmp(slot->key, key, keyLen))
+            return slot;
+        if (!slot->keyHash && !empty)
+            empty = slot;
+    }
+    return empty;
+}
+
+/* Insert or update a key directly in the table */
+int kvServerPut(struct KVServer* server, const char* key, uint32_t keyLen, const char* value, uint32_t valueLen)
+{
+    if (keyLen > KVMaxKey || valueLen > KVMaxValue)
+        return KVError;
+
+    uint64_t hash = kvHash(key, keyLen);
+    struct KVSlot* slot = findSlot(server, hash, key, keyLen);
+    if (!slot)
+        return KVFull;
+
+    size_t entryBytes = (sizeof(KVValueEntry) + valueLen + KVLogAlignment - 1) & ~(size_t)(KVLogAlignment - 1);
+    if (server->logTail + entryBytes > server->logSize)
+        return KVFull;
+
+    uint64_t version = slot->version + 2;
+    uint32_t valueChecksum = kvChecksum(value, valueLen);
+
+    /* Value is written before the slot points at it and never changes afterwards */
+    struct KVValueEntry* entry = (struct KVValueEntry*)(server->log + server->logTail);
+    entry->version = version;
+    entry->valueLen = valueLen;
+    entry->valueChecksum = valueChecksum;
+    memcpy(entry->value, value, valueLen);
+
+    /* Odd version tells readers the slot is being updated */
+    slot->version = version - 1;
+    std::atomic_thread_fence(std::memory_order_release);
+
+    struct KVSlot updated;
+    memset(&updated, 0, sizeof(KVSlot));
+    updated.version = version;
+    updated.keyHash = hash;
+    updated.valueOffset = server->logTail;
+    updated.valueLen = valueLen;
+    updated.valueChecksum = valueChecksum;
+    updated.keyLen = keyLen;
+    memcpy(updated.key, key, keyLen);
+    updated.checksum = slotChecksum(&updated);
+
+    memcpy((char*)slot + sizeof(uint64_t), (char*)&updated + sizeof(uint64_t), sizeof(KVSlot) - sizeof(uint64_t));
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->version = version;
+
+    server->logTail += entryBytes;
+    return KVOk;
+}
+
+/* Server side GET used by the RPC path */
+static int kvServerGet(struct KVServer* server, const char* key, uint32_t keyLen, char* value, uint32_t* valueLen)
+{
+    uint64_t hash = kvHash(key, keyLen);
+    struct KVSlot* slot = findSlot(server, hash, key, keyLen);
+    if (!slot || slot->keyHash != hash)
+        return KVNotFound;
+
+    struct KVValueEntry* entry = (struct KVValueEntry*)(server->log + slot->valueOffset);
+    memcpy(value, entry->value, entry->valueLen);
+    *valueLen = entry->valueLen;
+    return KVOk;
+}
+
+/* Post receive for the next request into the server buffer */
+static int postServerRecv(struct KVServer* server)
+{
+    struct RDMAResource* res = server->res;
+
+    struct ibv_sge sge;
+    sge.addr = (uintptr_t)res->buffer + KVServerRecvOffset;
+    sge.length = sizeof(KVMessage);
+    sge.lkey = res->memoryHandle->lkey;
+
+    struct ibv_recv_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+
+    int result = ibv_post_recv(res->queuePair, &wr, &badWR);
+    if (result)
+        fprintf(stderr, "Failed to post key-value server receive\n");
+    return result;
+}
+
+/* Send `message` placed in the buffer at `offset` */
+static int postMessage(struct RDMAResource* res, int offset, uint32_t length)
+{
+    struct ibv_sge sge;
+    sge.addr = (uintptr_t)res->buffer + offset;
+    sge.length = length;
+    sge.lkey = res->memoryHandle->lkey;
+
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_SEND;
+    wr.send_flags = IBV_SEND_SIGNALED;
+
+    int result = ibv_post_send(res->queuePair, &wr, &badWR);
+    if (result)
+        fprintf(stderr, "Failed to post key-value message\n");
+    return result;
+}
+
+/* Post the receive for the first request */
+int kvServerStart(struct KVServer* server)
+{
+    server->running = true;
+    return postServerRecv(server);
+}
+
+/* Serve requests until running is cleared */
+void kvServerLoop(struct KVServer* server)
+{
+    struct RDMAResource* res = server->res;
+    struct KVMessage* request = (struct KVMessage*)(res->buffer + KVServerRecvOffset);
+    struct KVMessage* response = (struct KVMessage*)(res->buffer + KVServerSendOffset);
+
+    while (server->running) {
+        struct ibv_wc wc;
+        int polled = ibv_poll_cq(res->compQueue, 1, &wc);
+        if (polled <= 0)
+            continue;
+        if (wc.status != IBV_WC_SUCCESS) {
+            fprintf(stderr, "Key-value server completion with status %s\n", ibv_wc_status_str(wc.status));
+            break;
+        }
+        if (wc.opcode != IBV_WC_RECV)
+            continue;
+
+        server->rpcCount++;
+        response->op = request->op;
+        response->keyLen = request->keyLen;
+        response->valueLen = 0;
+
+        /* A truncated key would alias another one */
+        if (request->keyLen > KVMaxKey)
+            response->status = KVError;
+        else if (request->op == KVOpPut)
+            response->status = kvServerPut(server, request->key, request->keyLen, request->value, request->valueLen);
+        else if (request->op == KVOpGet)
+            response->status = kvServerGet(server, request->key, request->keyLen, response->value, &response->valueLen);
+        else
+            response->status = KVError;
+
+        /* Next request may follow the response immediately */
+        if (postServerRecv(server) || postMessage(res, KVServerSendOffset, offsetof(KVMessage, value) + response->valueLen))
+            break;
+    }
+}
+
+/* Bind a client to a server layout */
+void createKVClient(struct KVClient* client, struct RDMAResource* res, const struct KVLayout* layout)
+{
+    client->res = res;
+    client->layout = *layout;
+    client->reads = 0;
+    client->retries = 0;
+}
+
+/* Wait for `count` successful completions on the client CQ */
+static int waitClient(struct RDMAResource* res, int count)
+{
+    while (count > 0) {
+        struct ibv_wc wc;
+        int polled = ibv_poll_cq(res->compQueue, 1, &wc);
+        if (polled < 0)
+            return 1;
+        if (!polled)
+            continue;
+        if (wc.status != IBV_WC_SUCCESS) {
+            fprintf(stderr, "Key-value client completion with status %s\n", ibv_wc_status_str(wc.status));
+            return 1;
+        }
+        count--;
+    }
+    return 0;
+}
+
+/* RDMA READ `length` bytes of the server table into the client buffer at `offset` */
+static int readRemote(struct KVClient* client, int offset, uint64_t remoteAddr, uint32_t length)
+{
+    struct RDMAResource* res = client->res;
+
+    struct ibv_sge sge;
+    sge.addr = (uintptr_t)res->buffer + offset;
+    sge.length = length;
+    sge.lkey = res->memoryHandle->lkey;
+
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_RDMA_READ;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.wr.rdma.remote_addr = remoteAddr;
+    wr.wr.rdma.rkey = client->layout.rkey;
+
+    client->reads++;
+    if (ibv_post_send(res->queuePair, &wr, &badWR)) {
+        fprintf(stderr, "Failed to post key-value READ\n");
+        return 1;
+    }
+    return waitClient(res, 1);
+}
+
+/* GET with one RDMA READ for the probe window and one for the value, no server CPU */
+int kvGet(struct KVClient* client, const char* key, uint32_t keyLen, char* value, uint32_t* valueLen)
+{
+    if (keyLen > KVMaxKey)
+        return KVError;
+
+    uint64_t hash = kvHash(key, keyLen);
+    uint64_t window = client->layout.tableAddr + (hash % client->layout.bucketCount) * sizeof(KVSlot);
+    const struct KVSlot* slots = (const struct KVSlot*)(client->res->buffer + KVClientProbeOffset);
+    const struct KVValueEntry* entry = (const struct KVValueEntry*)(client->res->buffer + KVClientValueOffset);
+
+    for (int attempt = 0; attempt < KVMaxRetries; attempt++) {
+        if (readRemote(client, KVClientProbeOffset, window, KVProbeWindow * sizeof(KVSlot)))
+            return KVError;
+
+        const struct KVSlot* found = nullptr;
+        bool torn = false;
+        for (int i = 0; i < KVProbeWindow && !found; i++) {
+            const struct KVSlot* slot = &slots[i];
+            if (!slot->keyHash && !slot->version)
+                continue;
+            if ((slot->version & 1) || slot->checksum != slotChecksum(slot)) {
+                torn = true;
+                continue;
+            }
+            if (slot->keyHash == hash && slot->keyLen == keyLen && !memcmp(slot->key, key, keyLen))
+                found = slot;
+        }
+
+        if (!found) {
+            if (!torn)
+                return KVNotFound;
+            client->retries++;
+            continue;
+        }
+
+        if (readRemote(client, KVClientValueOffset, client->layout.logAddr + found->valueOffset,
+            sizeof(KVValueEntry) + found->valueLen))
+            return KVError;
+
+        /* Entry must belong to the slot version that pointed at it */
+        if (entry->version != found->version || entry->valueLen != found->valueLen ||
+            kvChecksum(entry->value, entry->valueLen) != found->valueChecksum) {
+            client->retries++;
+            continue;
+        }
+
+        memcpy(value, entry->value, entry->valueLen);
+        *valueLen = entry->valueLen;
+        return KVOk;
+    }
+
+    fprintf(stderr, "Key-value GET gave up after %d torn reads\n", KVMaxRetries);
+    return KVError;
+}
+
+/* Send request from the client buffer and wait for the response */
+static int clientCall(struct KVClient* client)
+{
+    struct RDMAResource* res = client->res;
+    struct KVMessage* request = (struct KVMessage*)(res->buffer + KVClientSendOffset);
+
+    struct ibv_sge sge;
+    sge.addr = (uintptr_t)res->buffer + KVClientRecvOffset;
+    sge.length = sizeof(KVMessage);
+    sge.lkey = res->memoryHandle->lkey;
+
+    struct ibv_recv_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+
+    if (ibv_post_recv(res->queuePair, &wr, &badWR)) {
+        fprintf(stderr, "Failed to post key-value client receive\n");
+        return 1;
+    }
+    if (postMessage(res, KVClientSendOffset, offsetof(KVMessage, value) + (request->op == KVOpPut ? request->valueLen : 0)))
+        return 1;
+
+    /* Send completion and response, in either order */
+    return waitClient(res, 2);
+}
+
+/* Fill request header in the client send buffer */
+static struct KVMessage* prepareRequest(struct KVClient* client, uint32_t op, const char* key, uint32_t keyLen)
+{
+    struct KVMessage* request = (struct KVMessage*)(client->res->buffer + KVClientSendOffset);
+    request->op = op;
+    request->status = 0;
+    request->keyLen = keyLen;
+    request->valueLen = 0;
+    memcpy(request->key, key, keyLen);
+    return request;
+}
+
+/* GET through the server CPU */
+int kvGetRpc(struct KVClient* client, const char* key, uint32_t keyLen, char* value, uint32_t* valueLen)
+{
+    if (keyLen > KVMaxKey)
+        return KVError;
+
+    prepareRequest(client, KVOpGet, key, keyLen);
+    if (clientCall(client))
+        return KVError;
+
+    const struct KVMessage* response = (const struct KVMessage*)(client->res->buffer + KVClientRecvOffset);
+    if (response->status == KVOk) {
+        memcpy(value, response->value, response->valueLen);
+        *valueLen = response->valueLen;
+    }
+    return response->status;
+}
+
+/* PUT through the server CPU */
+int kvPut(struct KVClient* client, const char* key, uint32_t keyLen, const char* value, uint32_t valueLen)
+{
+    if (keyLen > KVMaxKey || valueLen > KVMaxValue)
+        return KVError;
+
+    struct KVMessage* request = prepareRequest(client, KVOpPut, key, keyLen);
+    request->valueLen = valueLen;
+    memcpy(request->value, value, valueLen);
+    if (clientCall(client))
+        return KVError;
+
+    const struct KVMessage* response = (const struct KVMessage*)(client->res->buffer + KVClientRecvOffset);
+    return response->status;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+
+#include "LibVerbsHelper.h"
+
+constexpr auto KVMaxKey = 24;
+constexpr auto KVMaxValue = 200;
+constexpr auto KVProbeWindow = 4;			/* Slots read by one GET, also the insert probe limit */
+constexpr auto KVMaxRetries = 16;			/* Re-reads of a slot caught in the middle of an update */
+
+/* Client side layout of res->buffer */
+constexpr auto KVClientProbeOffset = 0;
+constexpr auto KVClientValueOffset = 256;
+constexpr auto KVClientSendOffset = 512;
+constexpr auto KVClientRecvOffset = 768;
+
+/* Server side layout of res->buffer */
+constexpr auto KVServerRecvOffset = 0;
+constexpr auto KVServerSendOffset = 512;
+
+enum KVStatus {
+	KVOk = 0,
+	KVNotFound = 1,
+	KVFull = 2,
+	KVError = -1
+};
+
+enum KVOp {
+	KVOpGet = 1,
+	KVOpPut = 2
+};
+
+/* One cache line of the open addressed table. Updated as a seqlock by the server:
+ * version is odd while the slot is being written, checksum covers every other field */
+struct alignas(64) KVSlot {
+	uint64_t	version;
+	uint64_t	keyHash;			/* 0 marks an empty slot */
+	uint64_t	valueOffset;		/* Offset of KVValueEntry in the value log */
+	uint32_t	valueLen;
+	uint32_t	valueChecksum;
+	uint32_t	keyLen;
+	uint32_t	checksum;
+	char		key[KVMaxKey];
+};
+static_assert(sizeof(KVSlot) == 64, "KVSlot must fill exactly one cache line");
+
+/* Value log entry, the log is append only so entries never change after publishing */
+struct KVValueEntry {
+	uint64_t	version;			/* Slot version the entry was written for */
+	uint32_t	valueLen;
+	uint32_t	valueChecksum;
+	char		value[];
+};
+
+/* Two-sided request and response */
+struct KVMessage {
+	uint32_t	op;
+	int32_t		status;
+	uint32_t	keyLen;
+	uint32_t	valueLen;
+	char		key[KVMaxKey];
+	char		value[KVMaxValue];
+};
+
+/* What a client needs to read the table directly */
+struct KVLayout {
+	uint64_t	tableAddr;
+	uint64_t	logAddr;
+	uint64_t	bucketCount;
+	uint32_t	rkey;
+};
+
+struct KVServer {
+	struct RDMAResource*	res;			/* Connected to the client, used for RPC */
+	struct ibv_mr*			tableMR;		/* Table and value log, remote read only */
+	char*					region;
+	struct KVSlot*			slots;
+	char*					log;
+	uint64_t				bucketCount;
+	uint64_t				logSize;
+	uint64_t				logTail;
+	std::atomic<uint64_t>	rpcCount;		/* Requests served by the server CPU, read by the client thread */
+	std::atomic<bool>		running;
+};
+
+struct KVClient {
+	struct RDMAResource*	res;			/* Connected to the server */
+	struct KVLayout			layout;
+	uint64_t				reads;			/* RDMA READs issued */
+	uint64_t				retries;		/* Torn or in-update reads repeated */
+};
+
+/* Hash used for table placement, never 0 */
+uint64_t kvHash(const char* key, uint32_t keyLen);
+
+/* Checksum of value bytes and slot fields */
+uint32_t kvChecksum(const void* data, size_t length);
+
+/* Allocate and register table with `buckets` slots and a `logSize` byte value log */
+int createKVServer(struct KVServer* server, struct RDMAResource* res, uint64_t buckets, uint64_t logSize);
+
+/* Deregister and free table */
+void destroyKVServer(struct KVServer* server);
+
+/* Layout to hand to clients */
+void kvServerLayout(const struct KVServer* server, struct KVLayout* layout);
+
+/* Post the receive for the first request */
+int kvServerStart(struct KVServer* server);
+
+/* Serve requests until running is cleared */
+void kvServerLoop(struct KVServer* server);
+
+/* Insert or update a key directly in the table */
+int kvServerPut(struct KVServer* server, const char* key, uint32_t keyLen, const char* value, uint32_t valueLen);
+
+/* Bind a client to a server layout */
+void createKVClient(struct KVClient* client, struct RDMAResource* res, const struct KVLayout* layout);
+
+/* GET with one RDMA READ for the probe window and one for the value, no server CPU */
+int kvGet(struct KVClient* client, const char* key, uint32_t keyLen, char* value, uint32_t* valueLen);
+
+/* GET through the server CPU */
+int kvGetRpc(struct KVClient* client, const char* key, uint32_t keyLen, char* value, uint32_t* valueLen);
+
+/* PUT through the server CPU */
+int kvPut(struct KVClient* client, const char* key, uint32_t keyLen, const char* value, uint32_t valueLen);
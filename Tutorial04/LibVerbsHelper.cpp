@@ -1,5 +1,7 @@
 #include "LibVerbsHelper.h"
 
+#include <time.h>
+
 /* Destroy RDMA resource */
 void destroyRDMAResource(struct RDMAResource* res)
 {
@@ -31,21 +33,21 @@ void destroyRDMAResource(struct RDMAResource* res)
     }
 }
 
-/* Create RDMA resource structure and filled in */
-void createRDMAResource(struct RDMAResource* res)
+/* Create RDMA resource structure and filled in. Returns non zero on failure, with everything released */
+int openRDMAResource(struct RDMAResource* res)
 {
     int num_devices;
 
     struct ibv_device** device_list = ibv_get_device_list(&num_devices);
     if (!device_list) {
         fprintf(stderr, "Unable to get HCA device list\n");
-        exit(1);
+        return 1;
     }
 
     if (num_devices == 0) {
         fprintf(stderr, "Unable to find any HCA devices\n");
         ibv_free_device_list(device_list);
-        exit(1);
+        return 1;
     }
 
     for (int i = 0; i < num_devices; i++) {
@@ -60,14 +62,14 @@ void createRDMAResource(struct RDMAResource* res)
 
     if (res->context == 0) {
         fprintf(stderr, "Unable to get the device: %s\n", res->deviceName);
-        exit(1);
+        return 1;
     }
 
     /* Optional. Query HCA device properties */
     if (ibv_query_device(res->context, &res->deviceAttr)) {
         fprintf(stderr, "Unable to query device attribute\n");
         destroyRDMAResource(res);
-        exit(1);
+        return 1;
     }
 
     /* Optional. Query HCA port properties */
@@ -75,7 +77,7 @@ void createRDMAResource(struct RDMAResource* res)
     if (rc) {
         fprintf(stderr, "Failed to query port %d attributes in device '%s'\n", res->devicePort, res->deviceName);
         destroyRDMAResource(res);
-        exit(1);
+        return 1;
     }
 
     /* Verify enable port and active connection */
@@ -83,14 +85,24 @@ void createRDMAResource(struct RDMAResource* res)
     {
         fprintf(stderr, "Port %d in device '%s' not in LinkUp state\n", res->devicePort, res->deviceName);
         destroyRDMAResource(res);
-        exit(1);
+        return 1;
+    }
+
+    /* RoCE ports are addressed by GID instead of LID */
+    if (res->portAttr.link_layer == IBV_LINK_LAYER_ETHERNET) {
+        if (ibv_query_gid(res->context, res->devicePort, res->gidIndex, &res->localGid)) {
+            fprintf(stderr, "Failed to query GID %d of port %d in device '%s'\n", res->gidIndex, res->devicePort, res->deviceName);
+            destroyRDMAResource(res);
+            return 1;
+        }
     }
 
     /* Allocate Protection Domain */
     res->protectedDomain = ibv_alloc_pd(res->context);
     if (!res->protectedDomain) {
         fprintf(stderr, "Allocate protection domain error\n");
-        exit(1);
+        destroyRDMAResource(res);
+        return 1;
     }
     fprintf(stdout, "Protection Domain allocated\n");
 
@@ -98,7 +110,8 @@ void createRDMAResource(struct RDMAResource* res)
     res->compQueue = ibv_create_cq(res->context, QueueSize, nullptr, nullptr, 0);
     if (!res->compQueue) {
         fprintf(stderr, "Failed to create CQ woth %u entries\n", QueueSize);
-        exit(1);
+        destroyRDMAResource(res);
+        return 1;
     }
     fprintf(stdout, "Create Completion Queue with %d entries\n", QueueSize);
 
@@ -106,7 +119,8 @@ void createRDMAResource(struct RDMAResource* res)
     res->buffer = (char*)malloc(BufferSize);
     if (!res->buffer) {
         fprintf(stderr, "Failed to malloc %Zu bytes memory buffer\n", BufferSize);
-        exit(1);
+        destroyRDMAResource(res);
+        return 1;
     }
     fprintf(stdout, "Allocate %Zu bytes memory buffer\n", BufferSize);
 
@@ -114,15 +128,39 @@ void createRDMAResource(struct RDMAResource* res)
 
     /* Register memory buffer */
     int mrFlags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
+    /* Allow memory windows to grant access to parts of the buffer */
+    if (res->deviceAttr.device_cap_flags & (IBV_DEVICE_MEM_WINDOW_TYPE_2A | IBV_DEVICE_MEM_WINDOW_TYPE_2B))
+        mrFlags |= IBV_ACCESS_MW_BIND;
+    /* Let peers run fetch-and-add and compare-and-swap on the buffer */
+    if (res->deviceAttr.atomic_cap != IBV_ATOMIC_NONE)
+        mrFlags |= IBV_ACCESS_REMOTE_ATOMIC;
     res->memoryHandle = ibv_reg_mr(res->protectedDomain, res->buffer, BufferSize, mrFlags);
     if (!res->memoryHandle) {
         fprintf(stderr, "Register memory buffer failed with mr_flags=0x%x\n", mrFlags);
-        exit(1);
+        destroyRDMAResource(res);
+        return 1;
     }
     fprintf(stdout, "Register memory buffer with addr=%p, lkey=0x%x, rkey=0x%x, flags=0x%x\n",
         res->buffer, res->memoryHandle->lkey, res->memoryHandle->rkey, mrFlags);
 
     /* Create the Queue Pair */
+    if (createQueuePair(res)) {
+        destroyRDMAResource(res);
+        return 1;
+    }
+    return 0;
+}
+
+/* Create RDMA resource structure and filled in */
+void createRDMAResource(struct RDMAResource* res)
+{
+    if (openRDMAResource(res))
+        exit(1);
+}
+
+/* Create RC Queue Pair on the resource CQ */
+int createQueuePair(struct RDMAResource* res)
+{
     struct ibv_qp_init_attr qpInitAttr;
     memset(&qpInitAttr, 0, sizeof(ibv_qp_init_attr));
     qpInitAttr.qp_type = IBV_QPT_RC;
@@ -137,9 +175,10 @@ void createRDMAResource(struct RDMAResource* res)
     res->queuePair = ibv_create_qp(res->protectedDomain, &qpInitAttr);
     if (!res->queuePair) {
         fprintf(stderr, "Failed to create Queue Pair\n");
-        exit(1);
+        return 1;
     }
     fprintf(stdout, "QP with number 0x%x was created\n", res->queuePair->qp_num);
+    return 0;
 }
 
 /* Modify QP to INIT state */
@@ -152,6 +191,8 @@ int modifyQPtoInit(struct RDMAResource* res)
     qpInitAttr.port_num = res->devicePort;
     qpInitAttr.pkey_index = 0;
     qpInitAttr.qp_access_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
+    if (res->deviceAttr.atomic_cap != IBV_ATOMIC_NONE)
+        qpInitAttr.qp_access_flags |= IBV_ACCESS_REMOTE_ATOMIC;
 
     int flags = IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_ACCESS_FLAGS;
     int result = 0;
@@ -171,16 +212,24 @@ int modifyQPtoRTR(struct RDMAResource* res)
     rtrAttr.qp_state = IBV_QPS_RTR;
     rtrAttr.path_mtu = IBV_MTU_1024;
     rtrAttr.rq_psn = 0;
-    rtrAttr.max_dest_rd_atomic = 1;
+    rtrAttr.max_dest_rd_atomic = res->responderDepth ? res->responderDepth : 1;
     rtrAttr.min_rnr_timer = 0x12;
     rtrAttr.ah_attr.is_global = 0;
-    rtrAttr.ah_attr.sl = 0;
+    rtrAttr.ah_attr.sl = res->serviceLevel;
     rtrAttr.ah_attr.src_path_bits = 0;
     rtrAttr.ah_attr.port_num = res->devicePort;
 
-    rtrAttr.dest_qp_num = res->remoteQueueName;
+    rtrAttr.dest_qp_num = res->remoteQueueNum;
     rtrAttr.ah_attr.dlid = res->remoteId;
 
+    if (res->portAttr.link_layer == IBV_LINK_LAYER_ETHERNET) {
+        rtrAttr.ah_attr.is_global = 1;
+        rtrAttr.ah_attr.grh.dgid = res->remoteGid;
+        rtrAttr.ah_attr.grh.sgid_index = res->gidIndex;
+        rtrAttr.ah_attr.grh.hop_limit = 1;
+        rtrAttr.ah_attr.grh.traffic_class = res->trafficClass;
+    }
+
     int flags = IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU | IBV_QP_DEST_QPN | IBV_QP_RQ_PSN | IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER;
     int result = 0;
 
@@ -201,7 +250,7 @@ int modifyQPtoRTS(struct RDMAResource* res)
     rtsAttr.retry_cnt = 7;
     rtsAttr.rnr_retry = 7;
     rtsAttr.sq_psn = 0;
-    rtsAttr.max_rd_atomic = 1;
+    rtsAttr.max_rd_atomic = res->initiatorDepth ? res->initiatorDepth : 1;
 
     int flags = IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC;
     int result = 0;
@@ -210,4 +259,12 @@ int modifyQPtoRTS(struct RDMAResource* res)
     if (result)
         fprintf(stderr, "Failed to modify Queue Pair to RTS state\n");
     return result;
+}
+
+/* Monotonic time in nanoseconds */
+uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
 }
\ No newline at end of file
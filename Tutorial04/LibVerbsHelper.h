@@ -24,6 +24,13 @@ struct RDMAResource {
 	uint32_t				remoteKey;			/* Remote key */
 	uint32_t				remoteQueueNum;		/* Remote Queue Pair number */
 	uint16_t				remoteId;			/* Remote ID */
+	int						gidIndex;			/* Local GID index, RoCE ports only */
+	union ibv_gid			localGid;			/* Local GID, RoCE ports only */
+	union ibv_gid			remoteGid;			/* Remote GID, RoCE ports only */
+	uint8_t				serviceLevel;		/* SL of the path, mapped to the VL (IB) or PCP priority (RoCE) */
+	uint8_t				trafficClass;		/* GRH traffic class (DSCP << 2), RoCE ports only */
+	uint8_t				initiatorDepth;		/* READ/atomic requests in flight from this QP, 0 for 1 */
+	uint8_t				responderDepth;		/* READ/atomic requests from the peer served at once, 0 for 1 */
 };
 
 /* Destroy RDMA resource */
@@ -32,6 +39,12 @@ void destroyRDMAResource(struct RDMAResource* res);
 /* Create RDMA resource structure and filled in */
 void createRDMAResource(struct RDMAResource* res);
 
+/* Same as createRDMAResource(), but returns non zero instead of exiting */
+int openRDMAResource(struct RDMAResource* res);
+
+/* Create RC Queue Pair on the resource CQ */
+int createQueuePair(struct RDMAResource* res);
+
 /* Modify QP to INIT state */
 int modifyQPtoInit(struct RDMAResource* res);
 
@@ -45,4 +58,7 @@ int modifyQPtoRTS(struct RDMAResource* res);
 uint16_t getLocalId(struct RDMAResource* res);
 
 /* Get Queue Pair Number*/
-uint32_t getQueuePairNumber(struct RDMAResource* res);
\ No newline at end of file
+uint32_t getQueuePairNumber(struct RDMAResource* res);
+
+/* Monotonic time in nanoseconds */
+uint64_t nowNs();
\ No newline at end of file
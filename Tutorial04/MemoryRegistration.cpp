@@ -0,0 +1,101 @@
+#include "MemoryRegistration.h"
+
+#include <stdint.h>
+
+/* Query ODP capabilities of the device */
+int queryOdpCaps(struct RDMAResource* res, struct OdpCaps* caps)
+{
+    memset(caps, 0, sizeof(OdpCaps));
+
+    struct ibv_device_attr_ex deviceAttrEx;
+    memset(&deviceAttrEx, 0, sizeof(deviceAttrEx));
+    if (ibv_query_device_ex(res->context, nullptr, &deviceAttrEx)) {
+        fprintf(stderr, "Unable to query extended device attribute\n");
+        return 1;
+    }
+
+    const uint32_t rdmaCaps = IBV_ODP_SUPPORT_WRITE | IBV_ODP_SUPPORT_READ;
+    caps->rcCaps = deviceAttrEx.odp_caps.per_transport_caps.rc_odp_caps;
+    caps->supported = (deviceAttrEx.odp_caps.general_caps & IBV_ODP_SUPPORT) &&
+        (caps->rcCaps & rdmaCaps) == rdmaCaps;
+    caps->implicit = caps->supported && (deviceAttrEx.odp_caps.general_caps & IBV_ODP_SUPPORT_IMPLICIT);
+    return 0;
+}
+
+/* Register memory in the requested mode, falling back to a weaker mode the device supports */
+struct ibv_mr* registerMemory(struct RDMAResource* res, void* addr, size_t length, int access,
+    enum RegistrationMode requested, enum RegistrationMode* used)
+{
+    struct OdpCaps caps;
+    memset(&caps, 0, sizeof(OdpCaps));
+    if (requested != RegisterPinned && queryOdpCaps(res, &caps))
+        requested = RegisterPinned;
+
+    if (requested == RegisterImplicit && !caps.implicit) {
+        fprintf(stdout, "Implicit ODP is not supported by '%s'\n", res->deviceName);
+        requested = RegisterOnDemand;
+    }
+    if (requested == RegisterOnDemand && !caps.supported) {
+        fprintf(stdout, "ODP is not supported by '%s', using pinned registration\n", res->deviceName);
+        requested = RegisterPinned;
+    }
+
+    struct ibv_mr* mr = nullptr;
+    switch (requested) {
+    case RegisterImplicit:
+        mr = ibv_reg_mr(res->protectedDomain, nullptr, SIZE_MAX, access | IBV_ACCESS_ON_DEMAND);
+        break;
+    case RegisterOnDemand:
+        mr = ibv_reg_mr(res->protectedDomain, addr, length, access | IBV_ACCESS_ON_DEMAND);
+        break;
+    case RegisterPinned:
+        mr = ibv_reg_mr(res->protectedDomain, addr, length, access);
+        break;
+    }
+
+    if (!mr) {
+        fprintf(stderr, "Register %zu bytes (%s) failed with mr_flags=0x%x\n", length, registrationModeName(requested), access);
+        return nullptr;
+    }
+
+    if (used)
+        *used = requested;
+    return mr;
+}
+
+/* Fault in pages of an ODP MR ahead of use. Providers without advise support are ignored */
+int prefetchMemory(struct RDMAResource* res, struct ibv_mr* mr, void* addr, size_t length, bool forWrite)
+{
+    uint32_t advice = forWrite ? IBV_ADVISE_MR_ADVICE_PREFETCH_WRITE : IBV_ADVISE_MR_ADVICE_PREFETCH;
+
+    for (size_t offset = 0; offset < length; offset += PrefetchChunkSize) {
+        struct ibv_sge sge;
+        sge.addr = (uintptr_t)addr + offset;
+        sge.length = (uint32_t)(length - offset < PrefetchChunkSize ? length - offset : PrefetchChunkSize);
+        sge.lkey = mr->lkey;
+
+        /* Flush makes the call return once pages are mapped */
+        int result = ibv_advise_mr(res->protectedDomain, (enum ibv_advise_mr_advice)advice, IBV_ADVISE_MR_FLAG_FLUSH, &sge, 1);
+        if (result == EOPNOTSUPP)
+            return 0;
+        if (result) {
+            fprintf(stderr, "Prefetch of %u bytes at %p failed\n", sge.length, (void*)sge.addr);
+            return result;
+        }
+    }
+    return 0;
+}
+
+/* Printable mode name */
+const char* registrationModeName(enum RegistrationMode mode)
+{
+    switch (mode) {
+    case RegisterPinned:
+        return "pinned";
+    case RegisterOnDemand:
+        return "odp";
+    case RegisterImplicit:
+        return "implicit";
+    }
+    return "unknown";
+}
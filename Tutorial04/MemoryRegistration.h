@@ -0,0 +1,33 @@
+#pragma once
+
+#include "LibVerbsHelper.h"
+
+/* Largest range handed to a single ibv_advise_mr SGE */
+constexpr auto PrefetchChunkSize = 1ull << 30;
+
+enum RegistrationMode {
+	RegisterPinned,		/* Classic ibv_reg_mr, every page pinned up front */
+	RegisterOnDemand,	/* IBV_ACCESS_ON_DEMAND over the given range */
+	RegisterImplicit	/* IBV_ACCESS_ON_DEMAND over the whole address space */
+};
+
+struct OdpCaps {
+	bool		supported;		/* Explicit ODP MRs usable for RC read/write */
+	bool		implicit;		/* Implicit whole address space MR */
+	uint32_t	rcCaps;			/* IBV_ODP_SUPPORT_* for RC transport */
+};
+
+/* Query ODP capabilities of the device */
+int queryOdpCaps(struct RDMAResource* res, struct OdpCaps* caps);
+
+/* Register memory in the requested mode, falling back to a weaker mode the device
+ * supports (implicit -> on demand -> pinned). The mode actually used is stored in `used`.
+ * An implicit MR covers any address, addr and length are ignored for it */
+struct ibv_mr* registerMemory(struct RDMAResource* res, void* addr, size_t length, int access,
+	enum RegistrationMode requested, enum RegistrationMode* used);
+
+/* Fault in pages of an ODP MR ahead of use. Providers without advise support are ignored */
+int prefetchMemory(struct RDMAResource* res, struct ibv_mr* mr, void* addr, size_t length, bool forWrite);
+
+/* Printable mode name */
+const char* registrationModeName(enum RegistrationMode mode);
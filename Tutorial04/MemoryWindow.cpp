@@ -0,0 +1,108 @@
+#include "MemoryWindow.h"
+
+/* Device supports type 2 memory windows */
+bool memoryWindowsSupported(struct RDMAResource* res)
+{
+    return res->deviceAttr.device_cap_flags & (IBV_DEVICE_MEM_WINDOW_TYPE_2A | IBV_DEVICE_MEM_WINDOW_TYPE_2B);
+}
+
+/* Allocate an unbound type 2 window on the resource PD */
+int allocAccessGrant(struct RDMAResource* res, struct AccessGrant* grant)
+{
+    memset(grant, 0, sizeof(AccessGrant));
+
+    grant->window = ibv_alloc_mw(res->protectedDomain, IBV_MW_TYPE_2);
+    if (!grant->window) {
+        fprintf(stderr, "Failed to allocate type 2 memory window\n");
+        return 1;
+    }
+    grant->rkey = grant->window->rkey;
+    return 0;
+}
+
+/* Release window, grant must not be bound */
+void freeAccessGrant(struct AccessGrant* grant)
+{
+    if (grant->window) {
+        ibv_dealloc_mw(grant->window);
+        grant->window = nullptr;
+    }
+}
+
+/* Post a bind of the window to [addr, addr + length) of mr through the send queue */
+int postBindGrant(struct RDMAResource* res, struct AccessGrant* grant, struct ibv_mr* mr,
+    uint64_t addr, uint64_t length, int access, uint64_t wrId, bool signaled)
+{
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = wrId;
+    wr.opcode = IBV_WR_BIND_MW;
+    wr.send_flags = signaled ? IBV_SEND_SIGNALED : 0;
+
+    /* New tag on every bind, rkeys of earlier grants stay invalid */
+    uint32_t rkey = ibv_inc_rkey(grant->rkey);
+    wr.bind_mw.mw = grant->window;
+    wr.bind_mw.rkey = rkey;
+    wr.bind_mw.bind_info.mr = mr;
+    wr.bind_mw.bind_info.addr = addr;
+    wr.bind_mw.bind_info.length = length;
+    wr.bind_mw.bind_info.mw_access_flags = access;
+
+    int result = ibv_post_send(res->queuePair, &wr, &badWR);
+    if (result) {
+        fprintf(stderr, "Failed to post memory window bind\n");
+        return result;
+    }
+
+    grant->rkey = rkey;
+    grant->addr = addr;
+    grant->length = length;
+    grant->bound = true;
+    return 0;
+}
+
+/* Post a local invalidation of the grant rkey, revoking remote access */
+int postInvalidateGrant(struct RDMAResource* res, struct AccessGrant* grant, uint64_t wrId, bool signaled)
+{
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = wrId;
+    wr.opcode = IBV_WR_LOCAL_INV;
+    wr.send_flags = signaled ? IBV_SEND_SIGNALED : 0;
+    wr.invalidate_rkey = grant->rkey;
+
+    int result = ibv_post_send(res->queuePair, &wr, &badWR);
+    if (result) {
+        fprintf(stderr, "Failed to post memory window invalidation\n");
+        return result;
+    }
+    grant->bound = false;
+    return 0;
+}
+
+/* Send a message that also invalidates `rkey` on the receiving side */
+int postSendWithInvalidate(struct RDMAResource* res, uint32_t rkey, struct ibv_sge* sge, uint64_t wrId)
+{
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = wrId;
+    wr.opcode = IBV_WR_SEND_WITH_INV;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.sg_list = sge;
+    wr.num_sge = sge ? 1 : 0;
+    wr.invalidate_rkey = rkey;
+
+    int result = ibv_post_send(res->queuePair, &wr, &badWR);
+    if (result)
+        fprintf(stderr, "Failed to post send with invalidate\n");
+    return result;
+}
+
+/* Mark grant unbound after a receive completion carrying IBV_WC_WITH_INV for its rkey */
+bool grantInvalidatedBy(struct AccessGrant* grant, const struct ibv_wc* wc)
+{
+    if (!(wc->wc_flags & IBV_WC_WITH_INV) || wc->invalidated_rkey != grant->rkey)
+        return false;
+    grant->bound = false;
+    return true;
+}
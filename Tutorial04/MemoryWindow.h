@@ -0,0 +1,37 @@
+#pragma once
+
+#include "LibVerbsHelper.h"
+
+/* Remote access to a sub-range of a large MR, revocable without deregistration */
+struct AccessGrant {
+	struct ibv_mw*	window;			/* Type 2 memory window */
+	uint32_t		rkey;			/* Key handed to the peer, valid while bound */
+	uint64_t		addr;			/* Start of granted range */
+	uint64_t		length;			/* Length of granted range */
+	bool			bound;
+};
+
+/* Device supports type 2 memory windows */
+bool memoryWindowsSupported(struct RDMAResource* res);
+
+/* Allocate an unbound type 2 window on the resource PD */
+int allocAccessGrant(struct RDMAResource* res, struct AccessGrant* grant);
+
+/* Release window, grant must not be bound */
+void freeAccessGrant(struct AccessGrant* grant);
+
+/* Post a bind of the window to [addr, addr + length) of mr through the send queue.
+ * mr must be registered with IBV_ACCESS_MW_BIND. The new rkey is stored in the grant
+ * right away, requests posted later on the same QP are ordered after the bind */
+int postBindGrant(struct RDMAResource* res, struct AccessGrant* grant, struct ibv_mr* mr,
+	uint64_t addr, uint64_t length, int access, uint64_t wrId, bool signaled);
+
+/* Post a local invalidation of the grant rkey, revoking remote access */
+int postInvalidateGrant(struct RDMAResource* res, struct AccessGrant* grant, uint64_t wrId, bool signaled);
+
+/* Send a message that also invalidates `rkey` on the receiving side. Used by the
+ * peer to hand a grant back when it is done with the range */
+int postSendWithInvalidate(struct RDMAResource* res, uint32_t rkey, struct ibv_sge* sge, uint64_t wrId);
+
+/* Mark grant unbound after a receive completion carrying IBV_WC_WITH_INV for its rkey */
+bool grantInvalidatedBy(struct AccessGrant* grant, const struct ibv_wc* wc);
@@ -0,0 +1,267 @@
+#include "MultiRail.h"
+
+#include <algorithm>
+#include <deque>
+
+constexpr auto RateSmoothing = 0.125;
+
+/* Open one resource set for every active port, up to maxRails. Returns number of rails */
+int openRails(struct MultiRail* mr, int maxRails)
+{
+    mr->chunkSize = RailChunkSize;
+    mr->maxInflight = RailMaxInflight;
+    mr->rails.clear();
+    mr->rails.reserve(maxRails);
+
+    int num_devices = 0;
+    struct ibv_device** device_list = ibv_get_device_list(&num_devices);
+    if (!device_list) {
+        fprintf(stderr, "Unable to get HCA device list\n");
+        return 0;
+    }
+
+    for (int i = 0; i < num_devices && (int)mr->rails.size() < maxRails; i++) {
+        /* Probe ports first, openRDMAResource() gives up on a port that is down */
+        struct ibv_context* context = ibv_open_device(device_list[i]);
+        if (!context)
+            continue;
+
+        struct ibv_device_attr deviceAttr;
+        if (ibv_query_device(context, &deviceAttr)) {
+            ibv_close_device(context);
+            continue;
+        }
+
+        for (int port = 1; port <= deviceAttr.phys_port_cnt && (int)mr->rails.size() < maxRails; port++) {
+            struct ibv_port_attr portAttr;
+            if (ibv_query_port(context, port, &portAttr) || portAttr.state != IBV_PORT_ACTIVE)
+                continue;
+
+            mr->rails.emplace_back();
+            struct Rail& rail = mr->rails.back();
+            memset(&rail.res, 0, sizeof(RDMAResource));
+            rail.res.deviceName = strdup(ibv_get_device_name(device_list[i]));
+            rail.res.devicePort = port;
+            /* A port that fails setup is skipped, the other rails still carry the transfer */
+            if (openRDMAResource(&rail.res)) {
+                free((void*)rail.res.deviceName);
+                mr->rails.pop_back();
+                continue;
+            }
+
+            if (createExtendedQueue(&rail.res, &rail.queue, RailQueueDepth, 0, ExtendedQueueClassic)) {
+                destroyExtendedQueue(&rail.res, &rail.queue);
+                destroyRDMAResource(&rail.res);
+                free((void*)rail.res.deviceName);
+                mr->rails.pop_back();
+                continue;
+            }
+
+            rail.localMR = nullptr;
+            rail.remoteMR = nullptr;
+            rail.remoteBase = 0;
+            rail.remoteRkey = 0;
+            rail.inflight = 0;
+            rail.outstanding.clear();
+            rail.bytesCompleted = 0;
+            rail.lastCompletionNs = 0;
+            rail.rate = 0;
+            rail.active = true;
+            fprintf(stdout, "Rail %zu: device '%s' port %d\n", mr->rails.size() - 1, rail.res.deviceName, port);
+        }
+        ibv_close_device(context);
+    }
+    ibv_free_device_list(device_list);
+
+    mr->useRails = (int)mr->rails.size();
+    return mr->useRails;
+}
+
+/* Release every rail */
+void closeRails(struct MultiRail* mr)
+{
+    for (auto& rail : mr->rails) {
+        destroyExtendedQueue(&rail.res, &rail.queue);
+        if (rail.localMR)
+            ibv_dereg_mr(rail.localMR);
+        if (rail.remoteMR)
+            ibv_dereg_mr(rail.remoteMR);
+        destroyRDMAResource(&rail.res);
+        free((void*)rail.res.deviceName);
+    }
+    mr->rails.clear();
+}
+
+/* Register transfer buffer on every rail */
+int registerRailBuffers(struct MultiRail* mr, void* buffer, size_t length)
+{
+    int mrFlags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
+    for (auto& rail : mr->rails) {
+        rail.localMR = ibv_reg_mr(rail.res.protectedDomain, buffer, length, mrFlags);
+        if (!rail.localMR) {
+            fprintf(stderr, "Register %zu bytes on rail '%s' port %d failed\n", length, rail.res.deviceName, rail.res.devicePort);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Connect rail QP to the peer and move it to RTS */
+int connectRail(struct Rail* rail, uint32_t remoteQueueNum, uint16_t remoteId, uint64_t remoteBase, uint32_t remoteRkey)
+{
+    rail->res.remoteQueueNum = remoteQueueNum;
+    rail->res.remoteId = remoteId;
+    rail->remoteBase = remoteBase;
+    rail->remoteRkey = remoteRkey;
+
+    if (modifyQPtoInit(&rail->res))
+        return 1;
+    if (modifyQPtoRTR(&rail->res))
+        return 1;
+    return modifyQPtoRTS(&rail->res);
+}
+
+/* Connect every rail to itself, `destination` is registered and used as the remote buffer */
+int connectRailsLoopback(struct MultiRail* mr, void* destination, size_t length)
+{
+    int mrFlags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE;
+    for (auto& rail : mr->rails) {
+        rail.remoteMR = ibv_reg_mr(rail.res.protectedDomain, destination, length, mrFlags);
+        if (!rail.remoteMR) {
+            fprintf(stderr, "Register loopback destination on rail '%s' failed\n", rail.res.deviceName);
+            return 1;
+        }
+        rail.res.remoteGid = rail.res.localGid;
+        if (connectRail(&rail, rail.res.queuePair->qp_num, rail.res.portAttr.lid, (uintptr_t)destination, rail.remoteMR->rkey))
+            return 1;
+    }
+    return 0;
+}
+
+/* Take rail out of the striping set, its in-flight chunks are reassigned */
+void markRailDown(struct MultiRail* mr, int index)
+{
+    if (!mr->rails[index].active)
+        return;
+    mr->rails[index].active = false;
+    fprintf(stderr, "Rail %d ('%s' port %d) is down\n", index, mr->rails[index].res.deviceName, mr->rails[index].res.devicePort);
+}
+
+/* Active rail with a free in flight slot and the best completion rate per outstanding chunk */
+static int pickRail(struct MultiRail* mr)
+{
+    int best = -1;
+    double bestScore = -1;
+    for (int i = 0; i < mr->useRails; i++) {
+        struct Rail& rail = mr->rails[i];
+        if (!rail.active || rail.inflight >= mr->maxInflight)
+            continue;
+        /* Rails without history yet are tried first */
+        double score = rail.rate > 0 ? rail.rate / (rail.inflight + 1) : 1e9;
+        if (score > bestScore) {
+            bestScore = score;
+            best = i;
+        }
+    }
+    return best;
+}
+
+/* RDMA write `length` bytes from registered buffer offset to the same peer offset,
+ * striped over the active rails. Returns 0 when every byte was written */
+int stripedWrite(struct MultiRail* mr, uint64_t localAddr, uint64_t remoteOffset, size_t length)
+{
+    uint64_t chunks = (length + mr->chunkSize - 1) / mr->chunkSize;
+    std::deque<uint64_t> pending;
+    for (uint64_t c = 0; c < chunks; c++)
+        pending.push_back(c);
+
+    uint64_t done = 0;
+    struct ibv_sge sge;
+    struct ibv_send_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.opcode = IBV_WR_RDMA_WRITE;
+    wr.send_flags = IBV_SEND_SIGNALED;
+
+    while (done < chunks) {
+        /* Fill every rail up to its in flight limit */
+        while (!pending.empty()) {
+            int index = pickRail(mr);
+            if (index < 0)
+                break;
+
+            struct Rail& rail = mr->rails[index];
+            uint64_t chunk = pending.front();
+            uint64_t offset = chunk * mr->chunkSize;
+
+            wr.wr_id = chunk;
+            wr.wr.rdma.remote_addr = rail.remoteBase + remoteOffset + offset;
+            wr.wr.rdma.rkey = rail.remoteRkey;
+            sge.addr = localAddr + offset;
+            sge.length = (uint32_t)(length - offset < mr->chunkSize ? length - offset : mr->chunkSize);
+            sge.lkey = rail.localMR->lkey;
+
+            if (ibv_post_send(rail.res.queuePair, &wr, &badWR)) {
+                markRailDown(mr, index);
+                continue;
+            }
+            if (!rail.inflight)
+                rail.lastCompletionNs = nowNs();
+            rail.inflight++;
+            rail.outstanding.push_back(chunk);
+            pending.pop_front();
+        }
+
+        bool anyActive = false;
+        for (int i = 0; i < mr->useRails; i++) {
+            struct Rail& rail = mr->rails[i];
+            anyActive |= rail.active;
+            if (!rail.inflight)
+                continue;
+
+            struct ibv_wc wc[RailMaxInflight];
+            int polled = ibv_poll_cq(rail.res.compQueue, RailMaxInflight, wc);
+            if (polled < 0) {
+                /* Completions of this rail are lost, its chunks go to another rail */
+                markRailDown(mr, i);
+                pending.insert(pending.end(), rail.outstanding.begin(), rail.outstanding.end());
+                rail.outstanding.clear();
+                rail.inflight = 0;
+                continue;
+            }
+
+            for (int k = 0; k < polled; k++) {
+                rail.inflight--;
+                auto posted = std::find(rail.outstanding.begin(), rail.outstanding.end(), wc[k].wr_id);
+                if (posted != rail.outstanding.end())
+                    rail.outstanding.erase(posted);
+                if (wc[k].status != IBV_WC_SUCCESS) {
+                    /* Flushed or failed chunk goes to another rail */
+                    markRailDown(mr, i);
+                    pending.push_back(wc[k].wr_id);
+                    continue;
+                }
+
+                uint64_t now = nowNs();
+                uint64_t bytes = wc[k].wr_id == chunks - 1 ? length - wc[k].wr_id * mr->chunkSize : mr->chunkSize;
+                double sample = (double)bytes / (now - rail.lastCompletionNs + 1);
+                rail.rate = rail.rate > 0 ? rail.rate + RateSmoothing * (sample - rail.rate) : sample;
+                rail.lastCompletionNs = now;
+                rail.bytesCompleted += bytes;
+                done++;
+            }
+        }
+
+        if (!anyActive) {
+            bool drained = true;
+            for (int i = 0; i < mr->useRails; i++)
+                drained &= mr->rails[i].inflight == 0;
+            if (drained) {
+                fprintf(stderr, "No active rails left, %lu of %lu chunks written\n", (unsigned long)done, (unsigned long)chunks);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "LibVerbsHelper.h"
+#include "ExtendedVerbs.h"
+
+constexpr auto MaxRails = 8;
+constexpr auto RailQueueDepth = 64;
+constexpr auto RailChunkSize = 1024 * 1024;
+constexpr auto RailMaxInflight = 8;
+
+/* One HCA port with its own resources and QP */
+struct Rail {
+	struct RDMAResource		res;
+	struct ExtendedQueue	queue;				/* Deep classic QP/CQ */
+	struct ibv_mr*			localMR;			/* Transfer source registered on this rail */
+	struct ibv_mr*			remoteMR;			/* Loopback destination, NULL with a remote peer */
+	uint64_t				remoteBase;			/* Peer transfer buffer on this rail */
+	uint32_t				remoteRkey;
+	uint32_t				inflight;			/* Chunks posted and not completed */
+	std::deque<uint64_t>	outstanding;		/* Chunk ids (wr_id) of those chunks */
+	uint64_t				bytesCompleted;
+	uint64_t				lastCompletionNs;
+	double					rate;				/* EWMA of completed bytes per ns */
+	bool					active;
+};
+
+struct MultiRail {
+	std::vector<Rail>		rails;
+	uint32_t				chunkSize;
+	uint32_t				maxInflight;		/* Per rail in flight limit */
+	int						useRails;			/* Stripe over rails [0, useRails) */
+};
+
+/* Open one resource set for every active port, up to maxRails. Returns number of rails */
+int openRails(struct MultiRail* mr, int maxRails);
+
+/* Release every rail */
+void closeRails(struct MultiRail* mr);
+
+/* Register transfer buffer on every rail */
+int registerRailBuffers(struct MultiRail* mr, void* buffer, size_t length);
+
+/* Connect rail QP to the peer and move it to RTS */
+int connectRail(struct Rail* rail, uint32_t remoteQueueNum, uint16_t remoteId, uint64_t remoteBase, uint32_t remoteRkey);
+
+/* Connect every rail to itself, `destination` is registered and used as the remote buffer */
+int connectRailsLoopback(struct MultiRail* mr, void* destination, size_t length);
+
+/* Take rail out of the striping set, its in-flight chunks are reassigned */
+void markRailDown(struct MultiRail* mr, int index);
+
+/* RDMA write `length` bytes from registered buffer offset to the same peer offset,
+ * striped over the active rails. Returns 0 when every byte was written */
+int stripedWrite(struct MultiRail* mr, uint64_t localAddr, uint64_t remoteOffset, size_t length);
@@ -0,0 +1,292 @@
+#include "QueuePairPool.h"
+
+#include <algorithm>
+#include <chrono>
+
+/* Non owning view for the modifyQPto* helpers */
+static void poolView(struct QueuePairPool* pool, struct PooledQueuePair* pqp, struct RDMAResource* view)
+{
+    *view = *pool->res;
+    view->queuePair = pqp->qp;
+    view->compQueue = pqp->cq;
+}
+
+/* Receive wr_id carries the slot of the receive buffer */
+static int postPooledRecv(struct QueuePairPool* pool, struct PooledQueuePair* pqp, uint32_t slot)
+{
+    struct ibv_sge sge;
+    sge.addr = (uintptr_t)pqp->recvBuffer + (size_t)slot * pool->recvSize;
+    sge.length = pool->recvSize;
+    sge.lkey = pool->regionMR->lkey;
+
+    struct ibv_recv_wr wr, *badWR = nullptr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = slot;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+
+    int result = ibv_post_recv(pqp->qp, &wr, &badWR);
+    if (result)
+        fprintf(stderr, "Failed to post receive on pooled QP 0x%x\n", pqp->qp->qp_num);
+    return result;
+}
+
+/* INIT and a full receive queue, the part of connection setup that does not need the peer */
+static int armPooledQP(struct QueuePairPool* pool, struct PooledQueuePair* pqp)
+{
+    struct RDMAResource view;
+    poolView(pool, pqp, &view);
+    if (modifyQPtoInit(&view))
+        return 1;
+
+    for (uint32_t slot = 0; slot < pool->recvDepth; slot++) {
+        if (postPooledRecv(pool, pqp, slot))
+            return 1;
+    }
+    return 0;
+}
+
+static int createPooledQP(struct QueuePairPool* pool, struct PooledQueuePair* pqp)
+{
+    pqp->cq = ibv_create_cq(pool->res->context, 2 * pool->recvDepth, nullptr, nullptr, 0);
+    if (!pqp->cq) {
+        fprintf(stderr, "Failed to create CQ for pooled QP\n");
+        return 1;
+    }
+
+    struct ibv_qp_init_attr qpInitAttr;
+    memset(&qpInitAttr, 0, sizeof(ibv_qp_init_attr));
+    qpInitAttr.qp_type = IBV_QPT_RC;
+    qpInitAttr.sq_sig_all = 1;
+    qpInitAttr.send_cq = pqp->cq;
+    qpInitAttr.recv_cq = pqp->cq;
+    qpInitAttr.cap.max_send_wr = pool->recvDepth;
+    qpInitAttr.cap.max_recv_wr = pool->recvDepth;
+    qpInitAttr.cap.max_send_sge = 1;
+    qpInitAttr.cap.max_recv_sge = 1;
+
+    pqp->qp = ibv_create_qp(pool->res->protectedDomain, &qpInitAttr);
+    if (!pqp->qp) {
+        fprintf(stderr, "Failed to create pooled Queue Pair\n");
+        return 1;
+    }
+    return armPooledQP(pool, pqp);
+}
+
+static void destroyPooledQP(struct PooledQueuePair* pqp)
+{
+    if (pqp->qp)
+        ibv_destroy_qp(pqp->qp);
+    if (pqp->cq)
+        ibv_destroy_cq(pqp->cq);
+    pqp->qp = nullptr;
+    pqp->cq = nullptr;
+}
+
+/* RESET drops every queued WR, completions left in the private CQ are discarded */
+static int recyclePooledQP(struct QueuePairPool* pool, struct PooledQueuePair* pqp)
+{
+    struct ibv_qp_attr attr;
+    memset(&attr, 0, sizeof(ibv_qp_attr));
+    attr.qp_state = IBV_QPS_RESET;
+    if (ibv_modify_qp(pqp->qp, &attr, IBV_QP_STATE)) {
+        fprintf(stderr, "Failed to reset pooled QP 0x%x\n", pqp->qp->qp_num);
+        return 1;
+    }
+
+    struct ibv_wc wc[PoolRecvDepth];
+    while (ibv_poll_cq(pqp->cq, PoolRecvDepth, wc) > 0)
+        ;
+    return armPooledQP(pool, pqp);
+}
+
+/* Bring back retired QPs first, then create new ones until warmTarget QPs are ready */
+static void refillPool(struct QueuePairPool* pool)
+{
+    std::unique_lock<std::mutex> guard(pool->lock);
+    int backoffMs = 0;
+    while (pool->running) {
+        uint32_t index;
+        bool recycle = !pool->retired.empty();
+        if (recycle) {
+            index = pool->retired.back();
+            pool->retired.pop_back();
+        }
+        else if (pool->warm.size() < pool->warmTarget && !pool->empty.empty()) {
+            index = pool->empty.back();
+            pool->empty.pop_back();
+        }
+        else {
+            pool->wake.wait(guard);
+            continue;
+        }
+
+        /* Kernel round trips happen without the lock, acquire stays fast */
+        struct PooledQueuePair* pqp = &pool->slots[index];
+        guard.unlock();
+        int result = recycle ? recyclePooledQP(pool, pqp) : createPooledQP(pool, pqp);
+        if (result)
+            destroyPooledQP(pqp);
+        guard.lock();
+
+        if (result) {
+            pqp->state = PooledEmpty;
+            pool->empty.push_back(index);
+            /* Likely out of QPs or memory, retry after a growing delay or once a connection comes or goes */
+            backoffMs = backoffMs ? std::min(2 * backoffMs, PoolRefillMaxBackoffMs) : PoolRefillBackoffMs;
+            pool->wake.wait_for(guard, std::chrono::milliseconds(backoffMs));
+            continue;
+        }
+        backoffMs = 0;
+        pqp->state = PooledWarm;
+        pool->warm.push_back(index);
+        pool->recycled += recycle;
+    }
+}
+
+/* Allocate slots and receive region, warm up `warmTarget` QPs and start the refill thread */
+int createQPPool(struct QueuePairPool* pool, struct RDMAResource* res, uint32_t capacity, uint32_t warmTarget,
+    uint32_t recvDepth, uint32_t recvSize)
+{
+    pool->res = res;
+    pool->capacity = capacity;
+    pool->warmTarget = warmTarget < capacity ? warmTarget : capacity;
+    pool->recvDepth = recvDepth < PoolRecvDepth ? recvDepth : PoolRecvDepth;
+    pool->recvSize = recvSize;
+    pool->region = nullptr;
+    pool->regionMR = nullptr;
+    pool->running = false;
+    pool->hits = 0;
+    pool->misses = 0;
+    pool->recycled = 0;
+    pool->slots.assign(capacity, PooledQueuePair());
+    pool->warm.clear();
+    pool->retired.clear();
+    pool->empty.clear();
+
+    size_t length = (size_t)capacity * pool->recvDepth * recvSize;
+    void* memory = nullptr;
+    if (!capacity || posix_memalign(&memory, 4096, length)) {
+        fprintf(stderr, "Failed to allocate receive region of %u pooled QPs\n", capacity);
+        return 1;
+    }
+    pool->region = (char*)memory;
+    pool->regionMR = ibv_reg_mr(res->protectedDomain, pool->region, length, IBV_ACCESS_LOCAL_WRITE);
+    if (!pool->regionMR) {
+        fprintf(stderr, "Register pool receive region failed\n");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < capacity; i++) {
+        struct PooledQueuePair* pqp = &pool->slots[i];
+        pqp->qp = nullptr;
+        pqp->cq = nullptr;
+        pqp->recvBuffer = pool->region + (size_t)i * pool->recvDepth * recvSize;
+        pqp->index = i;
+        pqp->state = PooledEmpty;
+        pool->empty.push_back(capacity - 1 - i);
+    }
+
+    /* First warm set is created up front, the refill thread only keeps it topped up */
+    while (pool->warm.size() < pool->warmTarget) {
+        uint32_t index = pool->empty.back();
+        if (createPooledQP(pool, &pool->slots[index]))
+            return 1;
+        pool->empty.pop_back();
+        pool->slots[index].state = PooledWarm;
+        pool->warm.push_back(index);
+    }
+
+    pool->running = true;
+    pool->refiller = std::thread(refillPool, pool);
+    return 0;
+}
+
+/* Stop the refill thread and destroy every QP */
+void destroyQPPool(struct QueuePairPool* pool)
+{
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->running = false;
+    }
+    pool->wake.notify_all();
+    if (pool->refiller.joinable())
+        pool->refiller.join();
+
+    for (auto& pqp : pool->slots)
+        destroyPooledQP(&pqp);
+    if (pool->regionMR)
+        ibv_dereg_mr(pool->regionMR);
+    free(pool->region);
+    pool->regionMR = nullptr;
+    pool->region = nullptr;
+}
+
+/* Take a warm QP, creating one inline when the pool ran dry */
+struct PooledQueuePair* acquirePooledQP(struct QueuePairPool* pool)
+{
+    std::unique_lock<std::mutex> guard(pool->lock);
+    struct PooledQueuePair* pqp = nullptr;
+
+    if (!pool->warm.empty()) {
+        pqp = &pool->slots[pool->warm.back()];
+        pool->warm.pop_back();
+        pool->hits++;
+    }
+    else if (!pool->empty.empty()) {
+        pqp = &pool->slots[pool->empty.back()];
+        pool->empty.pop_back();
+        pool->misses++;
+
+        guard.unlock();
+        if (createPooledQP(pool, pqp)) {
+            destroyPooledQP(pqp);
+            guard.lock();
+            pool->empty.push_back(pqp->index);
+            return nullptr;
+        }
+        guard.lock();
+    }
+    else {
+        fprintf(stderr, "Every one of %u pooled QPs is in use\n", pool->capacity);
+        return nullptr;
+    }
+
+    pqp->state = PooledInUse;
+    guard.unlock();
+    pool->wake.notify_one();
+    return pqp;
+}
+
+/* Move acquired QP through RTR and RTS to the given peer */
+int connectPooledQP(struct QueuePairPool* pool, struct PooledQueuePair* pqp, uint32_t remoteQueueNum, uint16_t remoteId,
+    const union ibv_gid* remoteGid)
+{
+    struct RDMAResource view;
+    poolView(pool, pqp, &view);
+    view.remoteQueueNum = remoteQueueNum;
+    view.remoteId = remoteId;
+    if (remoteGid)
+        view.remoteGid = *remoteGid;
+
+    if (modifyQPtoRTR(&view))
+        return 1;
+    return modifyQPtoRTS(&view);
+}
+
+/* Repost receive slot `slot` after its completion was consumed */
+int repostPooledRecv(struct QueuePairPool* pool, struct PooledQueuePair* pqp, uint32_t slot)
+{
+    return postPooledRecv(pool, pqp, slot);
+}
+
+/* Hand QP of a closed connection back, it is reset and re-armed in the background */
+void releasePooledQP(struct QueuePairPool* pool, struct PooledQueuePair* pqp)
+{
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pqp->state = PooledRetired;
+        pool->retired.push_back(pqp->index);
+    }
+    pool->wake.notify_one();
+}
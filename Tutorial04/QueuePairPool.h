@@ -0,0 +1,72 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "LibVerbsHelper.h"
+
+constexpr auto PoolRecvDepth = 16;				/* Receives posted per QP, also the most a pool accepts */
+constexpr auto PoolRecvSize = 4096;
+constexpr auto PoolRefillBackoffMs = 1;			/* First wait after a failed refill, doubled per failure */
+constexpr auto PoolRefillMaxBackoffMs = 1000;
+
+enum PooledQPState {
+	PooledEmpty,			/* No QP created yet */
+	PooledWarm,				/* INIT with receives posted, ready to connect */
+	PooledInUse,			/* Handed to a connection */
+	PooledRetired			/* Connection closed, waiting for RESET and re-arm */
+};
+
+/* One pool slot, the QP keeps its CQ and receive slots across connections */
+struct PooledQueuePair {
+	struct ibv_qp*			qp;
+	struct ibv_cq*			cq;					/* Private to the QP, no stale completions of older connections */
+	char*					recvBuffer;			/* recvDepth slots of recvSize bytes in the pool region */
+	uint32_t				index;
+	enum PooledQPState		state;
+};
+
+/* QPs created and moved to INIT ahead of time. Connections take a warm QP and only
+ * pay for RTR and RTS, a background thread creates and recycles QPs behind them */
+struct QueuePairPool {
+	struct RDMAResource*			res;			/* Device, port and PD, owned by the caller */
+	uint32_t						capacity;		/* Slots, the most connections open at once */
+	uint32_t						warmTarget;		/* Warm QPs the refill thread keeps ready */
+	uint32_t						recvDepth;
+	uint32_t						recvSize;
+	char*							region;			/* Receive slots of every QP */
+	struct ibv_mr*					regionMR;
+	std::vector<PooledQueuePair>	slots;
+	std::vector<uint32_t>			warm;			/* Slot indices by state, under lock */
+	std::vector<uint32_t>			retired;
+	std::vector<uint32_t>			empty;
+	std::mutex						lock;
+	std::condition_variable			wake;
+	std::thread						refiller;
+	bool							running;
+	uint64_t						hits;			/* Acquires served by a warm QP */
+	uint64_t						misses;			/* Acquires that had to create a QP inline */
+	uint64_t						recycled;		/* Retired QPs brought back through RESET */
+};
+
+/* Allocate slots and receive region, warm up `warmTarget` QPs and start the refill thread */
+int createQPPool(struct QueuePairPool* pool, struct RDMAResource* res, uint32_t capacity, uint32_t warmTarget,
+	uint32_t recvDepth, uint32_t recvSize);
+
+/* Stop the refill thread and destroy every QP, connections must be released first */
+void destroyQPPool(struct QueuePairPool* pool);
+
+/* Take a warm QP, creating one inline when the pool ran dry. NULL when every slot is in use */
+struct PooledQueuePair* acquirePooledQP(struct QueuePairPool* pool);
+
+/* Move acquired QP through RTR and RTS to the given peer */
+int connectPooledQP(struct QueuePairPool* pool, struct PooledQueuePair* pqp, uint32_t remoteQueueNum, uint16_t remoteId,
+	const union ibv_gid* remoteGid);
+
+/* Repost receive slot `slot` after its completion was consumed */
+int repostPooledRecv(struct QueuePairPool* pool, struct PooledQueuePair* pqp, uint32_t slot);
+
+/* Hand QP of a closed connection back, it is reset and re-armed in the background */
+void releasePooledQP(struct QueuePairPool* pool, struct PooledQueuePair* pqp);
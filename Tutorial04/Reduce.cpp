@@ -0,0 +1,217 @@
+#include "Reduce.h"
+
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define REDUCE_X86 1
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+typedef void (*reduceFunc_t)(void* target, const void* source, size_t count);
+
+template <typename T, ReduceOp Op>
+static inline T combine(T a, T b)
+{
+    return Op == ReduceSum ? a + b : Op == ReduceMin ? (a < b ? a : b) : (a > b ? a : b);
+}
+
+template <typename T, ReduceOp Op>
+static void reduceScalar(void* target, const void* source, size_t count)
+{
+    T* dst = (T*)target;
+    const T* src = (const T*)source;
+    for (size_t i = 0; i < count; i++)
+        dst[i] = combine<T, Op>(dst[i], src[i]);
+}
+
+#ifdef REDUCE_X86
+/* Lane traits for one element type and vector width */
+struct Avx2Float {
+	typedef float Scalar;
+	typedef __m256 Vector;
+	static constexpr size_t Lanes = 8;
+	TARGET_AVX2 static Vector load(const Scalar* p) { return _mm256_loadu_ps(p); }
+	TARGET_AVX2 static void store(Scalar* p, Vector v) { _mm256_storeu_ps(p, v); }
+	TARGET_AVX2 static Vector add(Vector a, Vector b) { return _mm256_add_ps(a, b); }
+	TARGET_AVX2 static Vector min(Vector a, Vector b) { return _mm256_min_ps(a, b); }
+	TARGET_AVX2 static Vector max(Vector a, Vector b) { return _mm256_max_ps(a, b); }
+};
+
+struct Avx2Double {
+	typedef double Scalar;
+	typedef __m256d Vector;
+	static constexpr size_t Lanes = 4;
+	TARGET_AVX2 static Vector load(const Scalar* p) { return _mm256_loadu_pd(p); }
+	TARGET_AVX2 static void store(Scalar* p, Vector v) { _mm256_storeu_pd(p, v); }
+	TARGET_AVX2 static Vector add(Vector a, Vector b) { return _mm256_add_pd(a, b); }
+	TARGET_AVX2 static Vector min(Vector a, Vector b) { return _mm256_min_pd(a, b); }
+	TARGET_AVX2 static Vector max(Vector a, Vector b) { return _mm256_max_pd(a, b); }
+};
+
+struct Avx2Int32 {
+	typedef int32_t Scalar;
+	typedef __m256i Vector;
+	static constexpr size_t Lanes = 8;
+	TARGET_AVX2 static Vector load(const Scalar* p) { return _mm256_loadu_si256((const __m256i*)p); }
+	TARGET_AVX2 static void store(Scalar* p, Vector v) { _mm256_storeu_si256((__m256i*)p, v); }
+	TARGET_AVX2 static Vector add(Vector a, Vector b) { return _mm256_add_epi32(a, b); }
+	TARGET_AVX2 static Vector min(Vector a, Vector b) { return _mm256_min_epi32(a, b); }
+	TARGET_AVX2 static Vector max(Vector a, Vector b) { return _mm256_max_epi32(a, b); }
+};
+
+/* AVX2 has no 64 bit min/max, compare and blend instead */
+struct Avx2Int64 {
+	typedef int64_t Scalar;
+	typedef __m256i Vector;
+	static constexpr size_t Lanes = 4;
+	TARGET_AVX2 static Vector load(const Scalar* p) { return _mm256_loadu_si256((const __m256i*)p); }
+	TARGET_AVX2 static void store(Scalar* p, Vector v) { _mm256_storeu_si256((__m256i*)p, v); }
+	TARGET_AVX2 static Vector add(Vector a, Vector b) { return _mm256_add_epi64(a, b); }
+	TARGET_AVX2 static Vector min(Vector a, Vector b) { return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b)); }
+	TARGET_AVX2 static Vector max(Vector a, Vector b) { return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b)); }
+};
+
+/* GCC 12 reports the _mm512_undefined_* pass-through operand of the AVX-512 intrinsics as uninitialized */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+struct Avx512Float {
+	typedef float Scalar;
+	typedef __m512 Vector;
+	static constexpr size_t Lanes = 16;
+	TARGET_AVX512 static Vector load(const Scalar* p) { return _mm512_loadu_ps(p); }
+	TARGET_AVX512 static void store(Scalar* p, Vector v) { _mm512_storeu_ps(p, v); }
+	TARGET_AVX512 static Vector add(Vector a, Vector b) { return _mm512_add_ps(a, b); }
+	TARGET_AVX512 static Vector min(Vector a, Vector b) { return _mm512_min_ps(a, b); }
+	TARGET_AVX512 static Vector max(Vector a, Vector b) { return _mm512_max_ps(a, b); }
+};
+
+struct Avx512Double {
+	typedef double Scalar;
+	typedef __m512d Vector;
+	static constexpr size_t Lanes = 8;
+	TARGET_AVX512 static Vector load(const Scalar* p) { return _mm512_loadu_pd(p); }
+	TARGET_AVX512 static void store(Scalar* p, Vector v) { _mm512_storeu_pd(p, v); }
+	TARGET_AVX512 static Vector add(Vector a, Vector b) { return _mm512_add_pd(a, b); }
+	TARGET_AVX512 static Vector min(Vector a, Vector b) { return _mm512_min_pd(a, b); }
+	TARGET_AVX512 static Vector max(Vector a, Vector b) { return _mm512_max_pd(a, b); }
+};
+
+struct Avx512Int32 {
+	typedef int32_t Scalar;
+	typedef __m512i Vector;
+	static constexpr size_t Lanes = 16;
+	TARGET_AVX512 static Vector load(const Scalar* p) { return _mm512_loadu_si512(p); }
+	TARGET_AVX512 static void store(Scalar* p, Vector v) { _mm512_storeu_si512(p, v); }
+	TARGET_AVX512 static Vector add(Vector a, Vector b) { return _mm512_add_epi32(a, b); }
+	TARGET_AVX512 static Vector min(Vector a, Vector b) { return _mm512_min_epi32(a, b); }
+	TARGET_AVX512 static Vector max(Vector a, Vector b) { return _mm512_max_epi32(a, b); }
+};
+
+struct Avx512Int64 {
+	typedef int64_t Scalar;
+	typedef __m512i Vector;
+	static constexpr size_t Lanes = 8;
+	TARGET_AVX512 static Vector load(const Scalar* p) { return _mm512_loadu_si512(p); }
+	TARGET_AVX512 static void store(Scalar* p, Vector v) { _mm512_storeu_si512(p, v); }
+	TARGET_AVX512 static Vector add(Vector a, Vector b) { return _mm512_add_epi64(a, b); }
+	TARGET_AVX512 static Vector min(Vector a, Vector b) { return _mm512_min_epi64(a, b); }
+	TARGET_AVX512 static Vector max(Vector a, Vector b) { return _mm512_max_epi64(a, b); }
+};
+
+/* Two vectors per iteration to keep both load ports busy, scalar tail */
+template <typename V, ReduceOp Op>
+TARGET_AVX2 static void reduceAvx2(void* target, const void* source, size_t count)
+{
+    typedef typename V::Scalar T;
+    T* dst = (T*)target;
+    const T* src = (const T*)source;
+    size_t i = 0;
+    for (; i + 2 * V::Lanes <= count; i += 2 * V::Lanes) {
+        typename V::Vector a0 = V::load(dst + i), b0 = V::load(src + i);
+        typename V::Vector a1 = V::load(dst + i + V::Lanes), b1 = V::load(src + i + V::Lanes);
+        V::store(dst + i, Op == ReduceSum ? V::add(a0, b0) : Op == ReduceMin ? V::min(a0, b0) : V::max(a0, b0));
+        V::store(dst + i + V::Lanes, Op == ReduceSum ? V::add(a1, b1) : Op == ReduceMin ? V::min(a1, b1) : V::max(a1, b1));
+    }
+    for (; i < count; i++)
+        dst[i] = combine<T, Op>(dst[i], src[i]);
+}
+
+template <typename V, ReduceOp Op>
+TARGET_AVX512 static void reduceAvx512(void* target, const void* source, size_t count)
+{
+    typedef typename V::Scalar T;
+    T* dst = (T*)target;
+    const T* src = (const T*)source;
+    size_t i = 0;
+    for (; i + 2 * V::Lanes <= count; i += 2 * V::Lanes) {
+        typename V::Vector a0 = V::load(dst + i), b0 = V::load(src + i);
+        typename V::Vector a1 = V::load(dst + i + V::Lanes), b1 = V::load(src + i + V::Lanes);
+        V::store(dst + i, Op == ReduceSum ? V::add(a0, b0) : Op == ReduceMin ? V::min(a0, b0) : V::max(a0, b0));
+        V::store(dst + i + V::Lanes, Op == ReduceSum ? V::add(a1, b1) : Op == ReduceMin ? V::min(a1, b1) : V::max(a1, b1));
+    }
+    for (; i < count; i++)
+        dst[i] = combine<T, Op>(dst[i], src[i]);
+}
+
+#pragma GCC diagnostic pop
+#endif
+
+#define REDUCE_OPS(kernel, type) { kernel<type, ReduceSum>, kernel<type, ReduceMin>, kernel<type, ReduceMax> }
+
+/* Indexed by [isa][type][op] */
+static const reduceFunc_t reduceKernels[ReduceIsaCount][ReduceTypeCount][ReduceOpCount] =
+{
+    { REDUCE_OPS(reduceScalar, float), REDUCE_OPS(reduceScalar, double), REDUCE_OPS(reduceScalar, int32_t), REDUCE_OPS(reduceScalar, int64_t) },
+#ifdef REDUCE_X86
+    { REDUCE_OPS(reduceAvx2, Avx2Float), REDUCE_OPS(reduceAvx2, Avx2Double), REDUCE_OPS(reduceAvx2, Avx2Int32), REDUCE_OPS(reduceAvx2, Avx2Int64) },
+    { REDUCE_OPS(reduceAvx512, Avx512Float), REDUCE_OPS(reduceAvx512, Avx512Double), REDUCE_OPS(reduceAvx512, Avx512Int32), REDUCE_OPS(reduceAvx512, Avx512Int64) },
+#else
+    { REDUCE_OPS(reduceScalar, float), REDUCE_OPS(reduceScalar, double), REDUCE_OPS(reduceScalar, int32_t), REDUCE_OPS(reduceScalar, int64_t) },
+    { REDUCE_OPS(reduceScalar, float), REDUCE_OPS(reduceScalar, double), REDUCE_OPS(reduceScalar, int32_t), REDUCE_OPS(reduceScalar, int64_t) },
+#endif
+};
+
+/* Size of one element */
+size_t reduceTypeSize(enum ReduceType type)
+{
+    return type == ReduceFloat || type == ReduceInt32 ? 4 : 8;
+}
+
+/* Widest kernel set supported by this CPU */
+enum ReduceIsa reduceBestIsa()
+{
+#ifdef REDUCE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return ReduceAvx512;
+    if (__builtin_cpu_supports("avx2"))
+        return ReduceAvx2;
+#endif
+    return ReduceScalar;
+}
+
+/* target[i] = op(target[i], source[i]) for `count` elements */
+void reduceInto(void* target, const void* source, size_t count, enum ReduceType type, enum ReduceOp op, enum ReduceIsa isa)
+{
+    reduceKernels[isa][type][op](target, source, count);
+}
+
+const char* reduceTypeName(enum ReduceType type)
+{
+    static const char* names[ReduceTypeCount] = { "float", "double", "int32", "int64" };
+    return names[type];
+}
+
+const char* reduceOpName(enum ReduceOp op)
+{
+    static const char* names[ReduceOpCount] = { "sum", "min", "max" };
+    return names[op];
+}
+
+const char* reduceIsaName(enum ReduceIsa isa)
+{
+    static const char* names[ReduceIsaCount] = { "scalar", "avx2", "avx512" };
+    return names[isa];
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+
+enum ReduceType {
+	ReduceFloat,
+	ReduceDouble,
+	ReduceInt32,
+	ReduceInt64
+};
+
+enum ReduceOp {
+	ReduceSum,
+	ReduceMin,
+	ReduceMax
+};
+
+/* Kernel set, a wider set is only usable when the CPU supports it */
+enum ReduceIsa {
+	ReduceScalar,
+	ReduceAvx2,
+	ReduceAvx512
+};
+
+constexpr auto ReduceTypeCount = 4;
+constexpr auto ReduceOpCount = 3;
+constexpr auto ReduceIsaCount = 3;
+
+/* Size of one element */
+size_t reduceTypeSize(enum ReduceType type);
+
+/* Widest kernel set supported by this CPU */
+enum ReduceIsa reduceBestIsa();
+
+/* target[i] = op(target[i], source[i]) for `count` elements. Buffers need no alignment */
+void reduceInto(void* target, const void* source, size_t count, enum ReduceType type, enum ReduceOp op, enum ReduceIsa isa);
+
+/* Printable names */
+const char* reduceTypeName(enum ReduceType type);
+const char* reduceOpName(enum ReduceOp op);
+const char* reduceIsaName(enum ReduceIsa isa);
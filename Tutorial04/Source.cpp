@@ -68,6 +68,7 @@ int getRemoteQPInfo(struct RDMAResource* res)
     localQPInfo.rkey = htonl(res->memoryHandle->rkey);
     localQPInfo.qpNum = htonl(res->queuePair->qp_num);
     localQPInfo.lid = htons(res->portAttr.lid);
+    memcpy(localQPInfo.gid, &res->localGid, sizeof(localQPInfo.gid));
 
     if (sockSyncData(socket, sizeof(qpInfo_t), (char*)&localQPInfo, (char*)&remoteQPInfo) < 0)
     {
@@ -79,6 +80,7 @@ int getRemoteQPInfo(struct RDMAResource* res)
     res->remoteKey = ntohl(remoteQPInfo.rkey);
     res->remoteQueueNum = ntohl(remoteQPInfo.qpNum);
     res->remoteId = ntohs(remoteQPInfo.lid);
+    memcpy(&res->remoteGid, remoteQPInfo.gid, sizeof(res->remoteGid));
 
     return 1;
 }
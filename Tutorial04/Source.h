@@ -19,6 +19,7 @@ struct qpInfo_t
 	uint32_t	rkey;	/* Remote key */
 	uint32_t	qpNum;	/* QP number */
 	uint16_t	lid;	/* LID of IB port */
+	uint8_t		gid[16];	/* GID of RoCE port */
 };
 
 int socket;
\ No newline at end of file
@@ -0,0 +1,203 @@
+#include "VerbsResources.h"
+
+#include <unistd.h>
+
+/* Open HCA by kernel name, empty on failure */
+Context::Context(const char* deviceName)
+{
+    int num_devices = 0;
+    struct ibv_device** device_list = ibv_get_device_list(&num_devices);
+    if (!device_list) {
+        fprintf(stderr, "Unable to get HCA device list\n");
+        return;
+    }
+
+    for (int i = 0; i < num_devices; i++) {
+        if (!strcmp(deviceName, ibv_get_device_name(device_list[i]))) {
+            handle = ibv_open_device(device_list[i]);
+            break;
+        }
+    }
+    ibv_free_device_list(device_list);
+
+    if (!handle)
+        fprintf(stderr, "Unable to get the device: %s\n", deviceName);
+}
+
+ProtectionDomain::ProtectionDomain(const Context& context)
+    : VerbsHandle(ibv_alloc_pd(context.get()))
+{
+    if (!handle)
+        fprintf(stderr, "Allocate protection domain error\n");
+}
+
+CompletionQueue::CompletionQueue(const Context& context, int entries)
+    : VerbsHandle(ibv_create_cq(context.get(), entries, nullptr, nullptr, 0))
+{
+    if (!handle)
+        fprintf(stderr, "Failed to create CQ with %d entries\n", entries);
+}
+
+MemoryRegion::MemoryRegion(const ProtectionDomain& pd, void* addr, size_t length, int access)
+    : VerbsHandle(ibv_reg_mr(pd.get(), addr, length, access))
+{
+    if (!handle)
+        fprintf(stderr, "Register memory buffer failed with mr_flags=0x%x\n", access);
+}
+
+QueuePair::QueuePair(const ProtectionDomain& pd, const CompletionQueue& cq)
+{
+    struct ibv_qp_init_attr qpInitAttr;
+    memset(&qpInitAttr, 0, sizeof(ibv_qp_init_attr));
+    qpInitAttr.qp_type = IBV_QPT_RC;
+    qpInitAttr.sq_sig_all = 1;
+    qpInitAttr.send_cq = cq.get();
+    qpInitAttr.recv_cq = cq.get();
+    qpInitAttr.cap.max_send_wr = 1;
+    qpInitAttr.cap.max_recv_wr = 1;
+    qpInitAttr.cap.max_send_sge = 1;
+    qpInitAttr.cap.max_recv_sge = 1;
+
+    handle = ibv_create_qp(pd.get(), &qpInitAttr);
+    if (!handle)
+        fprintf(stderr, "Failed to create Queue Pair\n");
+}
+
+QueuePair::QueuePair(const ProtectionDomain& pd, struct ibv_qp_init_attr* initAttr)
+    : VerbsHandle(ibv_create_qp(pd.get(), initAttr))
+{
+    if (!handle)
+        fprintf(stderr, "Failed to create Queue Pair\n");
+}
+
+AlignedBuffer::AlignedBuffer(size_t length)
+    : data(nullptr), length(0)
+{
+    void* memory = nullptr;
+    if (posix_memalign(&memory, sysconf(_SC_PAGESIZE), length)) {
+        fprintf(stderr, "Failed to allocate %zu bytes memory buffer\n", length);
+        return;
+    }
+    data = (char*)memory;
+    this->length = length;
+    memset(data, 0, length);
+}
+
+AlignedBuffer& AlignedBuffer::operator=(AlignedBuffer&& other) noexcept
+{
+    if (this != &other) {
+        free(data);
+        data = other.data;
+        length = other.length;
+        other.data = nullptr;
+        other.length = 0;
+    }
+    return *this;
+}
+
+/* Context, port and GID queries, PD and CQ */
+int VerbsResource::open(const char* deviceName, int devicePort, int gidIndex)
+{
+    this->deviceName = deviceName;
+    this->devicePort = devicePort;
+    this->gidIndex = gidIndex;
+
+    /* A second create() releases the children before the context they were made on */
+    queuePair = QueuePair();
+    memoryHandle = MemoryRegion();
+    buffer = AlignedBuffer();
+    compQueue = CompletionQueue();
+    protectedDomain = ProtectionDomain();
+
+    context = Context(deviceName);
+    if (!context)
+        return 1;
+
+    if (ibv_query_device(context.get(), &deviceAttr)) {
+        fprintf(stderr, "Unable to query device attribute\n");
+        return 1;
+    }
+
+    if (ibv_query_port(context.get(), devicePort, &portAttr)) {
+        fprintf(stderr, "Failed to query port %d attributes in device '%s'\n", devicePort, deviceName);
+        return 1;
+    }
+
+    if (portAttr.state != IBV_PORT_ACTIVE) {
+        fprintf(stderr, "Port %d in device '%s' not in active state\n", devicePort, deviceName);
+        return 1;
+    }
+
+    memset(&localGid, 0, sizeof(localGid));
+    if (portAttr.link_layer == IBV_LINK_LAYER_ETHERNET && ibv_query_gid(context.get(), devicePort, gidIndex, &localGid)) {
+        fprintf(stderr, "Failed to query GID %d of port %d in device '%s'\n", gidIndex, devicePort, deviceName);
+        return 1;
+    }
+
+    protectedDomain = ProtectionDomain(context);
+    if (!protectedDomain)
+        return 1;
+
+    compQueue = CompletionQueue(context, QueueSize);
+    if (!compQueue)
+        return 1;
+    return 0;
+}
+
+/* Allocate and register the buffer */
+int VerbsResource::registerBuffer(size_t bufferSize, int access)
+{
+    buffer = AlignedBuffer(bufferSize);
+    if (!buffer)
+        return 1;
+
+    memoryHandle = MemoryRegion(protectedDomain, buffer.get(), buffer.size(), access);
+    if (!memoryHandle)
+        return 1;
+    return 0;
+}
+
+/* Same steps as createRDMAResource(), returns non zero on failure */
+int VerbsResource::create(const char* deviceName, int devicePort, int gidIndex)
+{
+    if (open(deviceName, devicePort, gidIndex))
+        return 1;
+    int mrFlags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
+    if (deviceAttr.atomic_cap != IBV_ATOMIC_NONE)
+        mrFlags |= IBV_ACCESS_REMOTE_ATOMIC;
+    if (registerBuffer(BufferSize, mrFlags))
+        return 1;
+
+    queuePair = QueuePair(protectedDomain, compQueue);
+    if (!queuePair)
+        return 1;
+
+    return 0;
+}
+
+/* Device, PD and CQ as create(), a `bufferSize` byte buffer registered with `access` and no QP */
+int VerbsResource::create(const char* deviceName, int devicePort, size_t bufferSize, int access, int gidIndex)
+{
+    if (open(deviceName, devicePort, gidIndex) || registerBuffer(bufferSize, access))
+        return 1;
+    return 0;
+}
+
+/* Non owning RDMAResource view for the C style helpers (modifyQPto*) */
+void VerbsResource::view(struct RDMAResource* res) const
+{
+    memset(res, 0, sizeof(RDMAResource));
+    res->deviceAttr = deviceAttr;
+    res->portAttr = portAttr;
+    res->localGid = localGid;
+    res->context = context.get();
+    res->device = context ? context->device : nullptr;
+    res->protectedDomain = protectedDomain.get();
+    res->compQueue = compQueue.get();
+    res->queuePair = queuePair.get();
+    res->memoryHandle = memoryHandle.get();
+    res->buffer = buffer.get();
+    res->deviceName = deviceName;
+    res->devicePort = devicePort;
+    res->gidIndex = gidIndex;
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "LibVerbsHelper.h"
+
+/* Move-only owner of a verbs handle, releases it with Destroy */
+template <typename T, int (*Destroy)(T*)>
+class VerbsHandle {
+public:
+	VerbsHandle() : handle(nullptr) {}
+	explicit VerbsHandle(T* handle) : handle(handle) {}
+	~VerbsHandle() { reset(); }
+
+	VerbsHandle(const VerbsHandle&) = delete;
+	VerbsHandle& operator=(const VerbsHandle&) = delete;
+
+	VerbsHandle(VerbsHandle&& other) noexcept : handle(other.release()) {}
+	VerbsHandle& operator=(VerbsHandle&& other) noexcept {
+		if (this != &other) {
+			reset();
+			handle = other.release();
+		}
+		return *this;
+	}
+
+	T* get() const { return handle; }
+	T* operator->() const { return handle; }
+	explicit operator bool() const { return handle != nullptr; }
+
+	/* Give up ownership without destroying */
+	T* release() {
+		T* released = handle;
+		handle = nullptr;
+		return released;
+	}
+
+	/* Destroy owned handle */
+	void reset() {
+		if (handle && Destroy(handle))
+			fprintf(stderr, "Failed to destroy verbs handle %p\n", (void*)handle);
+		handle = nullptr;
+	}
+
+protected:
+	T* handle;
+};
+
+/* HCA device context, closed on destruction */
+class Context : public VerbsHandle<ibv_context, ibv_close_device> {
+public:
+	Context() = default;
+	/* Open HCA by kernel name, empty on failure */
+	explicit Context(const char* deviceName);
+};
+
+/* Protection domain, deallocated on destruction */
+class ProtectionDomain : public VerbsHandle<ibv_pd, ibv_dealloc_pd> {
+public:
+	ProtectionDomain() = default;
+	explicit ProtectionDomain(const Context& context);
+};
+
+/* Completion queue, destroyed on destruction */
+class CompletionQueue : public VerbsHandle<ibv_cq, ibv_destroy_cq> {
+public:
+	CompletionQueue() = default;
+	CompletionQueue(const Context& context, int entries);
+};
+
+/* Memory registration, deregistered on destruction. Does not own the memory */
+class MemoryRegion : public VerbsHandle<ibv_mr, ibv_dereg_mr> {
+public:
+	MemoryRegion() = default;
+	MemoryRegion(const ProtectionDomain& pd, void* addr, size_t length, int access);
+
+	uint32_t lkey() const { return handle->lkey; }
+	uint32_t rkey() const { return handle->rkey; }
+};
+
+/* Queue pair, destroyed on destruction. Must not outlive its PD and CQs */
+class QueuePair : public VerbsHandle<ibv_qp, ibv_destroy_qp> {
+public:
+	QueuePair() = default;
+	/* RC QP with the same capabilities as createQueuePair() */
+	QueuePair(const ProtectionDomain& pd, const CompletionQueue& cq);
+	QueuePair(const ProtectionDomain& pd, struct ibv_qp_init_attr* initAttr);
+
+	uint32_t number() const { return handle->qp_num; }
+};
+
+/* Page aligned heap buffer */
+class AlignedBuffer {
+public:
+	AlignedBuffer() : data(nullptr), length(0) {}
+	explicit AlignedBuffer(size_t length);
+	~AlignedBuffer() { free(data); }
+
+	AlignedBuffer(const AlignedBuffer&) = delete;
+	AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+	AlignedBuffer(AlignedBuffer&& other) noexcept : data(other.data), length(other.length) {
+		other.data = nullptr;
+		other.length = 0;
+	}
+	AlignedBuffer& operator=(AlignedBuffer&& other) noexcept;
+
+	char* get() const { return data; }
+	size_t size() const { return length; }
+	explicit operator bool() const { return data != nullptr; }
+
+private:
+	char*	data;
+	size_t	length;
+};
+
+/* Owning counterpart of RDMAResource. Members are declared in creation
+ * order, so they are destroyed QP -> MR -> buffer -> CQ -> PD -> context */
+struct VerbsResource {
+	struct ibv_device_attr	deviceAttr;			/* HCA device attribute */
+	struct ibv_port_attr	portAttr;			/* IB port attributes */
+	union ibv_gid			localGid;			/* GID at gidIndex, RoCE ports only */
+	Context					context;
+	ProtectionDomain		protectedDomain;
+	CompletionQueue			compQueue;
+	AlignedBuffer			buffer;
+	MemoryRegion			memoryHandle;
+	QueuePair				queuePair;
+	const char*				deviceName;			/* HCA kernel device name */
+	int						devicePort;			/* HCA device port */
+	int						gidIndex;			/* Local GID index, RoCE ports only */
+
+	/* Same steps as createRDMAResource(), returns non zero on failure.
+	 * Whatever was created before the failure is released by the destructor */
+	int create(const char* deviceName, int devicePort, int gidIndex = 0);
+
+	/* Device, PD and CQ as above, but a `bufferSize` byte buffer registered with `access`
+	 * and no QP, for users that create their own QPs */
+	int create(const char* deviceName, int devicePort, size_t bufferSize, int access, int gidIndex = 0);
+
+	/* Non owning RDMAResource view for the C style helpers (modifyQPto*) */
+	void view(struct RDMAResource* res) const;
+
+private:
+	int open(const char* deviceName, int devicePort, int gidIndex);
+	int registerBuffer(size_t bufferSize, int access);
+};
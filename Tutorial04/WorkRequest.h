@@ -0,0 +1,225 @@
+#pragma once
+
+#include <assert.h>
+#include <vector>
+
+#include "LibVerbsHelper.h"
+
+/* Send opcodes that carry a remote address and key */
+constexpr bool isRemoteOpcode(ibv_wr_opcode opcode)
+{
+	return opcode == IBV_WR_RDMA_WRITE || opcode == IBV_WR_RDMA_WRITE_WITH_IMM || opcode == IBV_WR_RDMA_READ ||
+		opcode == IBV_WR_ATOMIC_CMP_AND_SWP || opcode == IBV_WR_ATOMIC_FETCH_AND_ADD;
+}
+
+/* Send opcodes that carry immediate data */
+constexpr bool hasImmediate(ibv_wr_opcode opcode)
+{
+	return opcode == IBV_WR_SEND_WITH_IMM || opcode == IBV_WR_RDMA_WRITE_WITH_IMM;
+}
+
+/* Send opcodes that may copy the payload into the WQE */
+constexpr bool canInline(ibv_wr_opcode opcode)
+{
+	return opcode == IBV_WR_SEND || opcode == IBV_WR_SEND_WITH_IMM ||
+		opcode == IBV_WR_RDMA_WRITE || opcode == IBV_WR_RDMA_WRITE_WITH_IMM;
+}
+
+/* Preallocated ring of send work requests for one QP. Everything that does not
+ * change between posts (opcode, flags, SGE list, keys) is filled once in the
+ * constructor, a post only stamps wr_id, addresses and lengths.
+ * A slot is reused after `depth` posts, depth must cover the send queue depth */
+template <ibv_wr_opcode Opcode, bool Inline, bool Signaled, int SgeCount = 1>
+class SendRing {
+	static_assert(SgeCount >= 1, "At least one SGE is required");
+	static_assert(!Inline || canInline(Opcode), "Opcode does not support inline data");
+
+	static constexpr unsigned int BaseFlags = (Signaled ? IBV_SEND_SIGNALED : 0) | (Inline ? IBV_SEND_INLINE : 0);
+
+public:
+	SendRing(struct ibv_qp* qp, uint32_t lkey, uint32_t rkey, uint32_t depth)
+		: qp(qp), mask(roundDepth(depth) - 1), next(0),
+		  requests(mask + 1), sgeList((mask + 1) * SgeCount)
+	{
+		for (uint32_t i = 0; i <= mask; i++) {
+			struct ibv_send_wr& wr = requests[i];
+			memset(&wr, 0, sizeof(ibv_send_wr));
+			wr.opcode = Opcode;
+			wr.sg_list = &sgeList[i * SgeCount];
+			wr.num_sge = SgeCount;
+			wr.send_flags = BaseFlags;
+			if (isRemoteOpcode(Opcode))
+				setRemoteKey(wr, rkey);
+			for (int s = 0; s < SgeCount; s++) {
+				sgeList[i * SgeCount + s].lkey = lkey;
+			}
+		}
+	}
+
+	SendRing(const SendRing&) = delete;
+	SendRing& operator=(const SendRing&) = delete;
+
+	/* Take next slot and stamp a single SGE request */
+	struct ibv_send_wr* stamp(uint64_t wrId, uint64_t addr, uint32_t length, uint64_t remoteAddr = 0, uint32_t imm = 0) {
+		struct ibv_send_wr* wr = &requests[next++ & mask];
+		wr->wr_id = wrId;
+		if (!Signaled)
+			wr->send_flags = BaseFlags;
+		wr->sg_list[0].addr = addr;
+		wr->sg_list[0].length = length;
+		if (isRemoteOpcode(Opcode))
+			setRemoteAddr(*wr, remoteAddr);
+		if (hasImmediate(Opcode))
+			wr->imm_data = imm;
+		return wr;
+	}
+
+	/* Take next slot, SGEs are stamped with setSge() */
+	struct ibv_send_wr* take(uint64_t wrId, uint64_t remoteAddr = 0, uint32_t imm = 0) {
+		struct ibv_send_wr* wr = &requests[next++ & mask];
+		wr->wr_id = wrId;
+		if (!Signaled)
+			wr->send_flags = BaseFlags;
+		if (isRemoteOpcode(Opcode))
+			setRemoteAddr(*wr, remoteAddr);
+		if (hasImmediate(Opcode))
+			wr->imm_data = imm;
+		return wr;
+	}
+
+	static void setSge(struct ibv_send_wr* wr, int index, uint64_t addr, uint32_t length) {
+		wr->sg_list[index].addr = addr;
+		wr->sg_list[index].length = length;
+	}
+
+	/* Selective signaling on an unsignaled ring, e.g. every Nth request */
+	static void signal(struct ibv_send_wr* wr) {
+		wr->send_flags |= IBV_SEND_SIGNALED;
+	}
+
+	/* Compare and swap / fetch and add operands */
+	static void setAtomic(struct ibv_send_wr* wr, uint64_t compareAdd, uint64_t swap) {
+		wr->wr.atomic.compare_add = compareAdd;
+		wr->wr.atomic.swap = swap;
+	}
+
+	/* Post one stamped request */
+	int post(struct ibv_send_wr* wr) {
+		struct ibv_send_wr* badWR = nullptr;
+		wr->next = nullptr;
+		return ibv_post_send(qp, wr, &badWR);
+	}
+
+	/* Post the last `count` stamped requests as one chain, single doorbell. Nothing is posted for 0 */
+	int postLast(uint32_t count) {
+		assert(count <= mask + 1);
+		if (!count)
+			return 0;
+		uint32_t first = next - count;
+		for (uint32_t i = 0; i + 1 < count; i++)
+			requests[(first + i) & mask].next = &requests[(first + i + 1) & mask];
+		requests[(first + count - 1) & mask].next = nullptr;
+
+		struct ibv_send_wr* badWR = nullptr;
+		return ibv_post_send(qp, &requests[first & mask], &badWR);
+	}
+
+	uint32_t depth() const { return mask + 1; }
+
+private:
+	static uint32_t roundDepth(uint32_t depth) {
+		uint32_t rounded = 1;
+		while (rounded < depth)
+			rounded <<= 1;
+		return rounded;
+	}
+
+	static void setRemoteKey(struct ibv_send_wr& wr, uint32_t rkey) {
+		if (Opcode == IBV_WR_ATOMIC_CMP_AND_SWP || Opcode == IBV_WR_ATOMIC_FETCH_AND_ADD)
+			wr.wr.atomic.rkey = rkey;
+		else
+			wr.wr.rdma.rkey = rkey;
+	}
+
+	static void setRemoteAddr(struct ibv_send_wr& wr, uint64_t remoteAddr) {
+		if (Opcode == IBV_WR_ATOMIC_CMP_AND_SWP || Opcode == IBV_WR_ATOMIC_FETCH_AND_ADD)
+			wr.wr.atomic.remote_addr = remoteAddr;
+		else
+			wr.wr.rdma.remote_addr = remoteAddr;
+	}
+
+	struct ibv_qp*					qp;
+	uint32_t						mask;
+	uint32_t						next;
+	std::vector<ibv_send_wr>		requests;
+	std::vector<ibv_sge>			sgeList;
+};
+
+/* Preallocated ring of receive work requests for one QP */
+template <int SgeCount = 1>
+class RecvRing {
+	static_assert(SgeCount >= 1, "At least one SGE is required");
+
+public:
+	RecvRing(struct ibv_qp* qp, uint32_t lkey, uint32_t depth)
+		: qp(qp), mask(roundDepth(depth) - 1), next(0),
+		  requests(mask + 1), sgeList((mask + 1) * SgeCount)
+	{
+		for (uint32_t i = 0; i <= mask; i++) {
+			struct ibv_recv_wr& wr = requests[i];
+			memset(&wr, 0, sizeof(ibv_recv_wr));
+			wr.sg_list = &sgeList[i * SgeCount];
+			wr.num_sge = SgeCount;
+			for (int s = 0; s < SgeCount; s++) {
+				sgeList[i * SgeCount + s].lkey = lkey;
+			}
+		}
+	}
+
+	RecvRing(const RecvRing&) = delete;
+	RecvRing& operator=(const RecvRing&) = delete;
+
+	/* Take next slot and stamp a single SGE request */
+	struct ibv_recv_wr* stamp(uint64_t wrId, uint64_t addr, uint32_t length) {
+		struct ibv_recv_wr* wr = &requests[next++ & mask];
+		wr->wr_id = wrId;
+		wr->sg_list[0].addr = addr;
+		wr->sg_list[0].length = length;
+		return wr;
+	}
+
+	/* Post one stamped request */
+	int post(struct ibv_recv_wr* wr) {
+		struct ibv_recv_wr* badWR = nullptr;
+		wr->next = nullptr;
+		return ibv_post_recv(qp, wr, &badWR);
+	}
+
+	/* Post the last `count` stamped requests as one chain. Nothing is posted for 0 */
+	int postLast(uint32_t count) {
+		assert(count <= mask + 1);
+		if (!count)
+			return 0;
+		uint32_t first = next - count;
+		for (uint32_t i = 0; i + 1 < count; i++)
+			requests[(first + i) & mask].next = &requests[(first + i + 1) & mask];
+		requests[(first + count - 1) & mask].next = nullptr;
+
+		struct ibv_recv_wr* badWR = nullptr;
+		return ibv_post_recv(qp, &requests[first & mask], &badWR);
+	}
+
+private:
+	static uint32_t roundDepth(uint32_t depth) {
+		uint32_t rounded = 1;
+		while (rounded < depth)
+			rounded <<= 1;
+		return rounded;
+	}
+
+	struct ibv_qp*					qp;
+	uint32_t						mask;
+	uint32_t						next;
+	std::vector<ibv_recv_wr>		requests;
+	std::vector<ibv_sge>			sgeList;
+};